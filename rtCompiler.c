@@ -1,21 +1,580 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "src/rtCompiler.h"
+
+/* The results of -link-runtime=false builds. The runtime that is linked into
+   programs by default implements the same buffer in IR and replaces
+   compiler_flush with its own. */
+static char compiler_output[COMPILER_OUTPUT_BUFFER];
+static size_t compiler_output_used;
+
+/* Write out the results printed so far. */
+__attribute__((weak)) void compiler_flush(void)
+{
+    size_t done = 0;
+    while (done < compiler_output_used)
+    {
+        ssize_t n = write(1, compiler_output + done, compiler_output_used - done);
+        if (n <= 0)
+            break;
+        done += n;
+    }
+    compiler_output_used = 0;
+}
 
 void compiler_write(int v)
 {
-    printf("The result is: %d\n", v);
+    if (compiler_output_used > COMPILER_OUTPUT_BUFFER - COMPILER_MAX_LINE)
+        compiler_flush();
+    compiler_output_used += snprintf(compiler_output + compiler_output_used, COMPILER_MAX_LINE,
+                                     COMPILER_RESULT_PREFIX "%d\n", v);
+}
+
+__attribute__((destructor)) static void compiler_output_close(void)
+{
+    compiler_flush();
+}
+
+/* The results of programs compiled with -result-format=raw or records, in the
+   layout described in src/Results.h. They go to the file COMPILER_RESULTS,
+   which is mapped and grown as it fills, or else through a buffer to the file
+   descriptor COMPILER_RESULTS_FD, standard output by default. Either is
+   written out at exit. */
+
+#define COMPILER_RESULTS_BLOCK (1 << 16)
+#define COMPILER_RESULTS_MAP_BLOCK (1 << 20)
+
+static struct
+{
+    int fd;
+    int mapped; /* buf maps the file fd, which is cap bytes long */
+    unsigned char *buf;
+    size_t pos, cap;
+} compiler_results;
+
+static void compiler_results_fail(void)
+{
+    fprintf(stderr, "Error: cannot write the results: %s\n", strerror(errno));
+    _exit(1);
+}
+
+/* Write out the buffer, or map a larger part of the file. */
+static void compiler_results_drain(void)
+{
+    if (compiler_results.mapped)
+    {
+        size_t cap = compiler_results.cap ? 2 * compiler_results.cap : COMPILER_RESULTS_MAP_BLOCK;
+        if (compiler_results.buf)
+            munmap(compiler_results.buf, compiler_results.cap);
+        if (ftruncate(compiler_results.fd, cap))
+            compiler_results_fail();
+        void *p = mmap(NULL, cap, PROT_READ | PROT_WRITE, MAP_SHARED, compiler_results.fd, 0);
+        if (p == MAP_FAILED)
+            compiler_results_fail();
+        compiler_results.buf = p;
+        compiler_results.cap = cap;
+        return;
+    }
+    for (size_t done = 0; done < compiler_results.pos;)
+    {
+        ssize_t n = write(compiler_results.fd, compiler_results.buf + done, compiler_results.pos - done);
+        if (n < 0 && errno != EINTR)
+            compiler_results_fail();
+        if (n > 0)
+            done += n;
+    }
+    compiler_results.pos = 0;
+}
+
+static void compiler_results_close(void)
+{
+    if (!compiler_results.mapped)
+    {
+        compiler_results_drain();
+        return;
+    }
+    munmap(compiler_results.buf, compiler_results.cap);
+    if (ftruncate(compiler_results.fd, compiler_results.pos))
+        compiler_results_fail();
+    close(compiler_results.fd);
+}
+
+/* Room for n more bytes, at most 12. */
+static unsigned char *compiler_results_reserve(size_t n)
+{
+    if (compiler_results.cap - compiler_results.pos < n)
+        compiler_results_drain();
+    unsigned char *p = compiler_results.buf + compiler_results.pos;
+    compiler_results.pos += n;
+    return p;
+}
+
+static void compiler_results_store(unsigned char *p, uint32_t v)
+{
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+    p[2] = (unsigned char)(v >> 16);
+    p[3] = (unsigned char)(v >> 24);
+}
+
+/* Start the results of format 1 (raw) or 2 (records). Records begin with a
+   header naming the n variables. */
+void compiler_results_open(int32_t format, const char **names, int32_t n)
+{
+    const char *path = getenv("COMPILER_RESULTS");
+    if (path && *path)
+    {
+        compiler_results.fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+        if (compiler_results.fd < 0)
+        {
+            fprintf(stderr, "Error: cannot open %s: %s\n", path, strerror(errno));
+            exit(1);
+        }
+        compiler_results.mapped = 1;
+        compiler_results_drain();
+    }
+    else
+    {
+        const char *fd = getenv("COMPILER_RESULTS_FD");
+        compiler_results.fd = fd ? atoi(fd) : 1;
+        compiler_results.buf = malloc(COMPILER_RESULTS_BLOCK);
+        compiler_results.cap = COMPILER_RESULTS_BLOCK;
+        if (!compiler_results.buf)
+        {
+            fprintf(stderr, "Error: out of memory\n");
+            exit(1);
+        }
+    }
+    atexit(compiler_results_close);
+    if (format != 2)
+        return;
+
+    unsigned char *p = compiler_results_reserve(12);
+    memcpy(p, "SRES", 4);
+    compiler_results_store(p + 4, 1);
+    compiler_results_store(p + 8, (uint32_t)n);
+    for (int32_t i = 0; i < n; ++i)
+    {
+        size_t len = strlen(names[i]);
+        compiler_results_store(compiler_results_reserve(4), (uint32_t)len);
+        for (size_t at = 0; at < len; at += 4)
+        {
+            unsigned char word[4] = {0, 0, 0, 0};
+            memcpy(word, names[i] + at, len - at < 4 ? len - at : 4);
+            memcpy(compiler_results_reserve(4), word, 4);
+        }
+    }
+}
+
+void compiler_write_raw(int32_t v)
+{
+    compiler_results_store(compiler_results_reserve(4), (uint32_t)v);
 }
 
-int compiler_read(char *s)
+void compiler_write_record(int32_t var, int32_t v)
 {
-    char buf[64];
-    int val;
-    printf("Enter a value for %s: ", s);
-    fgets(buf, sizeof(buf), stdin);
-    if (EOF == sscanf(buf, "%d", &val))
+    unsigned char *p = compiler_results_reserve(12);
+    compiler_results_store(p, 8);
+    compiler_results_store(p + 4, (uint32_t)var);
+    compiler_results_store(p + 8, (uint32_t)v);
+}
+
+/* The input of read statements: integers in decimal, with an optional sign,
+   separated by whitespace. Standard input is mapped whole if it is a regular
+   file, and read in large blocks otherwise. Reads are prompted for when the
+   input is a terminal, or as COMPILER_PROMPT says (0 for never). */
+
+#define COMPILER_INPUT_BLOCK (1 << 16)
+
+static struct
+{
+    int started;
+    int prompt;
+    int mapped;            /* the whole input is in memory */
+    const char *pos, *end; /* the part of it not parsed yet */
+    char *block;
+} compiler_input;
+
+static void compiler_input_start(void)
+{
+    const char *env = getenv("COMPILER_PROMPT");
+    compiler_input.started = 1;
+    compiler_input.prompt = env ? atoi(env) != 0 : isatty(0);
+
+    struct stat st;
+    off_t at = lseek(0, 0, SEEK_CUR);
+    if (fstat(0, &st) == 0 && S_ISREG(st.st_mode) && at >= 0 && at < st.st_size)
+    {
+        void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, 0, 0);
+        if (p != MAP_FAILED)
+        {
+            madvise(p, st.st_size, MADV_SEQUENTIAL);
+            compiler_input.mapped = 1;
+            compiler_input.pos = (const char *)p + at;
+            compiler_input.end = (const char *)p + st.st_size;
+            return;
+        }
+    }
+    compiler_input.block = malloc(COMPILER_INPUT_BLOCK);
+    if (!compiler_input.block)
     {
-        printf("Value %s is invalid\n", buf);
+        fprintf(stderr, "Error: out of memory\n");
         exit(1);
     }
-    return val;
-}
\ No newline at end of file
+}
+
+/* Read the next block of the input. Returns 0 at its end. */
+static int compiler_input_fill(void)
+{
+    if (compiler_input.mapped)
+        return 0;
+    ssize_t n;
+    do
+        n = read(0, compiler_input.block, COMPILER_INPUT_BLOCK);
+    while (n < 0 && errno == EINTR);
+    if (n <= 0)
+        return 0;
+    compiler_input.pos = compiler_input.block;
+    compiler_input.end = compiler_input.block + n;
+    return 1;
+}
+
+static int compiler_is_space(int c)
+{
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\f' || c == '\v';
+}
+
+/* Parse the next integer of the input into *v. Returns 1, 0 at the end of
+   the input, or -1 if the next word is not an int. */
+static int compiler_parse(int32_t *v)
+{
+    int c;
+    do
+    {
+        if (compiler_input.pos == compiler_input.end && !compiler_input_fill())
+            return 0;
+        c = *compiler_input.pos++;
+    } while (compiler_is_space(c));
+
+    int neg = c == '-';
+    if (c == '-' || c == '+')
+    {
+        if (compiler_input.pos == compiler_input.end && !compiler_input_fill())
+            return -1;
+        c = *compiler_input.pos++;
+    }
+    uint64_t x = 0;
+    for (;;)
+    {
+        if (c < '0' || c > '9')
+            return -1;
+        x = x * 10 + (c - '0');
+        if (x > (uint64_t)INT32_MAX + neg)
+            return -1;
+        if (compiler_input.pos == compiler_input.end && !compiler_input_fill())
+            break;
+        c = *compiler_input.pos;
+        if (compiler_is_space(c))
+            break;
+        ++compiler_input.pos;
+    }
+    *v = (int32_t)(neg ? 0u - (uint32_t)x : (uint32_t)x);
+    return 1;
+}
+
+/* Stop the program at a value the input does not have. index is -1 for a
+   variable. */
+static void compiler_input_error(int got, const char *name, int32_t index)
+{
+    char elem[16] = "";
+    if (index >= 0)
+        snprintf(elem, sizeof(elem), "[%d]", index);
+    compiler_flush();
+    if (got == 0)
+        fprintf(stderr, "Error: the input ended before a value for %s%s.\n", name, elem);
+    else
+        fprintf(stderr, "Error: the input for %s%s is not an integer.\n", name, elem);
+    exit(1);
+}
+
+static void compiler_prompt(const char *name, int32_t n)
+{
+    if (!compiler_input.started)
+        compiler_input_start();
+    if (!compiler_input.prompt)
+        return;
+    compiler_flush();
+    if (n)
+        printf("Enter %d values for %s: ", n, name);
+    else
+        printf("Enter a value for %s: ", name);
+    fflush(stdout);
+}
+
+/* Read a value into the variable name. */
+int compiler_read(const char *name)
+{
+    int32_t v;
+    compiler_prompt(name, 0);
+    int got = compiler_parse(&v);
+    if (got != 1)
+        compiler_input_error(got, name, -1);
+    return v;
+}
+
+/* Read a value into each of the n elements of the array name at a. */
+void compiler_read_array(const char *name, int32_t *a, int32_t n)
+{
+    compiler_prompt(name, n);
+    for (int32_t i = 0; i < n; ++i)
+    {
+        int got = compiler_parse(&a[i]);
+        if (got != 1)
+            compiler_input_error(got, name, i);
+    }
+}
+
+/* Stop the program at an array index out of range. */
+void compiler_index_error(int index, int size)
+{
+    compiler_flush();
+    fprintf(stderr, "Error: index %d is out of range for an array of %d elements.\n", index, size);
+    exit(1);
+}
+
+/* Write the counters of a -fprofile-generate build to path. The counts of an
+   earlier run of the same program are added, so a profile can cover several
+   runs. */
+void compiler_profile_dump(const char *path, uint64_t hash, uint64_t *counters, uint32_t n)
+{
+    FILE *f = fopen(path, "r");
+    if (f)
+    {
+        unsigned long long old_hash, count;
+        unsigned old_n;
+        if (fscanf(f, "# compiler profile %llx %u", &old_hash, &old_n) == 2 && old_hash == hash && old_n == n)
+        {
+            for (uint32_t i = 0; i < n && fscanf(f, "%llu", &count) == 1; ++i)
+                counters[i] += count;
+        }
+        fclose(f);
+    }
+
+    f = fopen(path, "w");
+    if (!f)
+    {
+        fprintf(stderr, "Error: cannot write profile %s\n", path);
+        return;
+    }
+    fprintf(f, "# compiler profile\n%016llx %u\n", (unsigned long long)hash, n);
+    for (uint32_t i = 0; i < n; ++i)
+        fprintf(f, "%llu\n", (unsigned long long)counters[i]);
+    fclose(f);
+}
+
+/* Print the report of a -fexec-profile build to stderr. kinds[i] is 0 for a
+   statement, 1 for a loop and 2 for an elif or else line without a counter.
+   cycles is NULL unless loops were timed. */
+void compiler_exec_report(const char **labels, const unsigned char *kinds, const uint64_t *counts,
+                          const uint64_t *cycles, uint32_t n, uint64_t total)
+{
+    fprintf(stderr, "Execution profile:\n%14s %8s  %s\n", "count", cycles ? "cycles" : "", "statement");
+    for (uint32_t i = 0; i < n; ++i)
+    {
+        char share[16] = "";
+        if (cycles && kinds[i] == 1 && total)
+            snprintf(share, sizeof(share), "%.1f%%", 100.0 * cycles[i] / total);
+        if (kinds[i] == 2)
+            fprintf(stderr, "%14s %8s  %s\n", "", "", labels[i]);
+        else
+            fprintf(stderr, "%14llu %8s  %s\n", (unsigned long long)counts[i], share, labels[i]);
+    }
+}
+
+/* The thread pool of parloopc. A loop of n iterations is cut into chunks of
+   consecutive iterations, and every thread starts out owning a run of them.
+   Threads take chunks from the front of their own run and, once it is empty,
+   steal from the back of the others'. Each chunk has its own partial results,
+   combined in chunk order at the end, so the result does not depend on which
+   thread ran what. Sums and products wrap, which makes the combined result
+   that of the serial loop. The pool starts on the first loop and its size is
+   COMPILER_THREADS, or else the number of processors. */
+
+#define COMPILER_MAX_THREADS 64
+#define COMPILER_CHUNKS_PER_THREAD 8
+
+typedef void (*compiler_loop_body)(void *ctx, int64_t begin, int64_t end, int32_t *partial);
+
+struct compiler_run
+{
+    pthread_mutex_t lock;
+    int64_t front, back; /* chunks [front, back) are not taken yet */
+};
+
+static struct
+{
+    pthread_once_t once;
+    int nthreads; /* including the thread that runs the loop */
+    pthread_mutex_t lock;
+    pthread_cond_t start, done;
+    unsigned generation; /* of the loop being run */
+    int busy;            /* workers still running it */
+
+    compiler_loop_body body;
+    void *ctx;
+    int64_t n, nchunks;
+    int32_t nred;
+    const int32_t *kinds;
+    int32_t *partials; /* nred per chunk */
+    struct compiler_run runs[COMPILER_MAX_THREADS];
+} compiler_pool = {PTHREAD_ONCE_INIT, 1, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+                   PTHREAD_COND_INITIALIZER};
+
+static void compiler_run_chunk(int64_t c)
+{
+    int64_t begin = c * compiler_pool.n / compiler_pool.nchunks;
+    int64_t end = (c + 1) * compiler_pool.n / compiler_pool.nchunks;
+    int32_t *partial = compiler_pool.partials + c * compiler_pool.nred;
+    for (int32_t r = 0; r < compiler_pool.nred; ++r)
+        partial[r] = compiler_pool.kinds[r] ? 1 : 0;
+    compiler_pool.body(compiler_pool.ctx, begin, end, partial);
+}
+
+/* Take a chunk from the front of run i if it is the thread's own, else from
+   the back. Returns -1 if the run is empty. */
+static int64_t compiler_take(int i, int own)
+{
+    struct compiler_run *run = &compiler_pool.runs[i];
+    int64_t c = -1;
+    pthread_mutex_lock(&run->lock);
+    if (run->front < run->back)
+        c = own ? run->front++ : --run->back;
+    pthread_mutex_unlock(&run->lock);
+    return c;
+}
+
+static void compiler_work(int self)
+{
+    int64_t c;
+    while ((c = compiler_take(self, 1)) >= 0)
+        compiler_run_chunk(c);
+    for (int k = 1; k < compiler_pool.nthreads; ++k)
+    {
+        int victim = (self + k) % compiler_pool.nthreads;
+        while ((c = compiler_take(victim, 0)) >= 0)
+            compiler_run_chunk(c);
+    }
+}
+
+static void *compiler_worker(void *arg)
+{
+    int self = (int)(intptr_t)arg;
+    unsigned seen = 0;
+    for (;;)
+    {
+        pthread_mutex_lock(&compiler_pool.lock);
+        while (compiler_pool.generation == seen)
+            pthread_cond_wait(&compiler_pool.start, &compiler_pool.lock);
+        seen = compiler_pool.generation;
+        pthread_mutex_unlock(&compiler_pool.lock);
+
+        compiler_work(self);
+
+        pthread_mutex_lock(&compiler_pool.lock);
+        if (--compiler_pool.busy == 0)
+            pthread_cond_signal(&compiler_pool.done);
+        pthread_mutex_unlock(&compiler_pool.lock);
+    }
+    return NULL;
+}
+
+static void compiler_pool_start(void)
+{
+    const char *env = getenv("COMPILER_THREADS");
+    long n = env ? atol(env) : sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1)
+        n = 1;
+    if (n > COMPILER_MAX_THREADS)
+        n = COMPILER_MAX_THREADS;
+    for (int i = 0; i < COMPILER_MAX_THREADS; ++i)
+        pthread_mutex_init(&compiler_pool.runs[i].lock, NULL);
+
+    compiler_pool.nthreads = 1;
+    for (long i = 1; i < n; ++i)
+    {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, compiler_worker, (void *)(intptr_t)i))
+            break;
+        pthread_detach(thread);
+        ++compiler_pool.nthreads;
+    }
+}
+
+/* Run iterations [0, n) of a parloopc with body. results holds the nred
+   reductions on entry and on return; kinds[r] is 0 for a sum, 1 for a
+   product. */
+void compiler_parallel_for(int64_t n, int32_t nred, const int32_t *kinds, int32_t *results, compiler_loop_body body,
+                           void *ctx)
+{
+    if (n <= 0)
+        return;
+    pthread_once(&compiler_pool.once, compiler_pool_start);
+
+    int threads = compiler_pool.nthreads;
+    int64_t nchunks = (int64_t)threads * COMPILER_CHUNKS_PER_THREAD;
+    if (nchunks > n)
+        nchunks = n;
+    int32_t *partials = malloc(sizeof(int32_t) * (nred ? nred * nchunks : 1));
+    if (!partials)
+    {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(1);
+    }
+
+    compiler_pool.body = body;
+    compiler_pool.ctx = ctx;
+    compiler_pool.n = n;
+    compiler_pool.nchunks = nchunks;
+    compiler_pool.nred = nred;
+    compiler_pool.kinds = kinds;
+    compiler_pool.partials = partials;
+    for (int i = 0; i < threads; ++i)
+    {
+        compiler_pool.runs[i].front = i * nchunks / threads;
+        compiler_pool.runs[i].back = (i + 1) * nchunks / threads;
+    }
+
+    if (threads == 1 || nchunks == 1)
+        compiler_work(0);
+    else
+    {
+        pthread_mutex_lock(&compiler_pool.lock);
+        compiler_pool.busy = threads - 1;
+        ++compiler_pool.generation;
+        pthread_cond_broadcast(&compiler_pool.start);
+        pthread_mutex_unlock(&compiler_pool.lock);
+
+        compiler_work(0);
+
+        pthread_mutex_lock(&compiler_pool.lock);
+        while (compiler_pool.busy)
+            pthread_cond_wait(&compiler_pool.done, &compiler_pool.lock);
+        pthread_mutex_unlock(&compiler_pool.lock);
+    }
+
+    for (int64_t c = 0; c < nchunks; ++c)
+        for (int32_t r = 0; r < nred; ++r)
+        {
+            uint32_t acc = (uint32_t)results[r], part = (uint32_t)partials[c * nred + r];
+            results[r] = (int32_t)(kinds[r] ? acc * part : acc + part);
+        }
+    free(partials);
+}
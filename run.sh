@@ -1,6 +1,6 @@
 cd build
 cd src
-./compiler "$(cat ../../input.txt)" > compiler.ll
-llc --filetype=obj -o=compiler.o compiler.ll
-clang -o compilerbin compiler.o ../../rtCompiler.c
+./compiler ${COMPILER_SOCKET:+--connect="$COMPILER_SOCKET"} "$(cat ../../input.txt)" -o compiler.bc
+llc --filetype=obj --relocation-model=pic -o=compiler.o compiler.bc
+clang -pthread -o compilerbin compiler.o ../../rtCompiler.c
 ./compilerbin
@@ -1,8 +1,15 @@
 #ifndef AST_H
 #define AST_H
 
+#include "SourceManager.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Allocator.h"
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
 
 // Forward declarations of classes used in the AST
 class AST;
@@ -18,6 +25,9 @@ class LogicalExpr;
 class IfStmt;
 class IterStmt;
 class elifStmt;
+class ArrayElement;
+class ArrayReduce;
+class ReadStmt;
 
 
 // ASTVisitor class defines a visitor pattern to traverse the AST
@@ -38,21 +48,97 @@ public:
   virtual void visit(IfStmt &) = 0;          // Visit the IfStmt node
   virtual void visit(IterStmt &) = 0;        // Visit the IterStmt node
   virtual void visit(elifStmt &) = 0;        // Visit the elifStmt node
+  virtual void visit(ArrayElement &) = 0;    // Visit the ArrayElement node
+  virtual void visit(ArrayReduce &) = 0;     // Visit the ArrayReduce node
+  virtual void visit(ReadStmt &) = 0;        // Visit the ReadStmt node
 };
 
 // AST class serves as the base class for all AST nodes
 class AST
 {
+  SourceLocation Loc;                        // Where the node starts in the source
+
 public:
   virtual ~AST() {}
   virtual void accept(ASTVisitor &V) = 0;    // Accept a visitor for traversal
+
+  SourceLocation getLoc() const { return Loc; }
+  void setLoc(SourceLocation L) { Loc = L; }
+};
+
+// ASTContext owns the nodes of the ASTs built with it. Nodes are bump
+// allocated and all destroyed at once by reset() or the destructor, so the
+// memory can be reused for the next program.
+class ASTContext
+{
+  llvm::BumpPtrAllocatorImpl<llvm::MallocAllocator, 65536> Alloc;
+  std::vector<AST *> Nodes;
+  std::vector<std::unique_ptr<ASTContext>> Children;
+
+public:
+  ASTContext() = default;
+  ASTContext(const ASTContext &) = delete;
+  ASTContext &operator=(const ASTContext &) = delete;
+  ~ASTContext() { reset(); }
+
+  template <typename T, typename... ArgTs>
+  T *create(ArgTs &&...Args)
+  {
+    T *Node = new (Alloc.Allocate(sizeof(T), alignof(T))) T(std::forward<ArgTs>(Args)...);
+    Nodes.push_back(Node);
+    return Node;
+  }
+
+  // Create a node located at Loc in the source.
+  template <typename T, typename... ArgTs>
+  T *createAt(SourceLocation Loc, ArgTs &&...Args)
+  {
+    T *Node = create<T>(std::forward<ArgTs>(Args)...);
+    Node->setLoc(Loc);
+    return Node;
+  }
+
+  // A context that lives as long as this one, for building nodes on another
+  // thread. Its nodes may be linked into the ASTs of this context.
+  ASTContext &createChild()
+  {
+    Children.push_back(std::make_unique<ASTContext>());
+    return *Children.back();
+  }
+
+  // Destroy all nodes and children; the first slab of the allocator is kept.
+  void reset()
+  {
+    Children.clear();
+    for (AST *Node : Nodes)
+      Node->~AST();
+    Nodes.clear();
+    Alloc.Reset();
+  }
+};
+
+// ValueRange is the interval [Lo, Hi] of the values an expression takes.
+// Lo > Hi means nothing is known: range analysis has not run, or it found
+// the expression unreachable.
+struct ValueRange
+{
+  int32_t Lo = 1;
+  int32_t Hi = 0;
+
+  bool isKnown() const { return Lo <= Hi; }
+  bool isFull() const { return Lo == INT32_MIN && Hi == INT32_MAX; }
 };
 
 // Expr class represents an expression in the AST
 class Expr : public AST
 {
+  ValueRange Range;                          // Set by Sema's range analysis
+
 public:
   Expr() {}
+
+  ValueRange getRange() const { return Range; }
+  void setRange(ValueRange R) { Range = R; }
 };
 
 class Logic : public AST
@@ -92,15 +178,21 @@ class Declaration : public Program
   using ValueVector = llvm::SmallVector<Expr *, 8>;
   VarVector Vars;                           // Stores the list of variables
   ValueVector Values;                       // Stores the list of initializers
+  llvm::SmallVector<unsigned, 8> Sizes;     // Number of elements of each array variable, 0 for an int
 
 public:
   // Declaration(llvm::SmallVector<llvm::StringRef, 8> Vars, Expr *E) : Vars(Vars), E(E) {}
-  Declaration(llvm::SmallVector<llvm::StringRef, 8> Vars, llvm::SmallVector<Expr *, 8> Values) : Vars(Vars), Values(Values) {}
+  Declaration(llvm::SmallVector<llvm::StringRef, 8> Vars, llvm::SmallVector<Expr *, 8> Values,
+              llvm::SmallVector<unsigned, 8> Sizes = {})
+      : Vars(Vars), Values(Values), Sizes(Sizes) {}
 
   VarVector::const_iterator varBegin() { return Vars.begin(); }
 
   VarVector::const_iterator varEnd() { return Vars.end(); }
 
+  // Number of elements of variable I if it is an array, else 0.
+  unsigned getSize(size_t I) { return I < Sizes.size() ? Sizes[I] : 0; }
+
   ValueVector::const_iterator valBegin() { return Values.begin(); }
 
   ValueVector::const_iterator valEnd() { return Values.end(); }
@@ -112,6 +204,27 @@ public:
 };
 
 
+// ReadStmt class represents a read statement in the AST, which reads a value
+// from the input into each variable, and one into each element of an array
+class ReadStmt : public Program
+{
+  using VarVector = llvm::SmallVector<Final *, 8>;
+  VarVector Vars;                           // Stores the variables read, in order
+
+public:
+  ReadStmt(llvm::SmallVector<Final *, 8> Vars) : Vars(Vars) {}
+
+  VarVector::const_iterator varBegin() { return Vars.begin(); }
+
+  VarVector::const_iterator varEnd() { return Vars.end(); }
+
+  virtual void accept(ASTVisitor &V) override
+  {
+    V.visit(*this);
+  }
+};
+
+
 // Final class represents a Final in the AST (either an identifier or a number)
 class Final : public Expr
 {
@@ -173,6 +286,99 @@ public:
   }
 };
 
+// The deepest the parser nests expressions and conditions, counting the
+// operations down left operands of arithmetic as one level (see leftSpine).
+// Passes after the parser recurse into the operands of an expression, and
+// this keeps them within an ordinary thread stack.
+const unsigned MaxExprDepth = 1000;
+
+// The operations down the left operands of Node, innermost first, so that
+// the leftmost operand is leftSpine(Node).front()->getLeft(). Sums of many
+// terms nest to the left as deep as they are long, so passes visit the
+// spine in a loop instead of recursing into left operands.
+inline llvm::SmallVector<BinaryOp *, 16> leftSpine(BinaryOp &Node)
+{
+  // Finds out whether an expression is a BinaryOp, since the AST has no RTTI.
+  class Matcher : public ASTVisitor
+  {
+  public:
+    BinaryOp *Match = nullptr;
+
+    virtual void visit(Final &) override {}
+    virtual void visit(BinaryOp &Node) override { Match = &Node; }
+    virtual void visit(Assignment &) override {}
+    virtual void visit(Declaration &) override {}
+    virtual void visit(Comparison &) override {}
+    virtual void visit(LogicalExpr &) override {}
+    virtual void visit(IfStmt &) override {}
+    virtual void visit(IterStmt &) override {}
+    virtual void visit(elifStmt &) override {}
+    virtual void visit(ArrayElement &) override {}
+    virtual void visit(ArrayReduce &) override {}
+    virtual void visit(ReadStmt &) override {}
+  };
+
+  llvm::SmallVector<BinaryOp *, 16> Spine = {&Node};
+  for (;;)
+  {
+    Matcher M;
+    if (Expr *Left = Spine.back()->getLeft())
+      Left->accept(M);
+    if (!M.Match)
+      break;
+    Spine.push_back(M.Match);
+  }
+  std::reverse(Spine.begin(), Spine.end());
+  return Spine;
+}
+
+// ArrayElement class represents the element Array[Index] of an array in the AST
+class ArrayElement : public Expr
+{
+  llvm::StringRef Array;                     // Name of the array
+  Expr *Index;                               // Index of the element, from 0
+
+public:
+  ArrayElement(llvm::StringRef Array, Expr *Index) : Array(Array), Index(Index) {}
+
+  llvm::StringRef getArray() { return Array; }
+
+  Expr *getIndex() { return Index; }
+
+  virtual void accept(ASTVisitor &V) override
+  {
+    V.visit(*this);
+  }
+};
+
+// ArrayReduce class represents sum(a), min(a) or max(a) of an array in the AST
+class ArrayReduce : public Expr
+{
+public:
+  enum Operator
+  {
+    Sum,
+    Min,
+    Max
+  };
+
+private:
+  llvm::StringRef Array;                     // Name of the array
+  Operator Op;                               // How its elements are combined
+
+public:
+  ArrayReduce(Operator Op, llvm::StringRef Array) : Array(Array), Op(Op) {}
+
+  llvm::StringRef getArray() { return Array; }
+
+  Operator getOperator() { return Op; }
+
+  virtual void accept(ASTVisitor &V) override
+  {
+    V.visit(*this);
+  }
+};
+
 // Assignment class represents an assignment expression in the AST
 class Assignment : public Program
 {
@@ -191,12 +397,15 @@ private:
   Final *Left;                             // Left-hand side Final (identifier)
   Expr *Right;                              // Right-hand side expression
   AssignKind AK;                            // Kind of assignment
+  Expr *Index;                              // Element of the array Left assigned, or nullptr
 
 public:
-  Assignment(Final *L, Expr *R, AssignKind AK) : Left(L), Right(R), AK(AK) {}
+  Assignment(Final *L, Expr *R, AssignKind AK, Expr *Index = nullptr) : Left(L), Right(R), AK(AK), Index(Index) {}
 
   Final *getLeft() { return Left; }
 
+  Expr *getIndex() { return Index; }
+
   Expr *getRight() { return Right; }
 
   AssignKind getAssignKind() { return AK; }
@@ -330,6 +539,16 @@ public:
   }
 };
 
+// LoopHints holds the tuning annotations written after loopc (0 means not given)
+struct LoopHints
+{
+  unsigned Unroll = 0;                       // unroll(N)
+  unsigned VectorizeWidth = 0;               // vectorize(N)
+  unsigned Interleave = 0;                   // interleave(N)
+
+  bool empty() const { return !Unroll && !VectorizeWidth && !Interleave; }
+};
+
 class IterStmt : public Program
 {
 using assignmentsVector = llvm::SmallVector<Assignment *, 8>;
@@ -337,12 +556,18 @@ assignmentsVector assignments;
 
 private:
   Logic *Cond;
+  LoopHints Hints;
+  bool Parallel;                             // parloopc, see ParallelLoop.h
 
 public:
-  IterStmt(Logic *Cond, llvm::SmallVector<Assignment *, 8> assignments) : Cond(Cond), assignments(assignments) {}
+  IterStmt(Logic *Cond, llvm::SmallVector<Assignment *, 8> assignments, LoopHints Hints = LoopHints(), bool Parallel = false) : Cond(Cond), assignments(assignments), Hints(Hints), Parallel(Parallel) {}
 
   Logic *getCond() { return Cond; }
 
+  const LoopHints &getHints() { return Hints; }
+
+  bool isParallel() { return Parallel; }
+
   assignmentsVector::const_iterator begin() { return assignments.begin(); }
 
   assignmentsVector::const_iterator end() { return assignments.end(); }
@@ -0,0 +1,732 @@
+#include "ASTCache.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/EndianStream.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/FileUtilities.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/xxhash.h"
+#include <vector>
+
+using namespace llvm;
+
+namespace cache
+{
+  enum NodeKind : uint8_t
+  {
+    KFinal,       // kind | ValueKind << 8, loc, string
+    KBinaryOp,    // kind | Operator << 8, loc, left, right
+    KComparison,  // kind | Operator << 8, loc, left, right
+    KLogicalExpr, // kind | Operator << 8, loc, left, right
+    KAssignment,  // kind | AssignKind << 8, loc, left, right
+    KDeclaration, // kind, loc, #vars, #values, (offset, length, size) of each var..., values...
+    KElif,        // kind, loc, cond, #body, body...
+    KIf,          // kind, loc, cond, #if, #elif, #else, if..., elif..., else...
+    KIter,        // kind | parallel << 8, loc, cond, unroll, vectorize, interleave, #body, body...
+    KProgram,     // kind, loc, #stmts, stmts...
+    KElement,     // kind, loc, string, index
+    KReduce,      // kind | Operator << 8, loc, string
+    KElementAssignment, // kind | AssignKind << 8, loc, left, right, index
+    KRead         // kind, loc, #vars, vars...
+  };
+
+  const uint32_t Magic = 0x54534153; // "SAST"
+  const uint32_t Version = 4;
+
+  // Header words: magic, version, source hash (low, high), source size,
+  // number of strings, number of node words, payload hash (low, high).
+  const unsigned HeaderWords = 9;
+
+  // Appends the records of a tree, children first.
+  class Writer : public ASTVisitor
+  {
+    StringRef Source;
+    uint32_t LocBase;  // offset of Source in the buffer the locations point into
+    bool Valid = true; // all names and locations are in Source
+    StringMap<uint32_t> StringIds;
+    std::vector<StringRef> Strings;
+    std::vector<uint32_t> Uses; // ids of the identifiers
+    std::vector<uint32_t> Words;
+    uint32_t NumNodes = 0;
+
+    // Offset of S in Source.
+    uint32_t offsetOf(StringRef S)
+    {
+      if (S.begin() < Source.begin() || S.end() > Source.end())
+      {
+        Valid = false;
+        return 0;
+      }
+      return S.begin() - Source.begin();
+    }
+
+    uint32_t string(StringRef S)
+    {
+      auto It = StringIds.try_emplace(S, Strings.size());
+      if (It.second)
+        Strings.push_back(S);
+      return It.first->second;
+    }
+
+    // Id of the name of a variable the tree reads or assigns.
+    uint32_t use(StringRef Name)
+    {
+      size_t NumStrings = Strings.size();
+      uint32_t Id = string(Name);
+      if (Strings.size() != NumStrings)
+        Uses.push_back(Id);
+      return Id;
+    }
+
+    uint32_t node(AST *Node)
+    {
+      Node->accept(*this);
+      return NumNodes - 1;
+    }
+
+    template <typename It> std::vector<uint32_t> nodes(It Begin, It End)
+    {
+      std::vector<uint32_t> Ids;
+      for (; Begin != End; ++Begin)
+        Ids.push_back(node(*Begin));
+      return Ids;
+    }
+
+    void record(NodeKind Kind, unsigned Op, AST &Node, std::initializer_list<uint32_t> Fields)
+    {
+      uint32_t Loc = Node.getLoc().getRawEncoding();
+      if (Loc && (Loc <= LocBase || Loc - LocBase > Source.size()))
+        Valid = false;
+      Words.push_back(Kind | Op << 8);
+      Words.push_back(Loc ? Loc - LocBase : 0);
+      Words.insert(Words.end(), Fields);
+      ++NumNodes;
+    }
+
+    void append(const std::vector<uint32_t> &Ids) { Words.insert(Words.end(), Ids.begin(), Ids.end()); }
+
+    // The (offset, length) pairs of the strings; clears Valid if one is not
+    // in Source.
+    std::vector<uint32_t> stringTable()
+    {
+      std::vector<uint32_t> Table;
+      for (StringRef S : Strings)
+      {
+        Table.push_back(offsetOf(S));
+        Table.push_back(S.size());
+      }
+      return Table;
+    }
+
+  public:
+    // Locations are written relative to LocBase, the offset of Source in
+    // the buffer that was parsed.
+    Writer(StringRef Source, uint32_t LocBase = 0) : Source(Source), LocBase(LocBase) {}
+
+    virtual void visit(Final &Node) override
+    {
+      uint32_t Id = Node.getKind() == Final::Ident ? use(Node.getVal()) : string(Node.getVal());
+      record(KFinal, Node.getKind(), Node, {Id});
+    }
+
+    virtual void visit(ArrayElement &Node) override
+    {
+      uint32_t Index = node(Node.getIndex());
+      record(KElement, 0, Node, {use(Node.getArray()), Index});
+    }
+
+    virtual void visit(ArrayReduce &Node) override
+    {
+      record(KReduce, Node.getOperator(), Node, {use(Node.getArray())});
+    }
+
+    virtual void visit(BinaryOp &Node) override
+    {
+      SmallVector<BinaryOp *, 16> Spine = leftSpine(Node);
+      uint32_t L = node(Spine.front()->getLeft());
+      for (BinaryOp *Op : Spine)
+      {
+        uint32_t R = node(Op->getRight());
+        record(KBinaryOp, Op->getOperator(), *Op, {L, R});
+        L = NumNodes - 1;
+      }
+    }
+
+    virtual void visit(Comparison &Node) override
+    {
+      uint32_t L = node(Node.getLeft());
+      uint32_t R = node(Node.getRight());
+      record(KComparison, Node.getOperator(), Node, {L, R});
+    }
+
+    virtual void visit(LogicalExpr &Node) override
+    {
+      uint32_t L = node(Node.getLeft());
+      uint32_t R = node(Node.getRight());
+      record(KLogicalExpr, Node.getOperator(), Node, {L, R});
+    }
+
+    virtual void visit(Assignment &Node) override
+    {
+      uint32_t L = node(Node.getLeft());
+      uint32_t R = node(Node.getRight());
+      if (Node.getIndex())
+        record(KElementAssignment, Node.getAssignKind(), Node, {L, R, node(Node.getIndex())});
+      else
+        record(KAssignment, Node.getAssignKind(), Node, {L, R});
+    }
+
+    virtual void visit(Declaration &Node) override
+    {
+      // Each name is kept at its own place in the source, where diagnostics
+      // and debug info find its line.
+      std::vector<uint32_t> Vars;
+      for (auto I = Node.varBegin(), E = Node.varEnd(); I != E; ++I)
+      {
+        Vars.push_back(offsetOf(*I));
+        Vars.push_back(I->size());
+        Vars.push_back(Node.getSize(I - Node.varBegin()));
+      }
+      std::vector<uint32_t> Values = nodes(Node.valBegin(), Node.valEnd());
+      record(KDeclaration, 0, Node, {uint32_t(Vars.size() / 3), uint32_t(Values.size())});
+      append(Vars);
+      append(Values);
+    }
+
+    virtual void visit(ReadStmt &Node) override
+    {
+      std::vector<uint32_t> Vars = nodes(Node.varBegin(), Node.varEnd());
+      record(KRead, 0, Node, {uint32_t(Vars.size())});
+      append(Vars);
+    }
+
+    virtual void visit(elifStmt &Node) override
+    {
+      uint32_t Cond = node(Node.getCond());
+      std::vector<uint32_t> Body = nodes(Node.begin(), Node.end());
+      record(KElif, 0, Node, {Cond, uint32_t(Body.size())});
+      append(Body);
+    }
+
+    virtual void visit(IfStmt &Node) override
+    {
+      uint32_t Cond = node(Node.getCond());
+      std::vector<uint32_t> If = nodes(Node.begin(), Node.end());
+      std::vector<uint32_t> Elif = nodes(Node.beginElif(), Node.endElif());
+      std::vector<uint32_t> Else = nodes(Node.beginElse(), Node.endElse());
+      record(KIf, 0, Node, {Cond, uint32_t(If.size()), uint32_t(Elif.size()), uint32_t(Else.size())});
+      append(If);
+      append(Elif);
+      append(Else);
+    }
+
+    virtual void visit(IterStmt &Node) override
+    {
+      uint32_t Cond = node(Node.getCond());
+      std::vector<uint32_t> Body = nodes(Node.begin(), Node.end());
+      const LoopHints &Hints = Node.getHints();
+      record(KIter, Node.isParallel(), Node, {Cond, Hints.Unroll, Hints.VectorizeWidth, Hints.Interleave, uint32_t(Body.size())});
+      append(Body);
+    }
+
+    virtual void visit(Program &Node) override
+    {
+      std::vector<uint32_t> Stmts = nodes(Node.begin(), Node.end());
+      record(KProgram, 0, Node, {uint32_t(Stmts.size())});
+      append(Stmts);
+    }
+
+    bool write(raw_ostream &OS)
+    {
+      std::vector<uint32_t> Table = stringTable();
+      if (!Valid)
+        return false;
+
+      // The payload is the string table and the records, as they are
+      // written, so that the reader can hash it before decoding anything.
+      SmallString<0> Payload;
+      raw_svector_ostream PayloadOS(Payload);
+      support::endian::Writer PayloadOut(PayloadOS, support::little);
+      for (uint32_t W : Table)
+        PayloadOut.write<uint32_t>(W);
+      for (uint32_t W : Words)
+        PayloadOut.write<uint32_t>(W);
+
+      uint64_t Hash = xxHash64(Source);
+      uint64_t PayloadHash = xxHash64(Payload);
+      support::endian::Writer Out(OS, support::little);
+      auto Put = [&Out](uint32_t V) { Out.write<uint32_t>(V); };
+      Put(Magic);
+      Put(Version);
+      Put(uint32_t(Hash));
+      Put(uint32_t(Hash >> 32));
+      Put(Source.size());
+      Put(Strings.size());
+      Put(Words.size());
+      Put(uint32_t(PayloadHash));
+      Put(uint32_t(PayloadHash >> 32));
+      OS << Payload;
+      return true;
+    }
+
+    // Write the tree as a statement of the incremental index: the number of
+    // strings and uses, the string table, the uses and the records.
+    bool writeStmt(raw_ostream &OS)
+    {
+      std::vector<uint32_t> Table = stringTable();
+      if (!Valid)
+        return false;
+
+      support::endian::Writer Out(OS, support::little);
+      auto Put = [&Out](uint32_t V) { Out.write<uint32_t>(V); };
+      Put(Strings.size());
+      Put(Uses.size());
+      for (uint32_t W : Table)
+        Put(W);
+      for (uint32_t W : Uses)
+        Put(W);
+      for (uint32_t W : Words)
+        Put(W);
+      return true;
+    }
+  };
+
+  // Builds the nodes of the records in order, checking every field, so a
+  // damaged file is rejected instead of producing a broken tree.
+  class Reader
+  {
+    ASTContext &Ctx;
+    StringRef Source;
+    uint32_t LocBase;
+    ArrayRef<StringRef> Strings;
+    const char *Words;
+    uint32_t NumWords;
+    uint32_t Pos = 0;
+    std::vector<std::pair<NodeKind, AST *>> Nodes;
+    bool IndexesArrays = false;
+
+    bool next(uint32_t &V)
+    {
+      if (Pos >= NumWords)
+        return false;
+      V = support::endian::read32le(Words + 4 * Pos++);
+      return true;
+    }
+
+    // Read the index of an earlier node.
+    bool childId(uint32_t &Id) { return next(Id) && Id < Nodes.size(); }
+
+    // Read an earlier node of kind Kind, whose class is T.
+    template <typename T> bool child(T *&Node, NodeKind Kind)
+    {
+      uint32_t Id;
+      if (!childId(Id) || Nodes[Id].first != Kind)
+        return false;
+      Node = static_cast<T *>(Nodes[Id].second);
+      return true;
+    }
+
+    bool expr(Expr *&E)
+    {
+      uint32_t Id;
+      if (!childId(Id))
+        return false;
+      switch (Nodes[Id].first)
+      {
+      case KFinal:
+        E = static_cast<Final *>(Nodes[Id].second);
+        return true;
+      case KBinaryOp:
+        E = static_cast<BinaryOp *>(Nodes[Id].second);
+        return true;
+      case KElement:
+        E = static_cast<ArrayElement *>(Nodes[Id].second);
+        return true;
+      case KReduce:
+        E = static_cast<ArrayReduce *>(Nodes[Id].second);
+        return true;
+      default:
+        return false;
+      }
+    }
+
+    bool logic(Logic *&L)
+    {
+      uint32_t Id;
+      if (!childId(Id))
+        return false;
+      switch (Nodes[Id].first)
+      {
+      case KComparison:
+        L = static_cast<Comparison *>(Nodes[Id].second);
+        return true;
+      case KLogicalExpr:
+        L = static_cast<LogicalExpr *>(Nodes[Id].second);
+        return true;
+      default:
+        return false;
+      }
+    }
+
+    bool assignments(uint32_t N, SmallVector<Assignment *, 8> &Out)
+    {
+      for (uint32_t I = 0; I < N; ++I)
+      {
+        uint32_t Id;
+        if (!childId(Id) || (Nodes[Id].first != KAssignment && Nodes[Id].first != KElementAssignment))
+          return false;
+        Out.push_back(static_cast<Assignment *>(Nodes[Id].second));
+      }
+      return true;
+    }
+
+    template <typename T> void add(NodeKind Kind, T *Node, uint32_t Loc)
+    {
+      Node->setLoc(SourceLocation::getFromRawEncoding(Loc ? Loc + LocBase : 0));
+      Nodes.push_back({Kind, Node});
+    }
+
+    bool readNode()
+    {
+      uint32_t Head, Loc;
+      if (!next(Head) || !next(Loc))
+        return false;
+      NodeKind Kind = NodeKind(Head & 0xff);
+      unsigned Op = Head >> 8;
+      IndexesArrays |= Kind == KElement || Kind == KReduce || Kind == KElementAssignment;
+
+      switch (Kind)
+      {
+      case KFinal:
+      {
+        uint32_t Id;
+        if (Op > Final::Number || !next(Id) || Id >= Strings.size())
+          return false;
+        add(Kind, Ctx.create<Final>(Final::ValueKind(Op), Strings[Id]), Loc);
+        return true;
+      }
+      case KBinaryOp:
+      {
+        Expr *L, *R;
+        if (Op > BinaryOp::Exp || !expr(L) || !expr(R))
+          return false;
+        add(Kind, Ctx.create<BinaryOp>(BinaryOp::Operator(Op), L, R), Loc);
+        return true;
+      }
+      case KComparison:
+      {
+        Expr *L, *R;
+        if (Op > Comparison::Less_equal || !expr(L) || !expr(R))
+          return false;
+        add(Kind, Ctx.create<Comparison>(L, R, Comparison::Operator(Op)), Loc);
+        return true;
+      }
+      case KLogicalExpr:
+      {
+        Logic *L, *R;
+        if (Op > LogicalExpr::Or || !logic(L) || !logic(R))
+          return false;
+        add(Kind, Ctx.create<LogicalExpr>(L, R, LogicalExpr::Operator(Op)), Loc);
+        return true;
+      }
+      case KAssignment:
+      {
+        Final *L;
+        Expr *R;
+        if (Op > Assignment::Exp_assign || !child(L, KFinal) || !expr(R))
+          return false;
+        add(Kind, Ctx.create<Assignment>(L, R, Assignment::AssignKind(Op)), Loc);
+        return true;
+      }
+      case KElementAssignment:
+      {
+        Final *L;
+        Expr *R, *Index;
+        if (Op > Assignment::Exp_assign || !child(L, KFinal) || !expr(R) || !expr(Index))
+          return false;
+        add(Kind, Ctx.create<Assignment>(L, R, Assignment::AssignKind(Op), Index), Loc);
+        return true;
+      }
+      case KElement:
+      {
+        uint32_t Id;
+        Expr *Index;
+        if (Op != 0 || !next(Id) || Id >= Strings.size() || !expr(Index))
+          return false;
+        add(Kind, Ctx.create<ArrayElement>(Strings[Id], Index), Loc);
+        return true;
+      }
+      case KReduce:
+      {
+        uint32_t Id;
+        if (Op > ArrayReduce::Max || !next(Id) || Id >= Strings.size())
+          return false;
+        add(Kind, Ctx.create<ArrayReduce>(ArrayReduce::Operator(Op), Strings[Id]), Loc);
+        return true;
+      }
+      case KDeclaration:
+      {
+        uint32_t NumVars, NumValues;
+        if (!next(NumVars) || !next(NumValues))
+          return false;
+        SmallVector<StringRef, 8> Vars;
+        SmallVector<Expr *, 8> Values;
+        SmallVector<unsigned, 8> Sizes;
+        for (uint32_t I = 0; I < NumVars; ++I)
+        {
+          uint32_t Offset, Length, Size;
+          if (!next(Offset) || !next(Length) || !next(Size) || uint64_t(Offset) + Length > Source.size())
+            return false;
+          Vars.push_back(Source.substr(Offset, Length));
+          Sizes.push_back(Size);
+        }
+        for (uint32_t I = 0; I < NumValues; ++I)
+        {
+          Expr *E;
+          if (!expr(E))
+            return false;
+          Values.push_back(E);
+        }
+        add(Kind, Ctx.create<Declaration>(Vars, Values, Sizes), Loc);
+        return true;
+      }
+      case KRead:
+      {
+        uint32_t N;
+        SmallVector<Final *, 8> Vars;
+        if (!next(N))
+          return false;
+        for (uint32_t I = 0; I < N; ++I)
+        {
+          Final *Var;
+          if (!child(Var, KFinal) || Var->getKind() != Final::Ident)
+            return false;
+          Vars.push_back(Var);
+        }
+        add(Kind, Ctx.create<ReadStmt>(Vars), Loc);
+        return true;
+      }
+      case KElif:
+      {
+        Logic *Cond;
+        uint32_t N;
+        SmallVector<Assignment *, 8> Body;
+        if (!logic(Cond) || !next(N) || !assignments(N, Body))
+          return false;
+        add(Kind, Ctx.create<elifStmt>(Cond, Body), Loc);
+        return true;
+      }
+      case KIf:
+      {
+        Logic *Cond;
+        uint32_t NumIf, NumElif, NumElse;
+        SmallVector<Assignment *, 8> If, Else;
+        SmallVector<elifStmt *, 8> Elifs;
+        if (!logic(Cond) || !next(NumIf) || !next(NumElif) || !next(NumElse) || !assignments(NumIf, If))
+          return false;
+        for (uint32_t I = 0; I < NumElif; ++I)
+        {
+          elifStmt *Elif;
+          if (!child(Elif, KElif))
+            return false;
+          Elifs.push_back(Elif);
+        }
+        if (!assignments(NumElse, Else))
+          return false;
+        add(Kind, Ctx.create<IfStmt>(Cond, If, Else, Elifs), Loc);
+        return true;
+      }
+      case KIter:
+      {
+        Logic *Cond;
+        LoopHints Hints;
+        uint32_t N;
+        SmallVector<Assignment *, 8> Body;
+        if (!logic(Cond) || !next(Hints.Unroll) || !next(Hints.VectorizeWidth) || !next(Hints.Interleave) ||
+            !next(N) || !assignments(N, Body))
+          return false;
+        add(Kind, Ctx.create<IterStmt>(Cond, Body, Hints, Op != 0), Loc);
+        return true;
+      }
+      case KProgram:
+      {
+        uint32_t N;
+        if (!next(N))
+          return false;
+        SmallVector<AST *> Stmts;
+        for (uint32_t I = 0; I < N; ++I)
+        {
+          uint32_t Id;
+          if (!childId(Id))
+            return false;
+          NodeKind StmtKind = Nodes[Id].first;
+          if (StmtKind != KDeclaration && StmtKind != KAssignment && StmtKind != KElementAssignment &&
+              StmtKind != KIf && StmtKind != KIter && StmtKind != KRead)
+            return false;
+          Stmts.push_back(Nodes[Id].second);
+        }
+        add(Kind, Ctx.create<Program>(Stmts), Loc);
+        return true;
+      }
+      }
+      return false;
+    }
+
+  public:
+    Reader(ASTContext &Ctx, StringRef Source, uint32_t LocBase, ArrayRef<StringRef> Strings, const char *Words,
+           uint32_t NumWords)
+        : Ctx(Ctx), Source(Source), LocBase(LocBase), Strings(Strings), Words(Words), NumWords(NumWords) {}
+
+    // Read all records. Returns the last node, the root, or nullptr if the
+    // records are damaged; Kind is set to its kind.
+    AST *read(NodeKind &Kind)
+    {
+      while (Pos < NumWords)
+        if (!readNode())
+          return nullptr;
+      if (Nodes.empty())
+        return nullptr;
+      Kind = Nodes.back().first;
+      return Nodes.back().second;
+    }
+
+    // Whether the records had elements or sums of arrays.
+    bool indexesArrays() const { return IndexesArrays; }
+  };
+
+  // Read Num (offset, length) pairs at Table into strings of Source.
+  bool readStrings(const char *Table, uint64_t Num, StringRef Source, std::vector<StringRef> &Strings)
+  {
+    Strings.reserve(Num);
+    for (uint64_t I = 0; I < Num; ++I)
+    {
+      uint64_t Offset = support::endian::read32le(Table + 8 * I);
+      uint64_t Length = support::endian::read32le(Table + 8 * I + 4);
+      if (Offset + Length > Source.size())
+        return false;
+      Strings.push_back(Source.substr(Offset, Length));
+    }
+    return true;
+  }
+
+  std::string cachePath(StringRef Dir, StringRef Source)
+  {
+    SmallString<128> Path(Dir);
+    sys::path::append(Path, utohexstr(xxHash64(Source)) + ".ast");
+    return std::string(Path.str());
+  }
+} // namespace cache
+
+bool writeBinaryAST(Program *Tree, StringRef Source, raw_ostream &OS)
+{
+  cache::Writer W(Source);
+  Tree->accept(W);
+  return W.write(OS);
+}
+
+Program *readBinaryAST(StringRef Data, StringRef Source, ASTContext &Ctx)
+{
+  if (Data.size() < 4 * cache::HeaderWords)
+    return nullptr;
+  auto Word = [&Data](uint64_t I) { return support::endian::read32le(Data.data() + 4 * I); };
+
+  uint64_t Hash = xxHash64(Source);
+  if (Word(0) != cache::Magic || Word(1) != cache::Version || Word(2) != uint32_t(Hash) ||
+      Word(3) != uint32_t(Hash >> 32) || Word(4) != Source.size())
+    return nullptr;
+  uint64_t NumStrings = Word(5), NumWords = Word(6);
+  uint64_t Table = cache::HeaderWords;
+  uint64_t Nodes = Table + 2 * NumStrings;
+  if (4 * (Nodes + NumWords) != Data.size())
+    return nullptr;
+  // A damaged or truncated file is a miss, not a tree with wrong contents.
+  uint64_t PayloadHash = xxHash64(Data.drop_front(4 * Table));
+  if (Word(7) != uint32_t(PayloadHash) || Word(8) != uint32_t(PayloadHash >> 32))
+    return nullptr;
+
+  std::vector<StringRef> Strings;
+  if (!cache::readStrings(Data.data() + 4 * Table, NumStrings, Source, Strings))
+    return nullptr;
+
+  cache::NodeKind Kind;
+  AST *Root = cache::Reader(Ctx, Source, 0, Strings, Data.data() + 4 * Nodes, NumWords).read(Kind);
+  return Root && Kind == cache::KProgram ? static_cast<Program *>(Root) : nullptr;
+}
+
+bool writeBinaryStmt(AST *Stmt, StringRef Text, SourceLocation TextLoc, raw_ostream &OS)
+{
+  cache::Writer W(Text, TextLoc.getOffset());
+  Stmt->accept(W);
+  return W.writeStmt(OS);
+}
+
+AST *readBinaryStmt(StringRef Data, StringRef Text, SourceLocation TextLoc, ASTContext &Ctx, CheckedStmt &Scope)
+{
+  if (Data.size() < 8 || Data.size() % 4)
+    return nullptr;
+  auto Word = [&Data](uint64_t I) { return support::endian::read32le(Data.data() + 4 * I); };
+  uint64_t NumStrings = Word(0), NumUses = Word(1);
+  uint64_t Table = 2, UseIds = Table + 2 * NumStrings, Nodes = UseIds + NumUses;
+  if (4 * Nodes > Data.size())
+    return nullptr;
+
+  std::vector<StringRef> Strings;
+  if (!cache::readStrings(Data.data() + 4 * Table, NumStrings, Text, Strings))
+    return nullptr;
+  for (uint64_t I = 0; I < NumUses; ++I)
+  {
+    uint32_t Id = Word(UseIds + I);
+    if (Id >= Strings.size())
+      return nullptr;
+    Scope.Uses.push_back(Strings[Id]);
+  }
+
+  cache::NodeKind Kind;
+  cache::Reader R(Ctx, Text, TextLoc.getOffset(), Strings, Data.data() + 4 * Nodes, Data.size() / 4 - Nodes);
+  AST *Stmt = R.read(Kind);
+  if (!Stmt)
+    return nullptr;
+  Scope.IndexesArrays = R.indexesArrays();
+  switch (Kind)
+  {
+  case cache::KDeclaration:
+  {
+    auto *Decl = static_cast<Declaration *>(Stmt);
+    Scope.Decls.append(Decl->varBegin(), Decl->varEnd());
+    for (size_t I = 0, E = Decl->varEnd() - Decl->varBegin(); I != E; ++I)
+      Scope.DeclSizes.push_back(Decl->getSize(I));
+    return Stmt;
+  }
+  case cache::KAssignment:
+  case cache::KElementAssignment:
+  case cache::KIf:
+  case cache::KIter:
+  case cache::KRead:
+    return Stmt;
+  default:
+    return nullptr;
+  }
+}
+
+Program *loadCachedAST(StringRef Dir, StringRef Source, ASTContext &Ctx)
+{
+  auto Buffer = MemoryBuffer::getFile(cache::cachePath(Dir, Source), /*IsText=*/false,
+                                      /*RequiresNullTerminator=*/false);
+  if (!Buffer)
+    return nullptr;
+  return readBinaryAST((*Buffer)->getBuffer(), Source, Ctx);
+}
+
+void storeCachedAST(StringRef Dir, StringRef Source, Program *Tree)
+{
+  if (sys::fs::create_directories(Dir))
+    return;
+  SmallString<0> Data;
+  raw_svector_ostream OS(Data);
+  if (!writeBinaryAST(Tree, Source, OS))
+    return;
+  std::string Path = cache::cachePath(Dir, Source);
+  consumeError(writeFileAtomically(Path + ".tmp%%%%%%", Path, Data));
+}
@@ -0,0 +1,59 @@
+#ifndef ASTCACHE_H
+#define ASTCACHE_H
+
+#include "AST.h"
+#include "Sema.h"
+#include "SourceManager.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstdint>
+
+// The binary AST format stores a parsed program without pointers, so a file
+// can be mapped at any address and decoded without lexing or parsing:
+//
+//   header      magic "SAST", version, hash and size of the source, counts
+//               of the strings and node words, hash of everything after it
+//   strings     the distinct identifiers and numbers, each as the offset and
+//               length of one occurrence in the source
+//   nodes       one record of 32-bit words per node in post order; children
+//               are referred to by the index of their record
+//
+// The last record is the Program. All values are little endian. Names are
+// not copied: like the parser's, the decoded nodes point into the source, so
+// the file can be unmapped once it is read.
+
+// Write Tree, parsed from Source, in the binary AST format. Returns false if
+// the tree has names that are not in Source.
+bool writeBinaryAST(Program *Tree, llvm::StringRef Source, llvm::raw_ostream &OS);
+
+// Build the nodes stored in Data in Ctx. Returns nullptr if Data is not a
+// well-formed AST of Source.
+Program *readBinaryAST(llvm::StringRef Data, llvm::StringRef Source, ASTContext &Ctx);
+
+// The incremental index (see Incremental.h) stores each top-level statement
+// on its own, with the names in it and its locations relative to the start
+// of its text, so that it can be decoded wherever that text moves to:
+//
+//   #strings, #uses, strings, uses (ids of the identifiers), nodes
+//
+// where the last record is the statement.
+
+// Write Stmt, parsed from Text, which starts at TextLoc, as an index entry.
+// Returns false if the statement is not all inside Text.
+bool writeBinaryStmt(AST *Stmt, llvm::StringRef Text, SourceLocation TextLoc, llvm::raw_ostream &OS);
+
+// Build the statement stored in Data in Ctx, located in Text, which now
+// starts at TextLoc, and add the names it declares and uses to Scope.
+// Returns nullptr if Data is damaged.
+AST *readBinaryStmt(llvm::StringRef Data, llvm::StringRef Text, SourceLocation TextLoc, ASTContext &Ctx,
+                    CheckedStmt &Scope);
+
+// Look up the AST of Source in the cache directory Dir. Returns nullptr on a
+// miss.
+Program *loadCachedAST(llvm::StringRef Dir, llvm::StringRef Source, ASTContext &Ctx);
+
+// Store the AST of Source in the cache directory Dir. Failures are ignored,
+// the cache only saves time.
+void storeCachedAST(llvm::StringRef Dir, llvm::StringRef Source, Program *Tree);
+
+#endif
@@ -0,0 +1,198 @@
+#include "ASTPrinter.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+namespace
+print{
+  // Prints expressions with the fewest parentheses that keep their meaning,
+  // and statements up to the colon or semicolon that ends their first line.
+  class Printer : public ASTVisitor
+  {
+    raw_ostream &OS;
+    unsigned Prec = 0; // binding strength of the expression printed last
+
+    enum
+    {
+      PrecLogic = 1,
+      PrecAdd,
+      PrecMul,
+      PrecExp,
+      PrecAtom
+    };
+
+    static unsigned precOf(BinaryOp::Operator Op)
+    {
+      switch (Op)
+      {
+      case BinaryOp::Plus:
+      case BinaryOp::Minus:
+        return PrecAdd;
+      case BinaryOp::Exp:
+        return PrecExp;
+      default:
+        return PrecMul;
+      }
+    }
+
+    // Print E, in parentheses if it binds more loosely than MinPrec.
+    void operand(AST *E, unsigned MinPrec)
+    {
+      std::string Text;
+      raw_string_ostream Sub(Text);
+      Printer P(Sub);
+      E->accept(P);
+      if (P.Prec < MinPrec)
+        OS << "(" << Sub.str() << ")";
+      else
+        OS << Sub.str();
+    }
+
+  public:
+    Printer(raw_ostream &OS) : OS(OS) {}
+
+    virtual void visit(Final &Node) override
+    {
+      OS << Node.getVal();
+      Prec = PrecAtom;
+    }
+
+    virtual void visit(ArrayElement &Node) override
+    {
+      OS << Node.getArray() << "[";
+      Node.getIndex()->accept(*this);
+      OS << "]";
+      Prec = PrecAtom;
+    }
+
+    virtual void visit(ArrayReduce &Node) override
+    {
+      static const char *const Ops[] = {"sum", "min", "max"};
+      OS << Ops[Node.getOperator()] << "(" << Node.getArray() << ")";
+      Prec = PrecAtom;
+    }
+
+    virtual void visit(BinaryOp &Node) override
+    {
+      static const char *const Ops[] = {" + ", " - ", " * ", " / ", " % ", " ^ "};
+      // ^ groups to the right, the other operators to the left.
+      auto LeftPrec = [](BinaryOp *Op) {
+        unsigned P = precOf(Op->getOperator());
+        return Op->getOperator() == BinaryOp::Exp ? P + 1 : P;
+      };
+      auto RightPrec = [](BinaryOp *Op) {
+        unsigned P = precOf(Op->getOperator());
+        return Op->getOperator() == BinaryOp::Exp ? P : P + 1;
+      };
+
+      // The operations down the left spine are printed in a loop. Each is
+      // the left operand of the next, so the parentheses it needs open
+      // before the leftmost operand.
+      SmallVector<BinaryOp *, 16> Spine = leftSpine(Node);
+      auto NeedsParens = [&](size_t I) {
+        return I + 1 < Spine.size() && precOf(Spine[I]->getOperator()) < LeftPrec(Spine[I + 1]);
+      };
+      for (size_t I = 0; I < Spine.size(); ++I)
+        if (NeedsParens(I))
+          OS << "(";
+      operand(Spine.front()->getLeft(), LeftPrec(Spine.front()));
+      for (size_t I = 0; I < Spine.size(); ++I)
+      {
+        OS << Ops[Spine[I]->getOperator()];
+        operand(Spine[I]->getRight(), RightPrec(Spine[I]));
+        if (NeedsParens(I))
+          OS << ")";
+      }
+      Prec = precOf(Node.getOperator());
+    }
+
+    virtual void visit(Comparison &Node) override
+    {
+      static const char *const Ops[] = {" == ", " != ", " > ", " < ", " >= ", " <= "};
+      operand(Node.getLeft(), PrecAdd);
+      OS << Ops[Node.getOperator()];
+      operand(Node.getRight(), PrecAdd);
+      Prec = PrecAtom;
+    }
+
+    virtual void visit(LogicalExpr &Node) override
+    {
+      operand(Node.getLeft(), PrecLogic);
+      OS << (Node.getOperator() == LogicalExpr::And ? " and " : " or ");
+      operand(Node.getRight(), PrecLogic + 1);
+      Prec = PrecLogic;
+    }
+
+    virtual void visit(Assignment &Node) override
+    {
+      static const char *const Ops[] = {" = ", " -= ", " += ", " *= ", " /= ", " %= ", " ^= "};
+      OS << Node.getLeft()->getVal();
+      if (Node.getIndex())
+      {
+        OS << "[";
+        Node.getIndex()->accept(*this);
+        OS << "]";
+      }
+      OS << Ops[Node.getAssignKind()];
+      Node.getRight()->accept(*this);
+      OS << ";";
+    }
+
+    virtual void visit(Declaration &Node) override
+    {
+      OS << "int ";
+      for (auto I = Node.varBegin(), E = Node.varEnd(); I != E; ++I)
+      {
+        OS << (I == Node.varBegin() ? "" : ", ") << *I;
+        if (unsigned Size = Node.getSize(I - Node.varBegin()))
+          OS << "[" << Size << "]";
+      }
+      if (Node.valBegin() != Node.valEnd())
+        OS << " = ";
+      for (auto I = Node.valBegin(), E = Node.valEnd(); I != E; ++I)
+      {
+        OS << (I == Node.valBegin() ? "" : ", ");
+        (*I)->accept(*this);
+      }
+      OS << ";";
+    }
+
+    virtual void visit(ReadStmt &Node) override
+    {
+      OS << "read ";
+      for (auto I = Node.varBegin(), E = Node.varEnd(); I != E; ++I)
+        OS << (I == Node.varBegin() ? "" : ", ") << (*I)->getVal();
+      OS << ";";
+    }
+
+    virtual void visit(IfStmt &Node) override
+    {
+      OS << "if ";
+      Node.getCond()->accept(*this);
+      OS << ":";
+    }
+
+    virtual void visit(elifStmt &Node) override
+    {
+      OS << "elif ";
+      Node.getCond()->accept(*this);
+      OS << ":";
+    }
+
+    virtual void visit(IterStmt &Node) override
+    {
+      OS << (Node.isParallel() ? "parloopc " : "loopc ");
+      Node.getCond()->accept(*this);
+      OS << ":";
+    }
+  };
+}; // namespace
+
+std::string printStmtHeader(AST *Stmt)
+{
+  std::string Text;
+  raw_string_ostream OS(Text);
+  print::Printer P(OS);
+  Stmt->accept(P);
+  return OS.str();
+}
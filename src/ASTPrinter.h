@@ -0,0 +1,12 @@
+#ifndef ASTPRINTER_H
+#define ASTPRINTER_H
+
+#include "AST.h"
+#include <string>
+
+// Render the first line of a statement (or elif arm) as it would be written
+// in the source, e.g. "a += b * 2;" or "loopc i < 10:". Bodies are not
+// included.
+std::string printStmtHeader(AST *Stmt);
+
+#endif
@@ -0,0 +1,208 @@
+#include "Batch.h"
+#include "CodeGen.h"
+#include "Driver.h"
+#include "WorkStealingPool.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+using namespace llvm;
+
+namespace
+{
+  struct Job
+  {
+    std::string Source;
+    std::string Output;
+  };
+
+  struct JobResult
+  {
+    bool Ok = false;
+    std::string Diag;           // everything reported while compiling the file
+    double Ms = 0;
+  };
+
+  // State kept by each pool worker for all the files it compiles.
+  struct Worker
+  {
+    LLVMContext Ctx;
+    std::unique_ptr<TargetMachine> TM;
+    ASTContext AST;
+  };
+
+  std::string outputPath(StringRef Source, StringRef RelName, const BatchOptions &Opts)
+  {
+    SmallString<128> Out;
+    if (Opts.OutDir.empty())
+      Out = Source;
+    else
+    {
+      Out = Opts.OutDir;
+      sys::path::append(Out, RelName);
+    }
+    sys::path::replace_extension(Out, "o");
+    return std::string(Out.str());
+  }
+
+  bool collectJobs(ArrayRef<std::string> Inputs, const BatchOptions &Opts, std::vector<Job> &Jobs)
+  {
+    for (const std::string &Input : Inputs)
+    {
+      if (!sys::fs::is_directory(Input))
+      {
+        Jobs.push_back({Input, outputPath(Input, sys::path::filename(Input), Opts)});
+        continue;
+      }
+
+      std::vector<std::string> Found;
+      std::error_code EC;
+      for (sys::fs::recursive_directory_iterator I(Input, EC), E; I != E && !EC; I.increment(EC))
+        if (sys::path::extension(I->path()) == Opts.SourceExt && sys::fs::is_regular_file(I->path()))
+          Found.push_back(I->path());
+      if (EC)
+      {
+        errs() << "Error: cannot read directory " << Input << ": " << EC.message() << "\n";
+        return false;
+      }
+
+      // Sort so that the summary and the work distribution are reproducible.
+      std::sort(Found.begin(), Found.end());
+      for (const std::string &Source : Found)
+      {
+        StringRef RelName = StringRef(Source).drop_front(Input.size()).ltrim("/\\");
+        Jobs.push_back({Source, outputPath(Source, RelName, Opts)});
+      }
+    }
+
+    // Two workers must never write the same object file, e.g. for a/x.txt
+    // and b/x.txt with one -batch-out-dir.
+    StringMap<const Job *> Outputs;
+    for (const Job &J : Jobs)
+    {
+      SmallString<128> Output(J.Output);
+      sys::fs::make_absolute(Output);
+      sys::path::remove_dots(Output, /*remove_dot_dot=*/true);
+      auto Inserted = Outputs.try_emplace(Output, &J);
+      if (!Inserted.second)
+      {
+        errs() << "Error: " << Inserted.first->second->Source << " and " << J.Source
+               << " would both be compiled to " << J.Output << ".\n";
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void compileJob(Worker &W, const Job &J, const BatchOptions &Batch, JobResult &Result)
+  {
+    const CompileOptions &Opts = Batch.Compile;
+    raw_string_ostream Diag(Result.Diag);
+
+    if (!W.TM && !(W.TM = createHostTargetMachine(Diag)))
+      return;
+
+    auto Buffer = MemoryBuffer::getFile(J.Source);
+    if (!Buffer)
+    {
+      Diag << "Error: cannot read file: " << Buffer.getError().message() << "\n";
+      return;
+    }
+
+    W.AST.reset();
+    SourceManager SM((*Buffer)->getBuffer(), J.Source);
+    Program *Tree = parseAndCheck(SM, W.AST, Diag, Batch.Frontend);
+    if (!Tree)
+      return;
+
+    // The module is freed after each file; the context and its uniqued types
+    // stay with the worker.
+    Module M(J.Source, W.Ctx);
+    CodeGen Gen(Diag, Batch.Profile);
+    if (Opts.DebugInfo)
+      Gen.setDebugInfo(SM);
+    Gen.setChunkSize(Opts.ChunkSize);
+    Gen.setGlobalsThreshold(Opts.GlobalsThreshold);
+    Gen.setResultFormat(Opts.Results);
+    if (!Gen.generate(Tree, &M) || !finishModule(M, W.TM.get(), Opts, Diag))
+      return;
+
+    std::error_code EC;
+    StringRef OutDir = sys::path::parent_path(J.Output);
+    if (!OutDir.empty() && (EC = sys::fs::create_directories(OutDir)))
+    {
+      Diag << "Error: cannot create " << OutDir << ": " << EC.message() << "\n";
+      return;
+    }
+
+    raw_fd_ostream OS(J.Output, EC, sys::fs::OF_None);
+    if (EC)
+    {
+      Diag << "Error: cannot open " << J.Output << ": " << EC.message() << "\n";
+      return;
+    }
+    if (!emitObjectFile(M, *W.TM, OS))
+    {
+      Diag << "Error: the target cannot emit object files\n";
+      return;
+    }
+    Result.Ok = true;
+  }
+}
+
+int runBatch(ArrayRef<std::string> Inputs, const BatchOptions &Opts)
+{
+  std::vector<Job> Jobs;
+  if (!collectJobs(Inputs, Opts, Jobs))
+    return 1;
+
+  WorkStealingPool Pool(Opts.Jobs);
+  std::unique_ptr<Worker[]> Workers(new Worker[Pool.size()]);
+  std::vector<JobResult> Results(Jobs.size());
+
+  auto Start = std::chrono::steady_clock::now();
+  Pool.run(Jobs.size(), [&](unsigned W, size_t I) {
+    auto JobStart = std::chrono::steady_clock::now();
+    compileJob(Workers[W], Jobs[I], Opts, Results[I]);
+    Results[I].Ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - JobStart).count();
+  });
+  double WallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - Start).count();
+
+  // Report failures in input order, each with its own diagnostics.
+  unsigned Failed = 0;
+  double TotalMs = 0;
+  for (size_t I = 0, E = Jobs.size(); I != E; ++I)
+  {
+    TotalMs += Results[I].Ms;
+    if (Results[I].Ok)
+      continue;
+    ++Failed;
+    errs() << Jobs[I].Source << ": failed\n";
+    for (StringRef Line : split(StringRef(Results[I].Diag).rtrim(), '\n'))
+      errs() << "  " << Line << "\n";
+  }
+
+  std::vector<size_t> Slowest(Jobs.size());
+  for (size_t I = 0, E = Jobs.size(); I != E; ++I)
+    Slowest[I] = I;
+  std::sort(Slowest.begin(), Slowest.end(), [&](size_t A, size_t B) { return Results[A].Ms > Results[B].Ms; });
+  Slowest.resize(std::min<size_t>(Slowest.size(), 5));
+
+  outs() << "Compiled " << Jobs.size() - Failed << " of " << Jobs.size() << " files ("
+         << Failed << " failed) on " << Pool.size() << " workers\n";
+  outs() << "Wall time " << format("%.1f", WallMs) << " ms, compile time "
+         << format("%.1f", TotalMs) << " ms, "
+         << format("%.2f", Jobs.empty() ? 0.0 : TotalMs / Jobs.size()) << " ms per file\n";
+  for (size_t I : Slowest)
+    outs() << "  " << format("%8.2f", Results[I].Ms) << " ms  " << Jobs[I].Source << "\n";
+
+  return Failed ? 1 : 0;
+}
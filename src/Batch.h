@@ -0,0 +1,25 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "Driver.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+#include <string>
+
+struct BatchOptions
+{
+  std::string OutDir;            // empty: write each object next to its source
+  std::string SourceExt = ".txt"; // extension of sources found in directories
+  unsigned Jobs = 0;             // 0: one worker per hardware thread
+  FrontendOptions Frontend;      // how each source is parsed
+  CompileOptions Compile;        // how each module is finished
+  ProfileOptions Profile;        // -fexec-profile only; a PGO profile file belongs to a single program
+};
+
+// Compile every file in Inputs (directories are searched recursively) to an
+// object file on a work-stealing thread pool, then print a summary of
+// failures and timings. Sources that would be compiled to the same object
+// file are an error. Returns the process exit code.
+int runBatch(llvm::ArrayRef<std::string> Inputs, const BatchOptions &Opts);
+
+#endif
@@ -0,0 +1,628 @@
+#include "ByteCode.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+// Define a visitor class for translating the AST into register bytecode.
+namespace
+bc{
+  // Collects the declared variables and the integer literals of a program so
+  // that the frame layout is known before any instruction is emitted. The
+  // loops over the elements of an array need its size and 1 as well.
+  class FrameLayout : public ASTVisitor
+  {
+  public:
+    llvm::SmallVector<std::pair<llvm::StringRef, unsigned>> Vars; // with their numbers of elements, 0 for an int
+    llvm::SmallVector<int32_t> Consts;
+
+    virtual void visit(Program &Node) override
+    {
+      for (AST *Stmt : Node)
+        Stmt->accept(*this);
+    }
+
+    virtual void visit(Final &Node) override
+    {
+      if (Node.getKind() == Final::Number)
+      {
+        int32_t intval = 0;
+        if (!Node.getVal().getAsInteger(10, intval))
+          Consts.push_back(intval);
+      }
+    }
+
+    virtual void visit(BinaryOp &Node) override
+    {
+      llvm::SmallVector<BinaryOp *, 16> Spine = leftSpine(Node);
+      Spine.front()->getLeft()->accept(*this);
+      for (BinaryOp *Op : Spine)
+        Op->getRight()->accept(*this);
+    }
+
+    virtual void visit(Assignment &Node) override
+    {
+      Node.getRight()->accept(*this);
+      if (Node.getIndex())
+        Node.getIndex()->accept(*this);
+    }
+
+    virtual void visit(ArrayElement &Node) override
+    {
+      Node.getIndex()->accept(*this);
+    }
+
+    virtual void visit(ArrayReduce &) override {}
+    virtual void visit(ReadStmt &) override {}
+
+    virtual void visit(Declaration &Node) override
+    {
+      size_t N = 0;
+      for (auto I = Node.varBegin(), E = Node.varEnd(); I != E; ++I, ++N)
+      {
+        Vars.push_back({*I, Node.getSize(N)});
+        if (Node.getSize(N))
+        {
+          Consts.push_back(Node.getSize(N));
+          Consts.push_back(1);
+        }
+      }
+      for (auto I = Node.valBegin(), E = Node.valEnd(); I != E; ++I)
+        (*I)->accept(*this);
+    }
+
+    virtual void visit(Comparison &Node) override
+    {
+      Node.getLeft()->accept(*this);
+      Node.getRight()->accept(*this);
+    }
+
+    virtual void visit(LogicalExpr &Node) override
+    {
+      Node.getLeft()->accept(*this);
+      Node.getRight()->accept(*this);
+    }
+
+    virtual void visit(IfStmt &Node) override
+    {
+      Node.getCond()->accept(*this);
+      for (auto I = Node.begin(), E = Node.end(); I != E; ++I)
+        (*I)->accept(*this);
+      for (auto I = Node.beginElif(), E = Node.endElif(); I != E; ++I)
+        (*I)->accept(*this);
+      for (auto I = Node.beginElse(), E = Node.endElse(); I != E; ++I)
+        (*I)->accept(*this);
+    }
+
+    virtual void visit(elifStmt &Node) override
+    {
+      Node.getCond()->accept(*this);
+      for (auto I = Node.begin(), E = Node.end(); I != E; ++I)
+        (*I)->accept(*this);
+    }
+
+    virtual void visit(IterStmt &Node) override
+    {
+      Node.getCond()->accept(*this);
+      for (auto I = Node.begin(), E = Node.end(); I != E; ++I)
+        (*I)->accept(*this);
+    }
+  };
+
+  // Folds an expression made only of literals, as the IR builder's constant
+  // folder does, so exponents are accepted by both paths alike.
+  class ConstEval : public ASTVisitor
+  {
+  public:
+    int32_t Val = 0;
+    bool IsConst = true;
+
+    virtual void visit(Final &Node) override
+    {
+      if (Node.getKind() == Final::Ident)
+        IsConst = false;
+      else if (Node.getVal().getAsInteger(10, Val))
+        IsConst = false;
+    }
+
+    virtual void visit(BinaryOp &Node) override
+    {
+      llvm::SmallVector<BinaryOp *, 16> Spine = leftSpine(Node);
+      Spine.front()->getLeft()->accept(*this);
+      for (BinaryOp *Op : Spine)
+      {
+        uint32_t L = Val;
+        Op->getRight()->accept(*this);
+        uint32_t R = Val;
+        if (!IsConst)
+          return;
+        switch (Op->getOperator())
+        {
+        case BinaryOp::Plus:
+          Val = L + R;
+          break;
+        case BinaryOp::Minus:
+          Val = L - R;
+          break;
+        case BinaryOp::Mul:
+          Val = L * R;
+          break;
+        case BinaryOp::Div:
+        case BinaryOp::Mod:
+          if (R == 0 || ((int32_t)L == INT32_MIN && (int32_t)R == -1))
+            IsConst = false;
+          else if (Op->getOperator() == BinaryOp::Div)
+            Val = (int32_t)L / (int32_t)R;
+          else
+            Val = (int32_t)L % (int32_t)R;
+          break;
+        case BinaryOp::Exp:
+          Val = 1;
+          for (int32_t I = 0; I < (int32_t)R; ++I)
+            Val = (uint32_t)Val * L;
+          break;
+        }
+      }
+    }
+
+    virtual void visit(ArrayElement &) override { IsConst = false; }
+    virtual void visit(ArrayReduce &) override { IsConst = false; }
+    virtual void visit(ReadStmt &) override {}
+    virtual void visit(Assignment &) override {}
+    virtual void visit(Declaration &) override {}
+    virtual void visit(Comparison &) override {}
+    virtual void visit(LogicalExpr &) override {}
+    virtual void visit(IfStmt &) override {}
+    virtual void visit(IterStmt &) override {}
+    virtual void visit(elifStmt &) override {}
+  };
+
+  class ToByteCodeVisitor : public ASTVisitor
+  {
+    ByteCode &BC;
+    std::vector<Instr> &Code;
+    StringMap<unsigned> Slots;             // variable name -> frame register, the first element of an array
+    StringMap<unsigned> ArraySizes;        // array name -> number of elements
+    StringMap<unsigned> VarIds;            // variable name -> its index in BC.Vars
+    unsigned Element = 0;                  // register of the element index in a whole-array assignment, or 0,
+                                           // which is never a temporary
+    DenseMap<int64_t, unsigned> ConstRegs; // literal value -> constant register, keyed wider than
+                                           // int32_t since DenseMap reserves INT_MAX and INT_MIN
+    unsigned TempBase;                     // first register after the constants
+    unsigned NextTemp;                     // next free temporary register
+    unsigned R;                            // register holding the last result
+    bool HasError;
+    bool CountLoops;
+    bool Silent = false;                   // in a parloopc, assignments print nothing
+
+    unsigned getConst(int32_t Val)
+    {
+      auto It = ConstRegs.find(Val);
+      if (It != ConstRegs.end())
+        return It->second;
+      unsigned Reg = BC.constBase() + BC.Consts.size();
+      BC.Consts.push_back(Val);
+      ConstRegs[Val] = Reg;
+      return Reg;
+    }
+
+    unsigned newTemp()
+    {
+      unsigned Reg = NextTemp++;
+      if (NextTemp > BC.NumRegs)
+        BC.NumRegs = NextTemp;
+      return Reg;
+    }
+
+    unsigned emit(OpCode Op, uint32_t A = 0, uint32_t B = 0, uint32_t C = 0)
+    {
+      Code.push_back({Op, A, B, C});
+      return Code.size() - 1;
+    }
+
+    // The exponent has to fold to a constant, as CodeGen requires too.
+    int32_t getExponent(Expr *E)
+    {
+      ConstEval Eval;
+      E->accept(Eval);
+      if (!Eval.IsConst)
+      {
+        llvm::errs() << "Error: The exponent only allowed to be a constant.\n";
+        HasError = true;
+      }
+      return Eval.Val;
+    }
+
+    // Compile a condition and return the register holding its 0/1 value.
+    unsigned emitCond(Logic *Cond)
+    {
+      Cond->accept(*this);
+      return R;
+    }
+
+    void emitBody(ArrayRef<Assignment *> Body)
+    {
+      for (Assignment *A : Body)
+        A->accept(*this);
+    }
+
+    // Emit a loop over the Size elements of an array, with Body emitted once
+    // and given the register of the element index.
+    template <typename Fn> void emitElementLoop(unsigned Size, Fn Body)
+    {
+      unsigned K = newTemp();
+      emit(OpCode::Move, K, getConst(0));
+      unsigned Top = Code.size();
+      Body(K);
+      emit(OpCode::Add, K, K, getConst(1));
+      unsigned More = newTemp();
+      emit(OpCode::CmpLt, More, K, getConst(Size));
+      emit(OpCode::JmpTrue, More, Top);
+    }
+
+    // Compile the index of an element of Array and return the register
+    // holding it, checked to be in range.
+    unsigned emitIndex(Expr *Index, StringRef Array)
+    {
+      Index->accept(*this);
+      emit(OpCode::CheckIndex, R, ArraySizes.lookup(Array));
+      return R;
+    }
+
+  public:
+    ToByteCodeVisitor(ByteCode &BC, bool CountLoops) : BC(BC), Code(BC.Code), HasError(false), CountLoops(CountLoops) {}
+
+    bool run(Program *Tree)
+    {
+      FrameLayout Layout;
+      Tree->accept(Layout);
+      for (auto &Var : Layout.Vars)
+        if (Slots.try_emplace(Var.first, BC.NumVarSlots).second)
+        {
+          VarIds[Var.first] = BC.Vars.size();
+          BC.Vars.push_back(Var.first);
+          BC.Sizes.push_back(Var.second);
+          BC.NumVarSlots += std::max(Var.second, 1u);
+          if (Var.second)
+            ArraySizes[Var.first] = Var.second;
+        }
+      getConst(0);
+      for (int32_t Val : Layout.Consts)
+        getConst(Val);
+      TempBase = NextTemp = BC.NumRegs = BC.constBase() + BC.Consts.size();
+
+      Tree->accept(*this);
+      emit(OpCode::Halt);
+      return !HasError;
+    }
+
+    virtual void visit(Program &Node) override
+    {
+      for (AST *Stmt : Node)
+      {
+        NextTemp = TempBase;
+        Stmt->accept(*this);
+      }
+    }
+
+    virtual void visit(Final &Node) override
+    {
+      if (Node.getKind() == Final::Ident && Element && ArraySizes.count(Node.getVal()))
+      {
+        R = newTemp();
+        emit(OpCode::LoadElem, R, Slots[Node.getVal()], Element);
+      }
+      else if (Node.getKind() == Final::Ident)
+      {
+        R = Slots[Node.getVal()];
+      }
+      else
+      {
+        // Sema has rejected numbers that do not fit in an int.
+        int32_t intval = 0;
+        if (Node.getVal().getAsInteger(10, intval))
+          HasError = true;
+        R = getConst(intval);
+      }
+    }
+
+    // The operations down the left spine are emitted from the innermost
+    // out, each on the result of the one before.
+    virtual void visit(BinaryOp &Node) override
+    {
+      llvm::SmallVector<BinaryOp *, 16> Spine = leftSpine(Node);
+      Spine.front()->getLeft()->accept(*this);
+      for (BinaryOp *B : Spine)
+      {
+        unsigned Left = R;
+        if (B->getOperator() == BinaryOp::Exp)
+        {
+          int32_t Exponent = getExponent(B->getRight());
+          R = newTemp();
+          emit(OpCode::Pow, R, Left, Exponent);
+          continue;
+        }
+
+        B->getRight()->accept(*this);
+        unsigned Right = R;
+
+        OpCode Op;
+        switch (B->getOperator())
+        {
+        case BinaryOp::Plus:
+          Op = OpCode::Add;
+          break;
+        case BinaryOp::Minus:
+          Op = OpCode::Sub;
+          break;
+        case BinaryOp::Mul:
+          Op = OpCode::Mul;
+          break;
+        case BinaryOp::Div:
+          Op = OpCode::Div;
+          break;
+        default:
+          Op = OpCode::Rem;
+          break;
+        }
+        R = newTemp();
+        emit(Op, R, Left, Right);
+      }
+    }
+
+    virtual void visit(ArrayElement &Node) override
+    {
+      unsigned Index = emitIndex(Node.getIndex(), Node.getArray());
+      R = newTemp();
+      emit(OpCode::LoadElem, R, Slots[Node.getArray()], Index);
+    }
+
+    virtual void visit(ArrayReduce &Node) override
+    {
+      static const OpCode Ops[] = {OpCode::Sum, OpCode::Min, OpCode::Max};
+      R = newTemp();
+      emit(Ops[Node.getOperator()], R, Slots[Node.getArray()], ArraySizes.lookup(Node.getArray()));
+    }
+
+    virtual void visit(Assignment &Node) override
+    {
+      llvm::StringRef Dest = Node.getLeft()->getVal();
+      if (Node.getIndex())
+      {
+        // The right-hand side comes first, as in the IR.
+        Node.getRight()->accept(*this);
+        unsigned Val = R;
+        unsigned Index = emitIndex(Node.getIndex(), Dest);
+        unsigned Array = Slots[Dest];
+        if (Node.getAssignKind() != Assignment::Assign)
+        {
+          unsigned Old = newTemp();
+          emit(OpCode::LoadElem, Old, Array, Index);
+          emitAssign(Node, Old, Val);
+          Val = Old;
+        }
+        emit(OpCode::StoreElem, Array, Index, Val);
+        if (!Silent)
+          emit(OpCode::Write, Val, VarIds.lookup(Dest));
+        return;
+      }
+      if (unsigned Size = ArraySizes.lookup(Dest))
+      {
+        unsigned Array = Slots[Dest];
+        emitElementLoop(Size, [&](unsigned K) {
+          Element = K;
+          Node.getRight()->accept(*this);
+          Element = 0;
+          unsigned Val = R;
+          if (Node.getAssignKind() != Assignment::Assign)
+          {
+            Val = newTemp();
+            emit(OpCode::LoadElem, Val, Array, K);
+            emitAssign(Node, Val, R);
+          }
+          emit(OpCode::StoreElem, Array, K, Val);
+        });
+        return;
+      }
+
+      Node.getRight()->accept(*this);
+      unsigned Var = Slots[Dest];
+      emitAssign(Node, Var, R);
+      if (!Silent)
+        emit(OpCode::Write, Var, VarIds.lookup(Dest));
+    }
+
+    // Var (op)= Val, for the kind of assignment of Node.
+    void emitAssign(Assignment &Node, unsigned Var, unsigned Val)
+    {
+      switch (Node.getAssignKind())
+      {
+      case Assignment::Assign:
+        emit(OpCode::Move, Var, Val);
+        break;
+      case Assignment::Plus_assign:
+        emit(OpCode::Add, Var, Var, Val);
+        break;
+      case Assignment::Minus_assign:
+        emit(OpCode::Sub, Var, Var, Val);
+        break;
+      case Assignment::Star_assign:
+        emit(OpCode::Mul, Var, Var, Val);
+        break;
+      case Assignment::Slash_assign:
+        emit(OpCode::Div, Var, Var, Val);
+        break;
+      case Assignment::Mod_assign:
+        emit(OpCode::Rem, Var, Var, Val);
+        break;
+      case Assignment::Exp_assign:
+        emit(OpCode::Pow, Var, Var, getExponent(Node.getRight()));
+        break;
+      }
+    }
+
+    virtual void visit(Declaration &Node) override
+    {
+      // Evaluate every initializer before any variable is (re)set, like the
+      // IR generator does.
+      llvm::SmallVector<unsigned, 8> Vals;
+      for (auto I = Node.valBegin(), E = Node.valEnd(); I != E; ++I)
+      {
+        (*I)->accept(*this);
+        unsigned Tmp = newTemp();
+        emit(OpCode::Move, Tmp, R);
+        Vals.push_back(Tmp);
+      }
+      unsigned Idx = 0;
+      for (auto I = Node.varBegin(), E = Node.varEnd(); I != E; ++I, ++Idx)
+      {
+        // Arrays start out as zero; a value is given to each element.
+        if (unsigned Size = Node.getSize(Idx))
+        {
+          if (Idx < Vals.size())
+            emitElementLoop(Size, [&](unsigned K) { emit(OpCode::StoreElem, Slots[*I], K, Vals[Idx]); });
+          continue;
+        }
+        emit(OpCode::Move, Slots[*I], Idx < Vals.size() ? Vals[Idx] : getConst(0));
+      }
+    }
+
+    virtual void visit(ReadStmt &Node) override
+    {
+      for (Final *Var : make_range(Node.varBegin(), Node.varEnd()))
+      {
+        StringRef Name = Var->getVal();
+        emit(OpCode::Read, Slots[Name], ArraySizes.lookup(Name), VarIds.lookup(Name));
+      }
+    }
+
+    virtual void visit(Comparison &Node) override
+    {
+      Node.getLeft()->accept(*this);
+      unsigned Left = R;
+      Node.getRight()->accept(*this);
+      unsigned Right = R;
+
+      OpCode Op;
+      switch (Node.getOperator())
+      {
+      case Comparison::Equal:
+        Op = OpCode::CmpEq;
+        break;
+      case Comparison::Not_equal:
+        Op = OpCode::CmpNe;
+        break;
+      case Comparison::Greater:
+        Op = OpCode::CmpGt;
+        break;
+      case Comparison::Less:
+        Op = OpCode::CmpLt;
+        break;
+      case Comparison::Greater_equal:
+        Op = OpCode::CmpGe;
+        break;
+      default:
+        Op = OpCode::CmpLe;
+        break;
+      }
+      R = newTemp();
+      emit(Op, R, Left, Right);
+    }
+
+    virtual void visit(LogicalExpr &Node) override
+    {
+      Node.getLeft()->accept(*this);
+      unsigned Left = R;
+      Node.getRight()->accept(*this);
+      unsigned Right = R;
+      R = newTemp();
+      emit(Node.getOperator() == LogicalExpr::And ? OpCode::And : OpCode::Or, R, Left, Right);
+    }
+
+    virtual void visit(IterStmt &Node) override
+    {
+      if (Node.isParallel())
+      {
+        emitParallelLoop(Node);
+        return;
+      }
+
+      // Same rotated shape as the IR: guard, body, latch test.
+      unsigned Guard = emit(OpCode::JmpFalse, emitCond(Node.getCond()));
+      unsigned Body = Code.size();
+      if (CountLoops)
+      {
+        emit(OpCode::Loop, BC.Loops.size());
+        BC.Loops.push_back(&Node);
+      }
+      emitBody(llvm::ArrayRef<Assignment *>(Node.begin(), Node.end()));
+      emit(OpCode::JmpTrue, emitCond(Node.getCond()), Body);
+      Code[Guard].B = Code.size();
+      if (CountLoops)
+        Code[Body].B = Code.size();
+    }
+
+    // A parloopc runs serially, which gives the same results, and prints the
+    // final values of the variables its body assigns, as compiled code does.
+    // It has no Loop instruction, so tiered mode never compiles it; the JIT
+    // has no thread pool to run it on.
+    void emitParallelLoop(IterStmt &Node)
+    {
+      unsigned Guard = emit(OpCode::JmpFalse, emitCond(Node.getCond()));
+      unsigned Body = Code.size();
+      Silent = true;
+      emitBody(llvm::ArrayRef<Assignment *>(Node.begin(), Node.end()));
+      Silent = false;
+      emit(OpCode::JmpTrue, emitCond(Node.getCond()), Body);
+
+      llvm::SmallVector<llvm::StringRef, 8> Written;
+      for (Assignment *A : Node)
+      {
+        llvm::StringRef Var = A->getLeft()->getVal();
+        if (!A->getIndex() && !llvm::is_contained(Written, Var))
+        {
+          Written.push_back(Var);
+          emit(OpCode::Write, Slots[Var], VarIds.lookup(Var));
+        }
+      }
+      Code[Guard].B = Code.size();
+    }
+
+    virtual void visit(IfStmt &Node) override
+    {
+      llvm::SmallVector<unsigned, 8> ToEnd;
+
+      unsigned Skip = emit(OpCode::JmpFalse, emitCond(Node.getCond()));
+      emitBody(llvm::ArrayRef<Assignment *>(Node.begin(), Node.end()));
+      ToEnd.push_back(emit(OpCode::Jmp));
+      Code[Skip].B = Code.size();
+
+      for (auto I = Node.beginElif(), E = Node.endElif(); I != E; ++I)
+      {
+        Skip = emit(OpCode::JmpFalse, emitCond((*I)->getCond()));
+        (*I)->accept(*this);
+        ToEnd.push_back(emit(OpCode::Jmp));
+        Code[Skip].B = Code.size();
+      }
+
+      emitBody(llvm::ArrayRef<Assignment *>(Node.beginElse(), Node.endElse()));
+
+      for (unsigned J : ToEnd)
+        Code[J].A = Code.size();
+    }
+
+    virtual void visit(elifStmt &Node) override
+    {
+      emitBody(llvm::ArrayRef<Assignment *>(Node.begin(), Node.end()));
+    }
+  };
+}; // namespace
+
+bool ByteCodeGen::compile(Program *Tree, ByteCode &BC, bool CountLoops)
+{
+  bc::ToByteCodeVisitor ToBC(BC, CountLoops);
+  return ToBC.run(Tree);
+}
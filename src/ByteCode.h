@@ -0,0 +1,77 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include "AST.h"
+#include "llvm/ADT/StringRef.h"
+#include <cstdint>
+#include <vector>
+
+// Opcodes of the register bytecode. Every operand is a register index into
+// the frame, except jump targets, which are instruction indices.
+enum class OpCode : uint32_t
+{
+  Move,           // A = B
+  Add,            // A = B + C
+  Sub,            // A = B - C
+  Mul,            // A = B * C
+  Div,            // A = B / C
+  Rem,            // A = B % C
+  Pow,            // A = B ^ C (C is an immediate exponent)
+  CmpEq,          // A = B == C
+  CmpNe,          // A = B != C
+  CmpLt,          // A = B < C
+  CmpGt,          // A = B > C
+  CmpLe,          // A = B <= C
+  CmpGe,          // A = B >= C
+  And,            // A = B & C
+  Or,             // A = B | C
+  LoadElem,       // A = element R[C] of the array at B
+  StoreElem,      // element R[B] of the array at A = C
+  CheckIndex,     // stop with an error unless 0 <= A < B (B is an immediate number of elements)
+  Sum,            // A = sum of the C elements of the array at B
+  Min,            // A = least of the C elements of the array at B
+  Max,            // A = greatest of the C elements of the array at B
+  Jmp,            // goto A
+  JmpFalse,       // if (!A) goto B
+  JmpTrue,        // if (A) goto B
+  Write,          // print A, the value of the variable B of Vars
+  Read,           // read into the variable C of Vars at A, or into each of its B elements if it is an array
+  Loop,           // top of the body of loop A, whose exit is at B (tiered mode)
+  Halt            // stop execution
+};
+
+// A single three-address instruction.
+struct Instr
+{
+  OpCode Op;
+  uint32_t A;
+  uint32_t B;
+  uint32_t C;
+};
+
+// ByteCode holds a compiled program. The frame is laid out densely as
+// [variables][constants][temporaries]; constants are preloaded from Consts.
+// Each variable takes one slot, and an array one per element.
+struct ByteCode
+{
+  std::vector<Instr> Code;
+  std::vector<int32_t> Consts;
+  std::vector<llvm::StringRef> Vars;   // names of the variables, in the order of their slots
+  std::vector<unsigned> Sizes;         // of each variable: its number of elements if it is an array, else 0
+  std::vector<IterStmt *> Loops;       // source loop of each Loop instruction
+  unsigned NumVarSlots = 0;
+  unsigned NumRegs = 0;
+
+  unsigned constBase() const { return NumVarSlots; }
+};
+
+class ByteCodeGen
+{
+public:
+  // Translate the AST into bytecode. Returns false if the program cannot be
+  // compiled (e.g. a non-constant exponent). With CountLoops, every loop body
+  // starts with a Loop instruction so the VM can find hot loops.
+  bool compile(Program *Tree, ByteCode &BC, bool CountLoops = false);
+};
+
+#endif
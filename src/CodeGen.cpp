@@ -1,16 +1,128 @@
 #include "CodeGen.h"
+#include "ParallelLoop.h"
+#include "llvm/ADT/SmallString.h"
 #include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/IR/DIBuilder.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Intrinsics.h"
 #include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/FileSystem.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/IR/Constants.h"
+#include <algorithm>
 
 using namespace llvm;
 
 // Define a visitor class for generating LLVM IR from the AST.
 namespace
 ns{
+  // Measures statements in AST nodes, as an estimate of their code, and
+  // lists the variables and arrays they declare.
+  class StmtSize : public ASTVisitor
+  {
+    template <typename It> void all(It Begin, It End)
+    {
+      for (; Begin != End; ++Begin)
+        (*Begin)->accept(*this);
+    }
+
+  public:
+    unsigned Size = 0;
+    SmallVector<StringRef, 16> Vars;
+    SmallVector<std::pair<StringRef, unsigned>, 4> Arrays; // with their numbers of elements
+    SmallVector<StringRef, 16> Declared;                   // the variables and arrays, in order
+
+    virtual void visit(Final &) override { ++Size; }
+
+    virtual void visit(BinaryOp &Node) override
+    {
+      SmallVector<BinaryOp *, 16> Spine = leftSpine(Node);
+      Size += Spine.size();
+      Spine.front()->getLeft()->accept(*this);
+      for (BinaryOp *Op : Spine)
+        Op->getRight()->accept(*this);
+    }
+
+    virtual void visit(Comparison &Node) override
+    {
+      ++Size;
+      Node.getLeft()->accept(*this);
+      Node.getRight()->accept(*this);
+    }
+
+    virtual void visit(LogicalExpr &Node) override
+    {
+      ++Size;
+      Node.getLeft()->accept(*this);
+      Node.getRight()->accept(*this);
+    }
+
+    virtual void visit(Assignment &Node) override
+    {
+      ++Size;
+      Node.getLeft()->accept(*this);
+      Node.getRight()->accept(*this);
+      if (Node.getIndex())
+        Node.getIndex()->accept(*this);
+    }
+
+    virtual void visit(ArrayElement &Node) override
+    {
+      ++Size;
+      Node.getIndex()->accept(*this);
+    }
+
+    virtual void visit(ArrayReduce &) override { ++Size; }
+
+    virtual void visit(ReadStmt &Node) override { Size += Node.varEnd() - Node.varBegin(); }
+
+    virtual void visit(Declaration &Node) override
+    {
+      Size += Node.varEnd() - Node.varBegin();
+      size_t N = 0;
+      for (auto I = Node.varBegin(), E = Node.varEnd(); I != E; ++I, ++N)
+      {
+        Declared.push_back(*I);
+        if (Node.getSize(N))
+          Arrays.push_back({*I, Node.getSize(N)});
+        else
+          Vars.push_back(*I);
+      }
+      all(Node.valBegin(), Node.valEnd());
+    }
+
+    virtual void visit(elifStmt &Node) override
+    {
+      Node.getCond()->accept(*this);
+      all(Node.begin(), Node.end());
+    }
+
+    virtual void visit(IfStmt &Node) override
+    {
+      ++Size;
+      Node.getCond()->accept(*this);
+      all(Node.begin(), Node.end());
+      all(Node.beginElif(), Node.endElif());
+      all(Node.beginElse(), Node.endElse());
+    }
+
+    virtual void visit(IterStmt &Node) override
+    {
+      // The condition is emitted twice, in the guard and in the latch.
+      ++Size;
+      Node.getCond()->accept(*this);
+      Node.getCond()->accept(*this);
+      all(Node.begin(), Node.end());
+    }
+  };
+
   class ToIRVisitor : public ASTVisitor
   {
     Module *M;
@@ -23,14 +135,73 @@ ns{
     Constant *Int32One;
 
     Value *V;
-    StringMap<AllocaInst *> nameMap;
+    StringMap<Value *> nameMap;  // variable name -> pointer to its i32 storage
 
     FunctionType *CompilerWriteFnTy;
     Function *CompilerWriteFn;
 
+    // How results are written, and the ID of each variable in records.
+    ResultFormat Results;
+    StringMap<unsigned> VarIds;
+
+    raw_ostream &Diag;
+    bool HasError;
+
+    // Profile-guided optimization: the counter numbering, the counters of an
+    // instrumented build and the counts of a profiled run.
+    std::unique_ptr<ProfileLayout> Layout;
+    GlobalVariable *Counters = nullptr;
+    const ProfileData *Profile = nullptr;
+
+    // -fexec-profile: the report lines, a counter per line, the cycles spent
+    // in each loop, and the cycles of the whole run.
+    std::unique_ptr<StmtTable> Stmts;
+    GlobalVariable *ExecCounts = nullptr;
+    GlobalVariable *ExecCycles = nullptr;
+    GlobalVariable *ExecTotal = nullptr;
+
+    // Debug info, when it is asked for; SM maps node locations to lines.
+    std::unique_ptr<DIBuilder> DIB;
+    DIFile *File = nullptr;
+    DICompileUnit *CU = nullptr;
+    DISubprogram *SP = nullptr;
+    DIType *DIIntTy = nullptr;
+    const SourceManager *SM = nullptr;
+
+    // When main is split into chunks: the frame argument of the chunk being
+    // emitted, the slot of each variable in it, the names by slot, and the
+    // block where the addresses of the slots are taken.
+    Value *ChunkFrame = nullptr;
+    StringMap<unsigned> FrameSlots;
+    std::vector<StringRef> FrameVars;
+    BasicBlock *FrameEntry = nullptr;
+
+    // The variables are globals, created before any code; see createGlobals.
+    bool GlobalVars = false;
+
+    // The arrays, by name: a pointer to their first element and their number
+    // of elements. They are globals, see createArrays, so that chunks and
+    // parloopc bodies reach them directly. While the right-hand side of a
+    // whole-array assignment is emitted, Element is the index (an i64) of
+    // the element that arrays without an index stand for.
+    struct ArrayStorage
+    {
+      Value *Base;
+      unsigned Size;
+    };
+    StringMap<ArrayStorage> Arrays;
+    Value *Element = nullptr;
+
+    // While the body function of a parloopc is emitted: its reductions,
+    // which hold partial results, and that assignments print nothing.
+    bool InParallelBody = false;
+    StringSet<> Reductions;
+    unsigned NumParallelLoops = 0;
+
   public:
     // Constructor for the visitor class.
-    ToIRVisitor(Module *M) : M(M), Builder(M->getContext())
+    ToIRVisitor(Module *M, raw_ostream &Diag, ResultFormat Results)
+        : M(M), Builder(M->getContext()), Results(Results), Diag(Diag), HasError(false)
     {
       // Initialize LLVM types and constants.
       VoidTy = Type::getVoidTy(M->getContext());
@@ -45,22 +216,450 @@ ns{
       CompilerWriteFn = Function::Create(CompilerWriteFnTy, GlobalValue::ExternalLinkage, "compiler_write", M);
     }
 
+    bool hasError() { return HasError; }
+
+    // Describe the program as the source of Sources, under its absolute path.
+    void enableDebugInfo(const SourceManager &Sources)
+    {
+      SM = &Sources;
+      SmallString<256> Path(SM->getName());
+      sys::fs::make_absolute(Path);
+      DIB = std::make_unique<DIBuilder>(*M);
+      File = DIB->createFile(sys::path::filename(Path), sys::path::parent_path(Path));
+      CU = DIB->createCompileUnit(dwarf::DW_LANG_C, File, "simple-compiler", false, "", 0);
+      DIIntTy = DIB->createBasicType("int", 32, dwarf::DW_ATE_signed);
+      M->addModuleFlag(Module::Warning, "Dwarf Version", 4);
+      M->addModuleFlag(Module::Warning, "Debug Info Version", DEBUG_METADATA_VERSION);
+    }
+
+    // Attribute the instructions emitted next to Node.
+    void setDebugLoc(AST &Node)
+    {
+      if (!SP || !Node.getLoc().isValid())
+        return;
+      std::pair<unsigned, unsigned> LineCol = SM->getLineAndColumn(Node.getLoc());
+      Builder.SetCurrentDebugLocation(DILocation::get(M->getContext(), LineCol.first, LineCol.second, SP));
+    }
+
     // Entry point for generating LLVM IR from the AST.
-    void run(Program *Tree)
+    void run(Program *Tree, const ProfileOptions &ProfileOpts, unsigned ChunkSize, unsigned GlobalsThreshold)
     {
       // Create the main function with the appropriate function type.
       FunctionType *MainFty = FunctionType::get(Int32Ty, {Int32Ty, Int8PtrPtrTy}, false);
       Function *MainFn = Function::Create(MainFty, GlobalValue::ExternalLinkage, "main", M);
 
+      if (!ProfileOpts.GeneratePath.empty() || ProfileOpts.Use)
+        Layout = std::make_unique<ProfileLayout>(Tree);
+      if (!ProfileOpts.GeneratePath.empty())
+        createCounters(ProfileOpts.GeneratePath);
+      if (ProfileOpts.Use)
+      {
+        if (ProfileOpts.Use->Hash == Layout->hash() && ProfileOpts.Use->Counts.size() == Layout->size())
+          Profile = ProfileOpts.Use;
+        else
+          Diag << "Warning: the profile does not match the program and is ignored\n";
+      }
+      if (ProfileOpts.ExecProfile)
+        createExecCounters(Tree, ProfileOpts.ExecCycles);
+
+      if (DIB)
+      {
+        DISubroutineType *MainTy = DIB->createSubroutineType(DIB->getOrCreateTypeArray({DIIntTy}));
+        SP = DIB->createFunction(File, "main", "main", File, 1, MainTy, 1, DINode::FlagPrototyped,
+                                 DISubprogram::SPFlagDefinition);
+        MainFn->setSubprogram(SP);
+      }
+
       // Create a basic block for the entry point of the main function.
       BasicBlock *BB = BasicBlock::Create(M->getContext(), "entry", MainFn);
       Builder.SetInsertPoint(BB);
 
+      Value *Start = ExecTotal ? readCycles() : nullptr;
+
+      StmtSize Measure;
+      std::vector<unsigned> Sizes;
+      for (AST *Stmt : *Tree)
+      {
+        unsigned Before = Measure.Size;
+        Stmt->accept(Measure);
+        Sizes.push_back(Measure.Size - Before);
+      }
+      if (GlobalsThreshold && Measure.Vars.size() > GlobalsThreshold)
+        createGlobals(Measure.Vars);
+      createArrays(Measure.Arrays);
+      if (Results != ResultFormat::Text)
+        openResults(Measure.Declared);
+
       // Visit the root node of the AST to generate IR.
-      Tree->accept(*this);
+      if (ChunkSize && Measure.Size > ChunkSize)
+        emitChunks(Tree, Sizes, Measure.Vars, ChunkSize);
+      else
+        Tree->accept(*this);
+
+      if (ExecTotal)
+        Builder.CreateStore(Builder.CreateSub(readCycles(), Start), ExecTotal);
 
       // Create a return instruction at the end of the main function.
       Builder.CreateRet(Int32Zero);
+
+      if (DIB)
+        DIB->finalize();
+    }
+
+    // Number the variables Names in order and start the binary result
+    // stream; records begin with a header that names them.
+    void openResults(ArrayRef<StringRef> Names)
+    {
+      for (unsigned I = 0, E = Names.size(); I != E; ++I)
+        VarIds[Names[I]] = I;
+
+      Constant *NamesPtr = ConstantPointerNull::get(cast<PointerType>(Int8PtrPtrTy));
+      if (Results == ResultFormat::Records && !Names.empty())
+      {
+        SmallVector<Constant *, 16> NamePtrs;
+        for (StringRef Name : Names)
+          NamePtrs.push_back(Builder.CreateGlobalStringPtr(Name, "compiler.name", 0, M));
+        ArrayType *NamesTy = ArrayType::get(Int8PtrTy, NamePtrs.size());
+        auto *NamesVar = new GlobalVariable(*M, NamesTy, true, GlobalValue::PrivateLinkage,
+                                            ConstantArray::get(NamesTy, NamePtrs), "compiler.names");
+        NamesPtr = ConstantExpr::getInBoundsGetElementPtr(NamesTy, NamesVar, ArrayRef<Constant *>{Int32Zero, Int32Zero});
+      }
+      FunctionCallee OpenFn = M->getOrInsertFunction(
+          "compiler_results_open", FunctionType::get(VoidTy, {Int32Ty, Int8PtrPtrTy, Int32Ty}, false));
+      Builder.CreateCall(OpenFn, {Builder.getInt32(static_cast<unsigned>(Results)), NamesPtr,
+                                  Builder.getInt32(Results == ResultFormat::Records ? Names.size() : 0)});
+    }
+
+    // Write Val, the new value of Var, as a result.
+    void emitWrite(StringRef Var, Value *Val)
+    {
+      switch (Results)
+      {
+      case ResultFormat::Text:
+        Builder.CreateCall(CompilerWriteFnTy, CompilerWriteFn, {Val});
+        break;
+      case ResultFormat::Raw:
+        Builder.CreateCall(M->getOrInsertFunction("compiler_write_raw", VoidTy, Int32Ty), {Val});
+        break;
+      case ResultFormat::Records:
+        Builder.CreateCall(M->getOrInsertFunction("compiler_write_record", VoidTy, Int32Ty, Int32Ty),
+                           {Builder.getInt32(VarIds.lookup(Var)), Val});
+        break;
+      }
+    }
+
+    // Give each variable of Vars a zero-initialized internal global, so that
+    // a large set of them costs neither a stack slot nor a store each.
+    void createGlobals(ArrayRef<StringRef> Vars)
+    {
+      GlobalVars = true;
+      for (StringRef Var : Vars)
+      {
+        auto *GV = new GlobalVariable(*M, Int32Ty, false, GlobalValue::InternalLinkage, Int32Zero,
+                                      "compiler.var." + Var);
+        nameMap[Var] = GV;
+        if (DIB)
+        {
+          unsigned Line = SM->getLineAndColumn(SM->getLocation(Var.data())).first;
+          GV->addDebugInfo(DIB->createGlobalVariableExpression(CU, Var, GV->getName(), File, Line, DIIntTy, true));
+        }
+      }
+    }
+
+    // Give each array of Decls a zero-initialized internal global of its
+    // number of elements.
+    void createArrays(ArrayRef<std::pair<StringRef, unsigned>> Decls)
+    {
+      for (const auto &Decl : Decls)
+      {
+        ArrayType *Ty = ArrayType::get(Int32Ty, Decl.second);
+        auto *GV = new GlobalVariable(*M, Ty, false, GlobalValue::InternalLinkage, ConstantAggregateZero::get(Ty),
+                                      "compiler.array." + Decl.first);
+        Arrays[Decl.first] = {ConstantExpr::getInBoundsGetElementPtr(Ty, GV, ArrayRef<Constant *>{Int32Zero, Int32Zero}),
+                              Decl.second};
+        if (DIB)
+        {
+          unsigned Line = SM->getLineAndColumn(SM->getLocation(Decl.first.data())).first;
+          DIType *DITy = DIB->createArrayType(uint64_t(Decl.second) * 32, 32, DIIntTy,
+                                              DIB->getOrCreateArray({DIB->getOrCreateSubrange(0, Decl.second)}));
+          GV->addDebugInfo(DIB->createGlobalVariableExpression(CU, Decl.first, GV->getName(), File, Line, DITy, true));
+        }
+      }
+    }
+
+    // Emit the statements of Tree, whose sizes are Sizes, into functions of
+    // at most ChunkSize nodes, which main calls in order. Unless they are
+    // globals, the variables Vars are passed to them in a frame.
+    void emitChunks(Program *Tree, ArrayRef<unsigned> Sizes, ArrayRef<StringRef> Vars, unsigned ChunkSize)
+    {
+      Value *Frame = nullptr;
+      if (!GlobalVars)
+      {
+        // Sema makes sure that every variable is declared once.
+        for (StringRef Var : Vars)
+        {
+          FrameSlots[Var] = FrameVars.size();
+          FrameVars.push_back(Var);
+        }
+        ArrayType *FrameTy = ArrayType::get(Int32Ty, FrameVars.size());
+        Frame = Builder.CreateConstInBoundsGEP2_32(FrameTy, Builder.CreateAlloca(FrameTy, nullptr, "frame"), 0, 0);
+      }
+
+      BasicBlock *MainBB = Builder.GetInsertBlock();
+      DISubprogram *MainSP = SP;
+      ArrayRef<AST *> Stmts(Tree->begin(), Tree->end());
+      for (size_t Begin = 0, NumChunks = 0; Begin != Stmts.size(); ++NumChunks)
+      {
+        // A statement larger than a chunk gets one of its own.
+        size_t End = Begin + 1;
+        unsigned Size = Sizes[Begin];
+        while (End != Stmts.size() && Size + Sizes[End] <= ChunkSize)
+          Size += Sizes[End++];
+
+        Function *Chunk = emitChunk(Stmts.slice(Begin, End - Begin), "main.chunk" + Twine(NumChunks), Frame != nullptr);
+        Builder.SetInsertPoint(MainBB);
+        SP = MainSP;
+        setDebugLoc(*Stmts[Begin]);
+        if (Frame)
+          Builder.CreateCall(Chunk, {Frame});
+        else
+          Builder.CreateCall(Chunk);
+        Begin = End;
+      }
+      ChunkFrame = nullptr;
+    }
+
+    // Emit `void Name(i32 *Frame)` running Stmts, with the variables in
+    // Frame at the slots emitChunks gave them, or `void Name()` if the
+    // variables are globals.
+    Function *emitChunk(ArrayRef<AST *> Stmts, const Twine &Name, bool WithFrame)
+    {
+      SmallVector<Type *, 1> Params;
+      if (WithFrame)
+        Params.push_back(Int32Ty->getPointerTo());
+      Function *ChunkFn = Function::Create(FunctionType::get(VoidTy, Params, false), GlobalValue::InternalLinkage,
+                                           Name, M);
+      // Inlined into main again, the chunks would bring back its size. Only
+      // the chunk writes to the frame while it runs.
+      ChunkFn->addFnAttr(Attribute::NoInline);
+      if (WithFrame)
+      {
+        ChunkFn->addParamAttr(0, Attribute::NoAlias);
+        ChunkFn->addParamAttr(0, Attribute::NoCapture);
+      }
+
+      if (DIB)
+      {
+        unsigned Line = SM->getLineAndColumn(Stmts.front()->getLoc()).first;
+        SmallVector<Metadata *, 2> Types = {nullptr};
+        if (WithFrame)
+          Types.push_back(DIB->createPointerType(DIIntTy, 64));
+        DISubroutineType *ChunkTy = DIB->createSubroutineType(DIB->getOrCreateTypeArray(Types));
+        SP = DIB->createFunction(File, ChunkFn->getName(), ChunkFn->getName(), File, Line, ChunkTy, Line,
+                                 DINode::FlagPrototyped,
+                                 DISubprogram::SPFlagDefinition | DISubprogram::SPFlagLocalToUnit);
+        ChunkFn->setSubprogram(SP);
+      }
+
+      FrameEntry = BasicBlock::Create(M->getContext(), "entry", ChunkFn);
+      BasicBlock *Body = BasicBlock::Create(M->getContext(), "body", ChunkFn);
+      BranchInst::Create(Body, FrameEntry);
+      if (WithFrame)
+      {
+        ChunkFrame = ChunkFn->getArg(0);
+        nameMap.clear();
+      }
+
+      Builder.SetInsertPoint(Body);
+      for (AST *Stmt : Stmts)
+        Stmt->accept(*this);
+      Builder.CreateRetVoid();
+      return ChunkFn;
+    }
+
+    // Pointer to the storage of the variable Name. In a chunk, the address
+    // of its frame slot is taken in the entry block the first time it is
+    // used, and that is also where the debugger learns about it.
+    Value *storageOf(StringRef Name)
+    {
+      Value *&Storage = nameMap[Name];
+      if (Storage || !ChunkFrame)
+        return Storage;
+      unsigned Slot = FrameSlots.lookup(Name);
+      IRBuilder<> Entry(FrameEntry->getTerminator());
+      Storage = Entry.CreateConstInBoundsGEP1_32(Int32Ty, ChunkFrame, Slot);
+      if (SP)
+      {
+        unsigned Line = SM->getLineAndColumn(SM->getLocation(FrameVars[Slot].data())).first;
+        DIExpression *Offset = Slot ? DIB->createExpression({dwarf::DW_OP_plus_uconst, 4u * Slot})
+                                    : DIB->createExpression();
+        DILocalVariable *Var = DIB->createAutoVariable(SP, FrameVars[Slot], File, Line, DIIntTy);
+        DIB->insertDeclare(ChunkFrame, Var, Offset, DILocation::get(M->getContext(), Line, 0, SP),
+                           FrameEntry->getTerminator());
+      }
+      return Storage;
+    }
+
+    // Create the counters of an instrumented build and a destructor that
+    // hands them to compiler_profile_dump at exit.
+    void createCounters(StringRef Path)
+    {
+      Type *Int64Ty = Builder.getInt64Ty();
+      ArrayType *CountersTy = ArrayType::get(Int64Ty, Layout->size());
+      Counters = new GlobalVariable(*M, CountersTy, false, GlobalValue::InternalLinkage,
+                                    ConstantAggregateZero::get(CountersTy), "compiler.profile.counters");
+
+      FunctionType *DumpTy = FunctionType::get(VoidTy, {Int8PtrTy, Int64Ty, Int64Ty->getPointerTo(), Int32Ty}, false);
+      FunctionCallee DumpFn = M->getOrInsertFunction("compiler_profile_dump", DumpTy);
+
+      Function *WriteFn = Function::Create(FunctionType::get(VoidTy, false), GlobalValue::InternalLinkage,
+                                           "compiler.profile.write", M);
+      Builder.SetInsertPoint(BasicBlock::Create(M->getContext(), "entry", WriteFn));
+      Value *First = Builder.CreateConstInBoundsGEP2_32(CountersTy, Counters, 0, 0);
+      Builder.CreateCall(DumpFn, {Builder.CreateGlobalStringPtr(Path, "compiler.profile.path"),
+                                  Builder.getInt64(Layout->hash()), First, Builder.getInt32(Layout->size())});
+      Builder.CreateRetVoid();
+      appendToGlobalDtors(*M, WriteFn, 65535);
+    }
+
+    // Add Step (an i1 or an i64), or one, to counter Idx of an instrumented
+    // build.
+    void count(unsigned Idx, Value *Step = nullptr)
+    {
+      if (!Counters)
+        return;
+      Type *Int64Ty = Builder.getInt64Ty();
+      Value *Ptr = Builder.CreateConstInBoundsGEP2_32(Counters->getValueType(), Counters, 0, Idx);
+      Value *Inc = Step ? Builder.CreateZExt(Step, Int64Ty) : Builder.getInt64(1);
+      Builder.CreateStore(Builder.CreateAdd(Builder.CreateLoad(Int64Ty, Ptr), Inc), Ptr);
+    }
+
+    // Create the per-statement counters of -fexec-profile and a destructor
+    // that prints the report with compiler_exec_report at exit.
+    void createExecCounters(Program *Tree, bool Cycles)
+    {
+      Stmts = std::make_unique<StmtTable>(Tree);
+      ArrayRef<StmtTable::Entry> Entries = Stmts->entries();
+      Type *Int64Ty = Builder.getInt64Ty();
+      Type *Int64PtrTy = Int64Ty->getPointerTo();
+      ArrayType *CountersTy = ArrayType::get(Int64Ty, Entries.size());
+
+      ExecCounts = new GlobalVariable(*M, CountersTy, false, GlobalValue::InternalLinkage,
+                                      ConstantAggregateZero::get(CountersTy), "compiler.exec.counts");
+      if (Cycles)
+      {
+        ExecCycles = new GlobalVariable(*M, CountersTy, false, GlobalValue::InternalLinkage,
+                                        ConstantAggregateZero::get(CountersTy), "compiler.exec.cycles");
+        ExecTotal = new GlobalVariable(*M, Int64Ty, false, GlobalValue::InternalLinkage,
+                                       Builder.getInt64(0), "compiler.exec.total");
+      }
+
+      SmallVector<Constant *, 32> Labels;
+      SmallVector<uint8_t, 32> Kinds;
+      for (const StmtTable::Entry &E : Entries)
+      {
+        Labels.push_back(Builder.CreateGlobalStringPtr(E.Text, "compiler.exec.label", 0, M));
+        Kinds.push_back(E.Kind);
+      }
+      ArrayType *LabelsTy = ArrayType::get(Int8PtrTy, Labels.size());
+      auto *LabelsVar = new GlobalVariable(*M, LabelsTy, true, GlobalValue::PrivateLinkage,
+                                           ConstantArray::get(LabelsTy, Labels), "compiler.exec.labels");
+      Constant *KindsInit = ConstantDataArray::get(M->getContext(), makeArrayRef(Kinds));
+      auto *KindsVar = new GlobalVariable(*M, KindsInit->getType(), true, GlobalValue::PrivateLinkage,
+                                          KindsInit, "compiler.exec.kinds");
+
+      FunctionType *ReportTy = FunctionType::get(
+          VoidTy, {Int8PtrPtrTy, Int8PtrTy, Int64PtrTy, Int64PtrTy, Int32Ty, Int64Ty}, false);
+      FunctionCallee ReportFn = M->getOrInsertFunction("compiler_exec_report", ReportTy);
+
+      Function *WriteFn = Function::Create(FunctionType::get(VoidTy, false), GlobalValue::InternalLinkage,
+                                           "compiler.exec.write", M);
+      Builder.SetInsertPoint(BasicBlock::Create(M->getContext(), "entry", WriteFn));
+      Value *CyclesPtr = ExecCycles ? Builder.CreateConstInBoundsGEP2_32(CountersTy, ExecCycles, 0, 0)
+                                    : ConstantPointerNull::get(cast<PointerType>(Int64PtrTy));
+      Value *Total = ExecTotal ? static_cast<Value *>(Builder.CreateLoad(Int64Ty, ExecTotal)) : Builder.getInt64(0);
+      Builder.CreateCall(ReportFn, {Builder.CreateConstInBoundsGEP2_32(LabelsTy, LabelsVar, 0, 0),
+                                    Builder.CreateConstInBoundsGEP2_32(KindsVar->getValueType(), KindsVar, 0, 0),
+                                    Builder.CreateConstInBoundsGEP2_32(CountersTy, ExecCounts, 0, 0),
+                                    CyclesPtr, Builder.getInt32(Entries.size()), Total});
+      Builder.CreateRetVoid();
+      appendToGlobalDtors(*M, WriteFn, 65535);
+    }
+
+    // Count one execution of Stmt, or Times (an i64), for -fexec-profile.
+    void countStmt(AST *Stmt, Value *Times = nullptr)
+    {
+      if (!ExecCounts)
+        return;
+      Type *Int64Ty = Builder.getInt64Ty();
+      Value *Ptr = Builder.CreateConstInBoundsGEP2_32(ExecCounts->getValueType(), ExecCounts, 0, Stmts->indexOf(Stmt));
+      Value *Inc = Times ? Times : Builder.getInt64(1);
+      Builder.CreateStore(Builder.CreateAdd(Builder.CreateLoad(Int64Ty, Ptr), Inc), Ptr);
+    }
+
+    Value *readCycles() { return Builder.CreateIntrinsic(Intrinsic::readcyclecounter, {}, {}); }
+
+    // Describe the variable Name, declared at Name in the source, to the
+    // debugger.
+    void declareVariable(AllocaInst *Storage, StringRef Name)
+    {
+      unsigned Line = SM->getLineAndColumn(SM->getLocation(Name.data())).first;
+      DILocalVariable *Var = DIB->createAutoVariable(SP, Name, File, Line, DIIntTy);
+      DIB->insertDeclare(Storage, Var, DIB->createExpression(), Builder.getCurrentDebugLocation(),
+                         Builder.GetInsertBlock());
+    }
+
+    uint64_t profileCount(unsigned Idx) { return Profile->Counts[Idx]; }
+
+    // Attach the profiled weights of its two successors to Br.
+    void setWeights(BranchInst *Br, uint64_t Taken, uint64_t NotTaken)
+    {
+      if (!Profile)
+        return;
+      // Weights are 32 bits wide; scale both alike and keep them nonzero.
+      uint64_t Scale = std::max(Taken, NotTaken) / UINT32_MAX + 1;
+      MDBuilder MDB(M->getContext());
+      Br->setMetadata(LLVMContext::MD_prof, MDB.createBranchWeights(Taken / Scale + 1, NotTaken / Scale + 1));
+    }
+
+    // Generate `void Name(i32 *Frame)` that runs a single loop, with the
+    // variables Vars living one after the other in Frame; see compileLoop.
+    Function *runLoop(IterStmt *Loop, ArrayRef<StringRef> Vars, ArrayRef<unsigned> Sizes, StringRef Name)
+    {
+      FunctionType *LoopFty = FunctionType::get(VoidTy, {Int32Ty->getPointerTo()}, false);
+      Function *LoopFn = Function::Create(LoopFty, GlobalValue::ExternalLinkage, Name, M);
+
+      BasicBlock *BB = BasicBlock::Create(M->getContext(), "entry", LoopFn);
+      Builder.SetInsertPoint(BB);
+
+      if (DIB)
+      {
+        unsigned Line = SM->getLineAndColumn(Loop->getLoc()).first;
+        DIType *FrameTy = DIB->createPointerType(DIIntTy, 64);
+        DISubroutineType *LoopTy = DIB->createSubroutineType(DIB->getOrCreateTypeArray({nullptr, FrameTy}));
+        SP = DIB->createFunction(File, Name, Name, File, Line, LoopTy, Line, DINode::FlagPrototyped,
+                                 DISubprogram::SPFlagDefinition);
+        LoopFn->setSubprogram(SP);
+      }
+
+      Value *Frame = LoopFn->getArg(0);
+      for (unsigned I = 0, E = Vars.size(), Slot = 0; I != E; Slot += std::max(Sizes[I], 1u), ++I)
+      {
+        VarIds[Vars[I]] = I;
+        Value *Ptr = Builder.CreateConstInBoundsGEP1_32(Int32Ty, Frame, Slot);
+        if (Sizes[I])
+          Arrays[Vars[I]] = {Ptr, Sizes[I]};
+        else
+          nameMap[Vars[I]] = Ptr;
+      }
+
+      Loop->accept(*this);
+
+      Builder.CreateRetVoid();
+
+      if (DIB)
+        DIB->finalize();
+      return LoopFn;
     }
 
     // Visit function for the Program node in the AST.
@@ -75,101 +674,272 @@ ns{
 
     virtual void visit(Assignment &Node) override
     {
+      setDebugLoc(Node);
+      if (!InParallelBody)
+        countStmt(&Node);
+
+      // Get the name of the variable being assigned.
+      llvm::StringRef varName = Node.getLeft()->getVal();
+
+      // A whole array is assigned element by element, and printed by none.
+      if (!Node.getIndex() && Arrays.count(varName))
+      {
+        emitArrayAssign(Node);
+        return;
+      }
+
       // Visit the right-hand side of the assignment and get its value.
       Node.getRight()->accept(*this);
       Value *val = V;
 
-      // Get the name of the variable being assigned.
-      llvm::StringRef varName = Node.getLeft()->getVal();
+      // An element of an array is assigned like a variable.
+      if (Expr *Index = Node.getIndex())
+      {
+        Index->accept(*this);
+        Value *Ptr = elementPtr(varName, V, Index);
+        setDebugLoc(Node);
+        if (Node.getAssignKind() != Assignment::Assign)
+          val = createArith(operatorOf(Node.getAssignKind()), Builder.CreateLoad(Int32Ty, Ptr), val,
+                            Node.getLeft(), Node.getRight());
+        Builder.CreateStore(val, Ptr);
+        if (!InParallelBody)
+          emitWrite(varName, val);
+        return;
+      }
       
+      // A reduction of a parloopc holds a partial result, which wraps like
+      // the sum or product of the whole loop and may leave the range Sema
+      // found for the variable.
+      if (Reductions.count(varName))
+      {
+        Value *Ptr = storageOf(varName);
+        Value *Partial = Builder.CreateLoad(Int32Ty, Ptr);
+        setDebugLoc(Node);
+        if (Node.getAssignKind() == Assignment::Star_assign)
+          Builder.CreateStore(Builder.CreateMul(Partial, val), Ptr);
+        else if (Node.getAssignKind() == Assignment::Plus_assign)
+          Builder.CreateStore(Builder.CreateAdd(Partial, val), Ptr);
+        else
+          Builder.CreateStore(Builder.CreateSub(Partial, val), Ptr);
+        return;
+      }
+
       // Get the value of the variable being assigned.
       Node.getLeft()->accept(*this);
       Value *varVal = V;
+      setDebugLoc(Node);
+
+      if (Node.getAssignKind() != Assignment::Assign)
+        val = createArith(operatorOf(Node.getAssignKind()), varVal, val, Node.getLeft(), Node.getRight());
+
+      // Create a store instruction to assign the value to the variable.
+      Builder.CreateStore(val, storageOf(varName));
+
+      // Write the value as a result.
+      if (!InParallelBody)
+        emitWrite(varName, val);
+    };
 
-      switch (Node.getAssignKind())
+    // The operator of a compound assignment.
+    static BinaryOp::Operator operatorOf(Assignment::AssignKind Kind)
+    {
+      switch (Kind)
       {
-      case Assignment::Plus_assign:
-        val = Builder.CreateNSWAdd(varVal, val);
-        break;
       case Assignment::Minus_assign:
-        val = Builder.CreateNSWSub(varVal, val);
-        break;
+        return BinaryOp::Minus;
       case Assignment::Star_assign:
-        val = Builder.CreateNSWMul(varVal, val);
-        break;
+        return BinaryOp::Mul;
       case Assignment::Slash_assign:
-        val = Builder.CreateSDiv(varVal, val);
-        break;
+        return BinaryOp::Div;
       case Assignment::Mod_assign:
-        val = Builder.CreateSRem(varVal, val);
-        break;
+        return BinaryOp::Mod;
       case Assignment::Exp_assign:
-        val = CreateExp(varVal, val);
-        break;
+        return BinaryOp::Exp;
       default:
-        break;
+        return BinaryOp::Plus;
       }
+    }
 
-      // Create a store instruction to assign the value to the variable.
-      Builder.CreateStore(val, nameMap[varName]);
+    // Emit a loop over the elements of an array of Size elements, which Body
+    // emits one of, given its index as an i64. Acc, if Init is given, starts
+    // as Init and becomes what Body returns for each element; the loop
+    // returns its last value.
+    Value *emitElementLoop(unsigned Size, Value *Init, function_ref<Value *(Value *K, Value *Acc)> Body)
+    {
+      Type *Int64Ty = Builder.getInt64Ty();
+      BasicBlock *Pre = Builder.GetInsertBlock();
+      BasicBlock *LoopBB = BasicBlock::Create(M->getContext(), "array.loop", Pre->getParent());
+      BasicBlock *AfterBB = BasicBlock::Create(M->getContext(), "after.array", Pre->getParent());
+      Builder.CreateBr(LoopBB);
 
-      // Create a call instruction to invoke the "compiler_write" function with the value.
-      CallInst *Call = Builder.CreateCall(CompilerWriteFnTy, CompilerWriteFn, {val});
-    };
+      Builder.SetInsertPoint(LoopBB);
+      PHINode *K = Builder.CreatePHI(Int64Ty, 2);
+      K->addIncoming(Builder.getInt64(0), Pre);
+      PHINode *Acc = nullptr;
+      if (Init)
+      {
+        Acc = Builder.CreatePHI(Int32Ty, 2);
+        Acc->addIncoming(Init, Pre);
+      }
+      Value *Result = Body(K, Acc);
+      Value *Next = Builder.CreateAdd(K, Builder.getInt64(1), "", true, true);
+      K->addIncoming(Next, Builder.GetInsertBlock());
+      if (Acc)
+        Acc->addIncoming(Result, Builder.GetInsertBlock());
+      Builder.CreateCondBr(Builder.CreateICmpULT(Next, Builder.getInt64(Size)), LoopBB, AfterBB);
+      Builder.SetInsertPoint(AfterBB);
+      return Acc ? Result : nullptr;
+    }
+
+    // Assign each element of the array that Node assigns, with the arrays
+    // on the right standing for their elements at the same index. Those need
+    // no checks, so the loop is left to the vectorizer.
+    void emitArrayAssign(Assignment &Node)
+    {
+      const ArrayStorage &A = Arrays.find(Node.getLeft()->getVal())->second;
+      emitElementLoop(A.Size, nullptr, [&](Value *K, Value *) -> Value * {
+        Element = K;
+        Node.getRight()->accept(*this);
+        Element = nullptr;
+        Value *Val = V;
+        setDebugLoc(Node);
+        Value *Ptr = Builder.CreateInBoundsGEP(Int32Ty, A.Base, K);
+        if (Node.getAssignKind() != Assignment::Assign)
+          Val = createArith(operatorOf(Node.getAssignKind()), Builder.CreateLoad(Int32Ty, Ptr), Val, Node.getLeft(),
+                            Node.getRight());
+        Builder.CreateStore(Val, Ptr);
+        return nullptr;
+      });
+    }
+
+    // Pointer to the element at Index (an i32, the value of IndexExpr) of the
+    // array Name. Unless Sema proved it in range, the index is checked first,
+    // and compiler_index_error stops the program if it is out of range.
+    Value *elementPtr(StringRef Name, Value *Index, Expr *IndexExpr)
+    {
+      const ArrayStorage &A = Arrays.find(Name)->second;
+      ValueRange R = IndexExpr->getRange();
+      if (!R.isKnown() || R.Lo < 0 || int64_t(R.Hi) >= A.Size)
+      {
+        FunctionCallee ErrorFn = M->getOrInsertFunction("compiler_index_error",
+                                                        FunctionType::get(VoidTy, {Int32Ty, Int32Ty}, false));
+        if (auto *F = dyn_cast<Function>(ErrorFn.getCallee()))
+        {
+          F->setDoesNotReturn();
+          F->setDoesNotThrow();
+          F->addFnAttr(Attribute::Cold);
+        }
+        Function *Fn = Builder.GetInsertBlock()->getParent();
+        BasicBlock *ErrorBB = BasicBlock::Create(M->getContext(), "index.error", Fn);
+        BasicBlock *OkBB = BasicBlock::Create(M->getContext(), "index.ok", Fn);
+        Builder.CreateCondBr(Builder.CreateICmpULT(Index, Builder.getInt32(A.Size)), OkBB, ErrorBB);
+        Builder.SetInsertPoint(ErrorBB);
+        Builder.CreateCall(ErrorFn, {Index, Builder.getInt32(A.Size)});
+        Builder.CreateUnreachable();
+        Builder.SetInsertPoint(OkBB);
+      }
+      return Builder.CreateInBoundsGEP(Int32Ty, A.Base, Builder.CreateZExt(Index, Builder.getInt64Ty()));
+    }
+
+    virtual void visit(ArrayElement &Node) override
+    {
+      Node.getIndex()->accept(*this);
+      setDebugLoc(Node);
+      V = Builder.CreateLoad(Int32Ty, elementPtr(Node.getArray(), V, Node.getIndex()));
+    }
+
+    // A loop the vectorizer knows as a reduction.
+    virtual void visit(ArrayReduce &Node) override
+    {
+      setDebugLoc(Node);
+      const ArrayStorage &A = Arrays.find(Node.getArray())->second;
+      ArrayReduce::Operator Op = Node.getOperator();
+      Value *Init = Op == ArrayReduce::Sum ? Int32Zero : Builder.getInt32(Op == ArrayReduce::Min ? INT32_MAX : INT32_MIN);
+      V = emitElementLoop(A.Size, Init, [&](Value *K, Value *Acc) -> Value * {
+        Value *Elem = Builder.CreateLoad(Int32Ty, Builder.CreateInBoundsGEP(Int32Ty, A.Base, K));
+        if (Op == ArrayReduce::Sum)
+          return Builder.CreateAdd(Acc, Elem);
+        return Builder.CreateBinaryIntrinsic(Op == ArrayReduce::Min ? Intrinsic::smin : Intrinsic::smax, Acc, Elem);
+      });
+    }
 
     virtual void visit(Final &Node) override
     {
+      setDebugLoc(Node);
+      auto Array = Element ? Arrays.find(Node.getVal()) : Arrays.end();
+      if (Array != Arrays.end())
+      {
+        V = Builder.CreateLoad(Int32Ty, Builder.CreateInBoundsGEP(Int32Ty, Array->second.Base, Element));
+        return;
+      }
       if (Node.getKind() == Final::Ident)
       {
-        // If the Final is an identifier, load its value from memory.
-        V = Builder.CreateLoad(Int32Ty, nameMap[Node.getVal()]);
+        // If the Final is an identifier, load its value from memory, in the
+        // range Sema found for it.
+        LoadInst *Load = Builder.CreateLoad(Int32Ty, storageOf(Node.getVal()));
+        ValueRange Range = Node.getRange();
+        if (Range.isKnown() && !Range.isFull())
+          Load->setMetadata(LLVMContext::MD_range,
+                            MDBuilder(M->getContext()).createRange(APInt(32, Range.Lo, true),
+                                                                   APInt(32, int64_t(Range.Hi) + 1, true)));
+        V = Load;
       }
       else
       {
         // If the Final is a literal, convert it to an integer and create a constant.
-        int intval;
-        Node.getVal().getAsInteger(10, intval);
+        // Sema has rejected numbers that do not fit in an int.
+        int32_t intval = 0;
+        if (Node.getVal().getAsInteger(10, intval))
+          llvm_unreachable("number does not fit in an int");
         V = ConstantInt::get(Int32Ty, intval, true);
       }
     };
 
     virtual void visit(BinaryOp &Node) override
     {
-      // Visit the left-hand side of the binary operation and get its value.
-      Node.getLeft()->accept(*this);
-      Value *Left = V;
+      // Visit the leftmost operand, then apply the operations down the left
+      // spine from the innermost out, each to the value so far and the value
+      // of its right-hand side.
+      SmallVector<BinaryOp *, 16> Spine = leftSpine(Node);
+      Spine.front()->getLeft()->accept(*this);
+      for (BinaryOp *Op : Spine)
+      {
+        Value *Left = V;
+        Op->getRight()->accept(*this);
+        Value *Right = V;
 
-      // Visit the right-hand side of the binary operation and get its value.
-      Node.getRight()->accept(*this);
-      Value *Right = V;
+        // Perform the binary operation based on the operator type and create the corresponding instruction.
+        setDebugLoc(*Op);
+        V = createArith(Op->getOperator(), Left, Right, Op->getLeft(), Op->getRight());
+      }
+    };
 
-      // Perform the binary operation based on the operator type and create the corresponding instruction.
-      switch (Node.getOperator())
+    // Emit Left Op Right, whose operands are the expressions LeftExpr and
+    // RightExpr. Where Sema proved them nonnegative, the unsigned forms are
+    // used, which the optimizer knows more about.
+    Value *createArith(BinaryOp::Operator Op, Value *Left, Value *Right, Expr *LeftExpr, Expr *RightExpr)
+    {
+      ValueRange L = LeftExpr->getRange(), R = RightExpr->getRange();
+      bool NonNegative = L.isKnown() && R.isKnown() && L.Lo >= 0 && R.Lo >= 0;
+      switch (Op)
       {
       case BinaryOp::Plus:
-        V = Builder.CreateNSWAdd(Left, Right);
-        break;
+        return Builder.CreateAdd(Left, Right, "", NonNegative, true);
       case BinaryOp::Minus:
-        V = Builder.CreateNSWSub(Left, Right);
-        break;
+        return Builder.CreateSub(Left, Right, "", NonNegative && L.Lo >= R.Hi, true);
       case BinaryOp::Mul:
-        V = Builder.CreateNSWMul(Left, Right);
-        break;
+        return Builder.CreateMul(Left, Right, "", NonNegative, true);
       case BinaryOp::Div:
-        V = Builder.CreateSDiv(Left, Right);
-        break;
+        return NonNegative && R.Lo > 0 ? Builder.CreateUDiv(Left, Right) : Builder.CreateSDiv(Left, Right);
       case BinaryOp::Mod:
-        V = Builder.CreateSRem(Left, Right);
-        break;
+        return NonNegative && R.Lo > 0 ? Builder.CreateURem(Left, Right) : Builder.CreateSRem(Left, Right);
       case BinaryOp::Exp:
-        V = CreateExp(Left, Right);
-        break;
-      default:
-        break;
+        return CreateExp(Left, Right, L.isKnown() && L.Lo >= 0);
       }
-    };
+      return nullptr;
+    }
 
-    Value* CreateExp(Value *Left, Value *Right)
+    Value* CreateExp(Value *Left, Value *Right, bool NonNegative)
     { 
       Value* res = Int32One;
 
@@ -181,19 +951,44 @@ ns{
         // Now, 'intValue' contains the actual integer value.
       } else {
         // Handle the case where the Value is not an integer constant
-        llvm::errs() << "Error: The exponent only allowed to be a constant.\n";
-        exit(3);
+        Diag << "Error: The exponent only allowed to be a constant.\n";
+        HasError = true;
+        return res;
       }
 
       for (int i = 0; i < intValue; ++i)
       {
-        res = Builder.CreateNSWMul(res, Left);
+        res = Builder.CreateMul(res, Left, "", NonNegative, true);
       }
       return res;
     }
 
+    // Each variable is read with compiler_read, and each array with
+    // compiler_read_array, which fills all its elements in one call. Both
+    // get the name, to prompt with and to report errors.
+    virtual void visit(ReadStmt &Node) override
+    {
+      setDebugLoc(Node);
+      countStmt(&Node);
+      FunctionCallee ReadFn = M->getOrInsertFunction("compiler_read", FunctionType::get(Int32Ty, {Int8PtrTy}, false));
+      FunctionCallee ReadArrayFn = M->getOrInsertFunction(
+          "compiler_read_array", FunctionType::get(VoidTy, {Int8PtrTy, Int32Ty->getPointerTo(), Int32Ty}, false));
+      for (Final *Var : make_range(Node.varBegin(), Node.varEnd()))
+      {
+        setDebugLoc(*Var);
+        Value *Name = Builder.CreateGlobalStringPtr(Var->getVal(), "compiler.name", 0, M);
+        auto Array = Arrays.find(Var->getVal());
+        if (Array != Arrays.end())
+          Builder.CreateCall(ReadArrayFn, {Name, Array->second.Base, Builder.getInt32(Array->second.Size)});
+        else
+          Builder.CreateStore(Builder.CreateCall(ReadFn, {Name}), storageOf(Var->getVal()));
+      }
+    }
+
     virtual void visit(Declaration &Node) override
     {
+      setDebugLoc(Node);
+      countStmt(&Node);
       llvm::SmallVector<Value *, 8> vals;
 
       llvm::SmallVector<Expr *, 8>::const_iterator E = Node.valBegin();
@@ -216,17 +1011,45 @@ ns{
         
         Var = *S;
 
-        // Create an alloca instruction to allocate memory for the variable.
-        nameMap[Var] = Builder.CreateAlloca(Int32Ty);
+        // An array is a global, which starts out as zero, and a value is
+        // given to each of its elements.
+        if (Node.getSize(S - Node.varBegin()))
+        {
+          ConstantInt *Const = dyn_cast_or_null<ConstantInt>(*itVal);
+          if (*itVal && (!Const || !Const->isZero()))
+          {
+            Value *Init = *itVal;
+            Value *Base = Arrays.find(Var)->second.Base;
+            emitElementLoop(Arrays.find(Var)->second.Size, nullptr, [&](Value *K, Value *) -> Value * {
+              Builder.CreateStore(Init, Builder.CreateInBoundsGEP(Int32Ty, Base, K));
+              return nullptr;
+            });
+          }
+          itVal++;
+          continue;
+        }
+
+        // Create an alloca instruction to allocate memory for the variable,
+        // unless it has a slot in the frame of a chunk or is a global.
+        if (!ChunkFrame && !GlobalVars)
+        {
+          AllocaInst *Alloca = Builder.CreateAlloca(Int32Ty);
+          nameMap[Var] = Alloca;
+          if (SP)
+            declareVariable(Alloca, Var);
+        }
         
         // Store the initial value (if any) in the variable's memory location.
+        // Globals start out as zero.
         if (*itVal != nullptr)
         {
-          Builder.CreateStore(*itVal, nameMap[Var]);
+          ConstantInt *Const = dyn_cast<ConstantInt>(*itVal);
+          if (!GlobalVars || !Const || !Const->isZero())
+            Builder.CreateStore(*itVal, storageOf(Var));
         }
-        else
+        else if (!GlobalVars)
         {
-          Builder.CreateStore(Int32Zero, nameMap[Var]);
+          Builder.CreateStore(Int32Zero, storageOf(Var));
         }
         itVal++;
       }
@@ -241,6 +1064,7 @@ ns{
       Node.getRight()->accept(*this);
       Value *Right = V;
 
+      setDebugLoc(Node);
       switch (Node.getOperator())
       {
       case LogicalExpr::And:
@@ -263,6 +1087,7 @@ ns{
       Node.getRight()->accept(*this);
       Value *Right = V;
 
+      setDebugLoc(Node);
       switch (Node.getOperator())
       {
       case Comparison::Equal:
@@ -290,15 +1115,27 @@ ns{
 
     virtual void visit(IterStmt &Node) override
     {
-      llvm::BasicBlock* WhileCondBB = llvm::BasicBlock::Create(M->getContext(), "loopc.cond", Builder.GetInsertBlock()->getParent());
+      if (Node.isParallel())
+      {
+        emitParallelLoop(Node);
+        return;
+      }
+
+      // Emit the loop in rotated form: a guard in the current block, then a
+      // body that re-tests the condition at its end (the latch).
       llvm::BasicBlock* WhileBodyBB = llvm::BasicBlock::Create(M->getContext(), "loopc.body", Builder.GetInsertBlock()->getParent());
       llvm::BasicBlock* AfterWhileBB = llvm::BasicBlock::Create(M->getContext(), "after.loopc", Builder.GetInsertBlock()->getParent());
 
-      Builder.CreateBr(WhileCondBB);
-      Builder.SetInsertPoint(WhileCondBB);
+      unsigned Base = Layout ? Layout->counterFor(&Node) : 0;
+      setDebugLoc(Node);
+      countStmt(&Node);
+      Value* Start = ExecCycles ? readCycles() : nullptr;
+
       Node.getCond()->accept(*this);
       Value* val=V;
-      Builder.CreateCondBr(val, WhileBodyBB, AfterWhileBB);
+      count(Base + ProfileLayout::LoopEntered, val);
+      count(Base + ProfileLayout::LoopSkipped, Builder.CreateNot(val));
+      BranchInst* Guard = Builder.CreateCondBr(val, WhileBodyBB, AfterWhileBB);
       Builder.SetInsertPoint(WhileBodyBB);
 
       for (llvm::SmallVector<Assignment* >::const_iterator I = Node.begin(), E = Node.end(); I != E; ++I)
@@ -306,23 +1143,342 @@ ns{
             (*I)->accept(*this);
         }
 
-      Builder.CreateBr(WhileCondBB);
+      Node.getCond()->accept(*this);
+      count(Base + ProfileLayout::LoopBackEdge, V);
+      setDebugLoc(Node);
+      BranchInst* Latch = Builder.CreateCondBr(V, WhileBodyBB, AfterWhileBB);
+      if (MDNode* LoopID = createLoopID(Node.getHints()))
+        Latch->setMetadata(LLVMContext::MD_loop, LoopID);
+
+      // The latch weights also give the optimizer the average trip count.
+      if (Profile)
+      {
+        uint64_t Entered = profileCount(Base + ProfileLayout::LoopEntered);
+        setWeights(Guard, Entered, profileCount(Base + ProfileLayout::LoopSkipped));
+        setWeights(Latch, profileCount(Base + ProfileLayout::LoopBackEdge), Entered);
+      }
 
       Builder.SetInsertPoint(AfterWhileBB);
-        
+
+      if (ExecCycles)
+      {
+        Value *Ptr = Builder.CreateConstInBoundsGEP2_32(ExecCycles->getValueType(), ExecCycles, 0, Stmts->indexOf(&Node));
+        Value *Spent = Builder.CreateSub(readCycles(), Start);
+        Builder.CreateStore(Builder.CreateAdd(Builder.CreateLoad(Builder.getInt64Ty(), Ptr), Spent), Ptr);
+      }
     };
 
+    // Emit a parloopc. Its body becomes a function running a range of its
+    // iterations, and compiler_parallel_for of the runtime spreads the
+    // iterations over its threads and combines the partial results of the
+    // reductions. The body prints nothing; the loop prints the final value of
+    // each variable the body assigns, if it ran at all.
+    void emitParallelLoop(IterStmt &Node)
+    {
+      ParallelLoop Shape;
+      std::string Error;
+      SourceLocation ErrorLoc;
+      auto IsArray = [this](StringRef Name) { return Arrays.count(Name) != 0; };
+      if (!matchParallelLoop(&Node, Shape, IsArray, Error, ErrorLoc))
+      {
+        Diag << "Error: " << Error << "\n";
+        HasError = true;
+        return;
+      }
+
+      SmallVector<StringRef, 8> Privates, Reduced;
+      SmallVector<uint32_t, 8> Kinds; // of Reduced: 0 for a sum, 1 for a product
+      for (const ParallelLoop::Var &Var : Shape.Vars)
+      {
+        if (Var.Kind == ParallelLoop::Private)
+          Privates.push_back(Var.Name);
+        else if (Var.Kind != ParallelLoop::Induction)
+        {
+          Reduced.push_back(Var.Name);
+          Kinds.push_back(Var.Kind == ParallelLoop::Product);
+        }
+      }
+
+      Type *Int64Ty = Builder.getInt64Ty();
+      Type *Int32PtrTy = Int32Ty->getPointerTo();
+      unsigned Base = Layout ? Layout->counterFor(&Node) : 0;
+      setDebugLoc(Node);
+      countStmt(&Node);
+      Value *Cycles = ExecCycles ? readCycles() : nullptr;
+
+      // The body changes neither the bound nor the step, so the number of
+      // iterations is known before the first.
+      Shape.Bound->accept(*this);
+      Value *Bound = Builder.CreateSExt(V, Int64Ty);
+      Value *Start = Builder.CreateLoad(Int32Ty, storageOf(Shape.IndVar));
+      Value *Start64 = Builder.CreateSExt(Start, Int64Ty);
+      setDebugLoc(Node);
+      Value *Distance = Shape.countsUp() ? Builder.CreateSub(Bound, Start64) : Builder.CreateSub(Start64, Bound);
+      uint64_t Stride = Shape.Step < 0 ? -int64_t(Shape.Step) : Shape.Step;
+      Value *Trips;
+      if (Shape.Op == Comparison::Less || Shape.Op == Comparison::Greater)
+        Trips = Builder.CreateSelect(
+            Builder.CreateICmpSGT(Distance, Builder.getInt64(0)),
+            Builder.CreateUDiv(Builder.CreateAdd(Distance, Builder.getInt64(Stride - 1)), Builder.getInt64(Stride)),
+            Builder.getInt64(0));
+      else
+        Trips = Builder.CreateSelect(
+            Builder.CreateICmpSGE(Distance, Builder.getInt64(0)),
+            Builder.CreateAdd(Builder.CreateUDiv(Distance, Builder.getInt64(Stride)), Builder.getInt64(1)),
+            Builder.getInt64(0));
+
+      Value *Entered = Builder.CreateICmpNE(Trips, Builder.getInt64(0));
+      count(Base + ProfileLayout::LoopEntered, Entered);
+      count(Base + ProfileLayout::LoopSkipped, Builder.CreateNot(Entered));
+      count(Base + ProfileLayout::LoopBackEdge,
+            Builder.CreateSelect(Entered, Builder.CreateSub(Trips, Builder.getInt64(1)), Builder.getInt64(0)));
+      for (Assignment *Stmt : Node)
+        countStmt(Stmt, Trips);
+
+      // The body finds the number of iterations, the start and the storage
+      // of the privates and the inputs in its context.
+      SmallVector<StringRef, 8> Shared(Privates.begin(), Privates.end());
+      Shared.append(Shape.Inputs.begin(), Shape.Inputs.end());
+      StructType *CtxTy = StructType::get(M->getContext(),
+                                          {Int64Ty, Int32Ty, ArrayType::get(Int32PtrTy, Shared.size())});
+      BasicBlock *LoopBB = Builder.GetInsertBlock();
+      Function *BodyFn = emitParallelBody(Node, Shape, CtxTy, Privates.size(), Shared, Reduced);
+      Builder.SetInsertPoint(LoopBB);
+      setDebugLoc(Node);
+
+      AllocaInst *Ctx = Builder.CreateAlloca(CtxTy, nullptr, "parloopc.ctx");
+      Builder.CreateStore(Trips, Builder.CreateStructGEP(CtxTy, Ctx, 0));
+      Builder.CreateStore(Start, Builder.CreateStructGEP(CtxTy, Ctx, 1));
+      for (unsigned K = 0, E = Shared.size(); K != E; ++K)
+        Builder.CreateStore(storageOf(Shared[K]), Builder.CreateInBoundsGEP(CtxTy, Ctx, {Builder.getInt32(0),
+                                                                                          Builder.getInt32(2),
+                                                                                          Builder.getInt32(K)}));
+
+      Value *KindsPtr = ConstantPointerNull::get(cast<PointerType>(Int32PtrTy));
+      Value *Results = KindsPtr;
+      ArrayType *ResultsTy = ArrayType::get(Int32Ty, Reduced.size());
+      if (!Reduced.empty())
+      {
+        Constant *KindsInit = ConstantDataArray::get(M->getContext(), makeArrayRef(Kinds));
+        auto *KindsVar = new GlobalVariable(*M, KindsInit->getType(), true, GlobalValue::PrivateLinkage, KindsInit,
+                                            "compiler.parloopc.kinds");
+        KindsPtr = Builder.CreateConstInBoundsGEP2_32(KindsInit->getType(), KindsVar, 0, 0);
+        Results = Builder.CreateConstInBoundsGEP2_32(ResultsTy, Builder.CreateAlloca(ResultsTy, nullptr, "parloopc.results"),
+                                                     0, 0);
+        for (unsigned R = 0, E = Reduced.size(); R != E; ++R)
+          Builder.CreateStore(Builder.CreateLoad(Int32Ty, storageOf(Reduced[R])),
+                              Builder.CreateConstInBoundsGEP1_32(Int32Ty, Results, R));
+      }
+
+      FunctionType *ParallelForTy = FunctionType::get(
+          VoidTy, {Int64Ty, Int32Ty, Int32PtrTy, Int32PtrTy, BodyFn->getType(), Int8PtrTy}, false);
+      FunctionCallee ParallelFor = M->getOrInsertFunction("compiler_parallel_for", ParallelForTy);
+      Builder.CreateCall(ParallelFor, {Trips, Builder.getInt32(Reduced.size()), KindsPtr, Results, BodyFn,
+                                       Builder.CreateBitCast(Ctx, Int8PtrTy)});
+
+      for (unsigned R = 0, E = Reduced.size(); R != E; ++R)
+        Builder.CreateStore(Builder.CreateLoad(Int32Ty, Builder.CreateConstInBoundsGEP1_32(Int32Ty, Results, R)),
+                            storageOf(Reduced[R]));
+      // The induction variable ends where the serial loop would leave it.
+      Value *Steps = Builder.CreateMul(Builder.CreateTrunc(Trips, Int32Ty), Builder.getInt32(Shape.Step));
+      Builder.CreateStore(Builder.CreateAdd(Start, Steps), storageOf(Shape.IndVar));
+
+      BasicBlock *WriteBB = BasicBlock::Create(M->getContext(), "parloopc.write", LoopBB->getParent());
+      BasicBlock *AfterBB = BasicBlock::Create(M->getContext(), "after.parloopc", LoopBB->getParent());
+      Builder.CreateCondBr(Entered, WriteBB, AfterBB);
+      Builder.SetInsertPoint(WriteBB);
+      for (const ParallelLoop::Var &Var : Shape.Vars)
+        emitWrite(Var.Name, Builder.CreateLoad(Int32Ty, storageOf(Var.Name)));
+      Builder.CreateBr(AfterBB);
+      Builder.SetInsertPoint(AfterBB);
+
+      if (ExecCycles)
+      {
+        Value *Ptr = Builder.CreateConstInBoundsGEP2_32(ExecCycles->getValueType(), ExecCycles, 0, Stmts->indexOf(&Node));
+        Value *Spent = Builder.CreateSub(readCycles(), Cycles);
+        Builder.CreateStore(Builder.CreateAdd(Builder.CreateLoad(Builder.getInt64Ty(), Ptr), Spent), Ptr);
+      }
+    }
+
+    // Emit `void main.parloopN(i8 *Ctx, i64 Begin, i64 End, i32 *Partial)`
+    // running iterations [Begin, End) of the parloopc Node, whose context has
+    // the type CtxTy and holds Shared, privates first. The reductions Reduced
+    // start from and end in Partial.
+    Function *emitParallelBody(IterStmt &Node, const ParallelLoop &Shape, StructType *CtxTy, unsigned NumPrivates,
+                               ArrayRef<StringRef> Shared, ArrayRef<StringRef> Reduced)
+    {
+      Type *Int64Ty = Builder.getInt64Ty();
+      Type *Int32PtrTy = Int32Ty->getPointerTo();
+      FunctionType *BodyTy = FunctionType::get(VoidTy, {Int8PtrTy, Int64Ty, Int64Ty, Int32PtrTy}, false);
+      Function *BodyFn = Function::Create(BodyTy, GlobalValue::InternalLinkage,
+                                          "main.parloop" + Twine(NumParallelLoops++), M);
+      BodyFn->addFnAttr(Attribute::NoUnwind);
+      BodyFn->addParamAttr(3, Attribute::NoAlias);
+      BodyFn->addParamAttr(3, Attribute::NoCapture);
+
+      // The body has variables of its own.
+      DISubprogram *OuterSP = SP;
+      Value *OuterFrame = ChunkFrame;
+      StringMap<Value *> OuterNames = std::move(nameMap);
+      nameMap.clear();
+      ChunkFrame = nullptr;
+
+      if (DIB)
+      {
+        unsigned Line = SM->getLineAndColumn(Node.getLoc()).first;
+        DIType *Int64DITy = DIB->createBasicType("long", 64, dwarf::DW_ATE_signed);
+        DISubroutineType *BodyDITy = DIB->createSubroutineType(DIB->getOrCreateTypeArray(
+            {nullptr, DIB->createPointerType(nullptr, 64), Int64DITy, Int64DITy, DIB->createPointerType(DIIntTy, 64)}));
+        SP = DIB->createFunction(File, BodyFn->getName(), BodyFn->getName(), File, Line, BodyDITy, Line,
+                                 DINode::FlagPrototyped,
+                                 DISubprogram::SPFlagDefinition | DISubprogram::SPFlagLocalToUnit);
+        BodyFn->setSubprogram(SP);
+      }
+
+      BasicBlock *Entry = BasicBlock::Create(M->getContext(), "entry", BodyFn);
+      BasicBlock *BodyBB = BasicBlock::Create(M->getContext(), "parloopc.body", BodyFn);
+      BasicBlock *ExitBB = BasicBlock::Create(M->getContext(), "parloopc.exit", BodyFn);
+      BasicBlock *LastBB = BasicBlock::Create(M->getContext(), "parloopc.last", BodyFn);
+      BasicBlock *RetBB = BasicBlock::Create(M->getContext(), "parloopc.ret", BodyFn);
+      Builder.SetInsertPoint(Entry);
+      setDebugLoc(Node);
+
+      Value *Ctx = Builder.CreateBitCast(BodyFn->getArg(0), CtxTy->getPointerTo());
+      Value *Begin = BodyFn->getArg(1);
+      Value *End = BodyFn->getArg(2);
+      Value *Partial = BodyFn->getArg(3);
+      Value *Trips = Builder.CreateLoad(Int64Ty, Builder.CreateStructGEP(CtxTy, Ctx, 0));
+      Value *Start = Builder.CreateLoad(Int32Ty, Builder.CreateStructGEP(CtxTy, Ctx, 1));
+      auto sharedAt = [&](unsigned K) {
+        return Builder.CreateLoad(Int32PtrTy, Builder.CreateInBoundsGEP(CtxTy, Ctx, {Builder.getInt32(0),
+                                                                                       Builder.getInt32(2),
+                                                                                       Builder.getInt32(K)}));
+      };
+      auto local = [&](StringRef Name) {
+        AllocaInst *Alloca = Builder.CreateAlloca(Int32Ty);
+        nameMap[Name] = Alloca;
+        if (SP)
+          declareVariable(Alloca, Name);
+        return Alloca;
+      };
+
+      // Inputs are copied, so the optimizer sees that they do not change.
+      for (unsigned K = 0, E = Shared.size(); K != E; ++K)
+      {
+        AllocaInst *Alloca = local(Shared[K]);
+        if (K >= NumPrivates)
+          Builder.CreateStore(Builder.CreateLoad(Int32Ty, sharedAt(K)), Alloca);
+      }
+      Value *IndVar = local(Shape.IndVar);
+      for (unsigned R = 0, E = Reduced.size(); R != E; ++R)
+        Builder.CreateStore(Builder.CreateLoad(Int32Ty, Builder.CreateConstInBoundsGEP1_32(Int32Ty, Partial, R)),
+                            local(Reduced[R]));
+      Builder.CreateCondBr(Builder.CreateICmpSLT(Begin, End), BodyBB, ExitBB);
+
+      // Iteration K starts with the induction variable at Start + K * Step.
+      Builder.SetInsertPoint(BodyBB);
+      PHINode *K = Builder.CreatePHI(Int64Ty, 2);
+      K->addIncoming(Begin, Entry);
+      Value *Steps = Builder.CreateMul(Builder.CreateTrunc(K, Int32Ty), Builder.getInt32(Shape.Step));
+      Builder.CreateStore(Builder.CreateAdd(Start, Steps), IndVar);
+      InParallelBody = true;
+      Reductions.insert(Reduced.begin(), Reduced.end());
+      for (Assignment *Stmt : Node)
+        Stmt->accept(*this);
+      InParallelBody = false;
+      Reductions.clear();
+      setDebugLoc(Node);
+      Value *Next = Builder.CreateAdd(K, Builder.getInt64(1));
+      K->addIncoming(Next, Builder.GetInsertBlock());
+      BranchInst *Latch = Builder.CreateCondBr(Builder.CreateICmpSLT(Next, End), BodyBB, ExitBB);
+      if (MDNode *LoopID = createLoopID(Node.getHints()))
+        Latch->setMetadata(LLVMContext::MD_loop, LoopID);
+
+      // The range with the last iteration leaves the privates as the serial
+      // loop would.
+      Builder.SetInsertPoint(ExitBB);
+      for (unsigned R = 0, E = Reduced.size(); R != E; ++R)
+        Builder.CreateStore(Builder.CreateLoad(Int32Ty, nameMap[Reduced[R]]),
+                            Builder.CreateConstInBoundsGEP1_32(Int32Ty, Partial, R));
+      Builder.CreateCondBr(Builder.CreateICmpEQ(End, Trips), LastBB, RetBB);
+      Builder.SetInsertPoint(LastBB);
+      for (unsigned K = 0; K != NumPrivates; ++K)
+        Builder.CreateStore(Builder.CreateLoad(Int32Ty, nameMap[Shared[K]]), sharedAt(K));
+      Builder.CreateBr(RetBB);
+      Builder.SetInsertPoint(RetBB);
+      Builder.CreateRetVoid();
+
+      SP = OuterSP;
+      ChunkFrame = OuterFrame;
+      nameMap = std::move(OuterNames);
+      return BodyFn;
+    }
+
+    // Build the llvm.loop metadata node for the tuning annotations of a loop.
+    MDNode* createLoopID(const LoopHints &Hints)
+    {
+      if (Hints.empty())
+        return nullptr;
+
+      LLVMContext &Ctx = M->getContext();
+      llvm::SmallVector<Metadata *, 4> Args;
+      Args.push_back(nullptr); // reserved for the self reference
+
+      auto addHint = [&](StringRef Name, unsigned Count) {
+        Args.push_back(MDNode::get(Ctx, {MDString::get(Ctx, Name), ConstantAsMetadata::get(Builder.getInt32(Count))}));
+      };
+
+      if (Hints.Unroll == 1)
+        Args.push_back(MDNode::get(Ctx, MDString::get(Ctx, "llvm.loop.unroll.disable")));
+      else if (Hints.Unroll)
+        addHint("llvm.loop.unroll.count", Hints.Unroll);
+
+      if (Hints.VectorizeWidth)
+      {
+        Args.push_back(MDNode::get(Ctx, {MDString::get(Ctx, "llvm.loop.vectorize.enable"),
+                                         ConstantAsMetadata::get(Builder.getInt1(Hints.VectorizeWidth > 1))}));
+        addHint("llvm.loop.vectorize.width", Hints.VectorizeWidth);
+      }
+
+      if (Hints.Interleave)
+        addHint("llvm.loop.interleave.count", Hints.Interleave);
+
+      MDNode* LoopID = MDNode::getDistinct(Ctx, Args);
+      LoopID->replaceOperandWith(0, LoopID);
+      return LoopID;
+    }
+
     virtual void visit(IfStmt &Node) override{
       llvm::BasicBlock* IfCondBB = llvm::BasicBlock::Create(M->getContext(), "if.cond", Builder.GetInsertBlock()->getParent());
       llvm::BasicBlock* IfBodyBB = llvm::BasicBlock::Create(M->getContext(), "if.body", Builder.GetInsertBlock()->getParent());
       llvm::BasicBlock* AfterIfBB = llvm::BasicBlock::Create(M->getContext(), "after.if", Builder.GetInsertBlock()->getParent());
 
+      // Counter Base counts reaching the statement, Base + 1 + I entering arm I.
+      unsigned Base = Layout ? Layout->counterFor(&Node) : 0;
+      uint64_t Remaining = Profile ? profileCount(Base) : 0;
+
+      // Branch on the condition of arm Arm, taken into its body.
+      auto branchToArm = [&](Value *Cond, unsigned Arm, BasicBlock *Body, BasicBlock *Next) {
+        setDebugLoc(Arm == 0 ? static_cast<AST &>(Node) : *Node.beginElif()[Arm - 1]);
+        BranchInst *Br = Builder.CreateCondBr(Cond, Body, Next);
+        if (Profile)
+        {
+          uint64_t Taken = profileCount(Base + 1 + Arm);
+          Remaining -= std::min(Remaining, Taken);
+          setWeights(Br, Taken, Remaining);
+        }
+      };
+
+      setDebugLoc(Node);
+      countStmt(&Node);
       Builder.CreateBr(IfCondBB);
       Builder.SetInsertPoint(IfCondBB);
+      count(Base);
       Node.getCond()->accept(*this);
       Value* IfCondVal=V;
 
       Builder.SetInsertPoint(IfBodyBB);
+      count(Base + 1);
 
       for (llvm::SmallVector<Assignment* >::const_iterator I = Node.begin(), E = Node.end(); I != E; ++I)
         {
@@ -334,6 +1490,7 @@ ns{
       llvm::BasicBlock* PreviousCondBB = IfCondBB;
       llvm::BasicBlock* PreviousBodyBB = IfBodyBB;
       Value* PreviousCondVal = IfCondVal;
+      unsigned PreviousArm = 0;
 
       for (llvm::SmallVector<elifStmt *, 8>::const_iterator I = Node.beginElif(), E = Node.endElif(); I != E; ++I)
       {
@@ -341,23 +1498,26 @@ ns{
         llvm::BasicBlock* ElifBodyBB = llvm::BasicBlock::Create(M->getContext(), "elif.body", Builder.GetInsertBlock()->getParent());
 
         Builder.SetInsertPoint(PreviousCondBB);
-        Builder.CreateCondBr(PreviousCondVal, PreviousBodyBB, ElifCondBB);
+        branchToArm(PreviousCondVal, PreviousArm, PreviousBodyBB, ElifCondBB);
 
         Builder.SetInsertPoint(ElifCondBB);
         (*I)->getCond()->accept(*this);
         Value* ElifCondVal = V;
 
         Builder.SetInsertPoint(ElifBodyBB);
+        count(Base + 2 + PreviousArm);
         (*I)->accept(*this);
         Builder.CreateBr(AfterIfBB);
 
         PreviousCondBB = ElifCondBB;
         PreviousCondVal = ElifCondVal;
         PreviousBodyBB = ElifBodyBB;
+        ++PreviousArm;
       }
       if (Node.beginElse() != Node.endElse()) {
         llvm::BasicBlock* ElseBB = llvm::BasicBlock::Create(M->getContext(), "else.body", Builder.GetInsertBlock()->getParent());
         Builder.SetInsertPoint(ElseBB);
+        count(Base + 2 + PreviousArm);
         for (llvm::SmallVector<Assignment* >::const_iterator I = Node.beginElse(), E = Node.endElse(); I != E; ++I)
         {
             (*I)->accept(*this);
@@ -365,11 +1525,11 @@ ns{
         Builder.CreateBr(AfterIfBB);
 
         Builder.SetInsertPoint(PreviousCondBB);
-        Builder.CreateCondBr(PreviousCondVal, PreviousBodyBB, ElseBB);
+        branchToArm(PreviousCondVal, PreviousArm, PreviousBodyBB, ElseBB);
       }
       else {
         Builder.SetInsertPoint(PreviousCondBB);
-        Builder.CreateCondBr(IfCondVal, PreviousBodyBB, AfterIfBB);
+        branchToArm(PreviousCondVal, PreviousArm, PreviousBodyBB, AfterIfBB);
       }
 
       Builder.SetInsertPoint(AfterIfBB);
@@ -384,18 +1544,53 @@ ns{
   };
 }; // namespace
 
-void CodeGen::compile(Program *Tree)
+std::unique_ptr<Module> CodeGen::compile(Program *Tree, LLVMContext &Ctx)
 {
-  // Create an LLVM context and a module.
-  LLVMContext Ctx;
-  Module *M = new Module("simple-compiler", Ctx);
+  auto M = std::make_unique<Module>("simple-compiler", Ctx);
+  if (!generate(Tree, M.get()))
+    return nullptr;
+  return M;
+}
 
+bool CodeGen::generate(Program *Tree, Module *M)
+{
   // Create an instance of the ToIRVisitor and run it on the AST to generate LLVM IR.
-  ns::ToIRVisitor *ToIR = new ns::ToIRVisitor(M);
+  ns::ToIRVisitor ToIR(M, Diag, Results);
+  if (DebugSource)
+    ToIR.enableDebugInfo(*DebugSource);
+  ToIR.run(Tree, Profile, ChunkSize, GlobalsThreshold);
+  return !ToIR.hasError();
+}
+
+Function *CodeGen::compileLoop(IterStmt *Loop, ArrayRef<StringRef> Vars, ArrayRef<unsigned> Sizes, Module *M,
+                               StringRef Name)
+{
+  ns::ToIRVisitor ToIR(M, Diag, Results);
+  if (DebugSource)
+    ToIR.enableDebugInfo(*DebugSource);
+  return ToIR.runLoop(Loop, Vars, Sizes, Name);
+}
+
+void CodeGen::optimize(Module &M, unsigned OptLevel, TargetMachine *TM)
+{
+  if (OptLevel == 0)
+    return;
 
+  LoopAnalysisManager LAM;
+  FunctionAnalysisManager FAM;
+  CGSCCAnalysisManager CGAM;
+  ModuleAnalysisManager MAM;
 
-  ToIR->run(Tree);
+  PassBuilder PB(TM);
+  PB.registerModuleAnalyses(MAM);
+  PB.registerCGSCCAnalyses(CGAM);
+  PB.registerFunctionAnalyses(FAM);
+  PB.registerLoopAnalyses(LAM);
+  PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
 
-  // Print the generated module to the standard output.
-  M->print(outs(), nullptr);
+  OptimizationLevel Level = OptLevel == 1   ? OptimizationLevel::O1
+                            : OptLevel == 2 ? OptimizationLevel::O2
+                                            : OptimizationLevel::O3;
+  ModulePassManager MPM = PB.buildPerModuleDefaultPipeline(Level);
+  MPM.run(M, MAM);
 }
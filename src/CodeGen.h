@@ -2,11 +2,75 @@
 #define CODEGEN_H
 
 #include "AST.h"
+#include "Profile.h"
+#include "Results.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Target/TargetMachine.h"
+#include <memory>
+#include "llvm/Support/raw_ostream.h"
+#include <string>
+
+// Profile-guided optimization settings of a compilation.
+struct ProfileOptions
+{
+ std::string GeneratePath;         // non-empty: count executions and write them here at exit
+ const ProfileData *Use = nullptr; // counts to turn into branch weights
+ bool ExecProfile = false;         // count every statement and report at exit
+ bool ExecCycles = false;          // with ExecProfile, also time every loop
+};
 
 class CodeGen
 {
+ llvm::raw_ostream &Diag;
+ ProfileOptions Profile;
+ const SourceManager *DebugSource = nullptr; // set: emit debug info for this source
+ unsigned ChunkSize;
+ unsigned GlobalsThreshold;
+ ResultFormat Results = ResultFormat::Text;
+
 public:
- void compile(Program *Tree);
+ // Programs larger than this many AST nodes are split into chunks of at
+ // most this size, each in a function of its own, so that main stays small
+ // enough for the optimizer. Its passes take more than linear time in the
+ // size of a function.
+ static constexpr unsigned DefaultChunkSize = 1000;
+
+ // Programs that declare more variables than this keep them in zeroed
+ // globals rather than on the stack.
+ static constexpr unsigned DefaultGlobalsThreshold = 1000;
+
+ CodeGen(llvm::raw_ostream &Diag = llvm::errs(), const ProfileOptions &Profile = ProfileOptions())
+     : Diag(Diag), Profile(Profile), ChunkSize(DefaultChunkSize), GlobalsThreshold(DefaultGlobalsThreshold) {}
+
+ // Generate the program as a new module in Ctx, for embedders that want
+ // the module without serializing it. Returns nullptr on error.
+ std::unique_ptr<llvm::Module> compile(Program *Tree, llvm::LLVMContext &Ctx);
+
+ // Emit DWARF debug info for programs parsed from the buffer of SM.
+ void setDebugInfo(const SourceManager &SM) { DebugSource = &SM; }
+
+ // Split main into chunks of at most Nodes AST nodes, or never if 0.
+ void setChunkSize(unsigned Nodes) { ChunkSize = Nodes; }
+
+ // Make the variables globals if there are more than Vars, or never if 0.
+ void setGlobalsThreshold(unsigned Vars) { GlobalsThreshold = Vars; }
+
+ // Write results in format F; see ResultFormat.
+ void setResultFormat(ResultFormat F) { Results = F; }
+
+ // Generate the program as the main function of M. Returns false on error.
+ bool generate(Program *Tree, llvm::Module *M);
+
+ // Emit `void Name(i32 *Frame)` into M, running Loop with the variables Vars
+ // stored one after the other in Frame, where Vars[i] takes Sizes[i] slots if
+ // it is an array and one if Sizes[i] is 0. Used to compile hot loops of the
+ // interpreter.
+ llvm::Function *compileLoop(IterStmt *Loop, llvm::ArrayRef<llvm::StringRef> Vars, llvm::ArrayRef<unsigned> Sizes,
+                             llvm::Module *M, llvm::StringRef Name);
 
+ // Run the default LLVM pipeline for the given -O level over M, tuned for TM
+ // if it is given.
+ void optimize(llvm::Module &M, unsigned OptLevel, llvm::TargetMachine *TM = nullptr);
 };
 #endif
\ No newline at end of file
@@ -1,9 +1,21 @@
+#include "Batch.h"
+#include "ByteCode.h"
 #include "CodeGen.h"
-#include "Parser.h"
-#include "Sema.h"
+#include "Driver.h"
+#include "Server.h"
+#include "Tiered.h"
+#include "VM.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/LLVMContext.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
 #include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/SystemUtils.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/ToolOutputFile.h"
 #include "llvm/Support/raw_ostream.h"
+#include <cstdlib>
+#include <memory>
 
 // Define a command-line option for specifying the input expression.
 static llvm::cl::opt<std::string>
@@ -11,43 +23,439 @@ static llvm::cl::opt<std::string>
           llvm::cl::desc("<input expression>"),
           llvm::cl::init(""));
 
-// The main function of the program.
-int main(int argc, const char **argv)
+// Run the program with the bytecode interpreter instead of emitting LLVM IR.
+static llvm::cl::opt<bool>
+    Interp("interp",
+           llvm::cl::desc("Execute the program in the bytecode VM"),
+           llvm::cl::init(false));
+
+// Interpret the program, but compile hot loops with the JIT in the background.
+static llvm::cl::opt<bool>
+    Tiered("tiered",
+           llvm::cl::desc("Execute in the bytecode VM and JIT-compile hot loops"),
+           llvm::cl::init(false));
+
+static llvm::cl::opt<unsigned>
+    TierThreshold("tier-threshold",
+                  llvm::cl::desc("Loop iterations before a loop is JIT-compiled"),
+                  llvm::cl::init(1000));
+
+static llvm::cl::opt<unsigned>
+    TierJobs("tier-jobs",
+             llvm::cl::desc("Number of threads compiling hot loops (default: one per hardware thread)"),
+             llvm::cl::init(0));
+
+// Make loops compiled by --tiered visible to perf and gdb.
+static llvm::cl::opt<bool>
+    JITPerf("jit-perf",
+            llvm::cl::desc("Write perf jitdump files for JIT-compiled loops"),
+            llvm::cl::init(false));
+
+static llvm::cl::opt<bool>
+    JITGDB("jit-gdb",
+           llvm::cl::desc("Register JIT-compiled loops with gdb"),
+           llvm::cl::init(false));
+
+// Compile many source files to object files in one process.
+static llvm::cl::list<std::string>
+    Batch("batch",
+          llvm::cl::desc("Compile the given source files or directories to object files"),
+          llvm::cl::value_desc("path"),
+          llvm::cl::CommaSeparated);
+
+static llvm::cl::opt<std::string>
+    BatchOutDir("batch-out-dir",
+                llvm::cl::desc("Directory for the object files of --batch (default: next to each source)"),
+                llvm::cl::value_desc("dir"));
+
+static llvm::cl::opt<std::string>
+    BatchExt("batch-ext",
+             llvm::cl::desc("Extension of the sources searched for in --batch directories"),
+             llvm::cl::init(".txt"));
+
+// Output format of a compilation. Textual IR has to be asked for explicitly.
+enum EmitKind
 {
-    // Initialize the LLVM framework.
-    llvm::InitLLVM X(argc, argv);
+    EmitBitcode,
+    EmitIR,
+    EmitObject
+};
 
-    // Parse command-line options.
-    llvm::cl::ParseCommandLineOptions(argc, argv, "Simple Compiler\n");
+static llvm::cl::opt<EmitKind>
+    Emit(llvm::cl::desc("Output format:"),
+         llvm::cl::values(clEnumValN(EmitBitcode, "emit-llvm-bc", "LLVM bitcode (default)"),
+                          clEnumValN(EmitIR, "emit-llvm", "Textual LLVM IR"),
+                          clEnumValN(EmitObject, "emit-obj", "Object file for the host")),
+         llvm::cl::init(EmitBitcode));
+
+static llvm::cl::opt<std::string>
+    OutputFilename("o",
+                   llvm::cl::desc("Output file (default: standard output)"),
+                   llvm::cl::value_desc("filename"),
+                   llvm::cl::init("-"));
+
+// How programs write their results. Binary results go to the file named by
+// COMPILER_RESULTS, or else to the descriptor COMPILER_RESULTS_FD, or else to
+// standard output; the text lines always go to standard output.
+static llvm::cl::opt<ResultFormat>
+    Results("result-format",
+            llvm::cl::desc("Format of the results the program writes:"),
+            llvm::cl::values(clEnumValN(ResultFormat::Text, "text", "\"The result is: V\" lines (default)"),
+                             clEnumValN(ResultFormat::Raw, "raw", "Little-endian int32 values"),
+                             clEnumValN(ResultFormat::Records, "records",
+                                        "A header naming the variables, then a record per value tagged with the "
+                                        "variable")),
+            llvm::cl::init(ResultFormat::Text));
+
+// Optimization of the generated module before it is written out.
+static llvm::cl::opt<unsigned>
+    OptLevel("O",
+             llvm::cl::desc("Optimization level (default: 2)"),
+             llvm::cl::value_desc("level"),
+             llvm::cl::Prefix,
+             llvm::cl::init(2));
+
+static llvm::cl::opt<bool>
+    LinkRuntime("link-runtime",
+                llvm::cl::desc("Link the runtime into the module so it can be inlined"),
+                llvm::cl::init(true));
 
-    // Create a lexer object and initialize it with the input expression.
-    Lexer Lex(Input);
+// Profile-guided optimization: instrument a build, then feed its counts back.
+static llvm::cl::opt<std::string>
+    ProfileGenerate("fprofile-generate",
+                    llvm::cl::desc("Instrument the program to write execution counts to <file> (default: compiler.profile)"),
+                    llvm::cl::value_desc("file"),
+                    llvm::cl::ValueOptional);
+
+static llvm::cl::opt<std::string>
+    ProfileUse("fprofile-use",
+               llvm::cl::desc("Optimize with the execution counts in <file>"),
+               llvm::cl::value_desc("file"));
+
+// Report how often each statement ran, and optionally where the cycles went.
+static llvm::cl::opt<bool>
+    ExecProfile("fexec-profile",
+                llvm::cl::desc("Print per-statement execution counts when the program exits"),
+                llvm::cl::init(false));
+
+static llvm::cl::opt<bool>
+    ExecProfileCycles("fexec-profile-cycles",
+                      llvm::cl::desc("With -fexec-profile, also measure the cycles spent in each loop"),
+                      llvm::cl::init(false));
+
+// Debug info for perf and gdb. The source is passed as text, so its file
+// name has to be given separately.
+static llvm::cl::opt<bool>
+    DebugInfo("g",
+              llvm::cl::desc("Emit debug info"),
+              llvm::cl::init(false));
+
+static llvm::cl::opt<std::string>
+    InputName("input-name",
+              llvm::cl::desc("File name of the input in debug info (default: input.txt)"),
+              llvm::cl::value_desc("file"),
+              llvm::cl::init("input.txt"));
+
+// Keep main small enough for the optimizer by moving statements out of it.
+static llvm::cl::opt<unsigned>
+    ChunkSize("chunk-size",
+              llvm::cl::desc("Split programs into functions of at most this many AST nodes (0: never, default: 1000)"),
+              llvm::cl::init(CodeGen::DefaultChunkSize));
+
+// Keep large sets of variables out of the stack frame.
+static llvm::cl::opt<unsigned>
+    GlobalsThreshold("globals-threshold",
+                     llvm::cl::desc("Make variables zero-initialized globals if a program declares more than this "
+                                    "many (0: never, default: 1000)"),
+                     llvm::cl::init(CodeGen::DefaultGlobalsThreshold));
+
+// Lex the whole input before parsing instead of one token at a time.
+static llvm::cl::opt<bool>
+    PreLex("pre-lex",
+           llvm::cl::desc("Lex the input into a token buffer before parsing (default: true)"),
+           llvm::cl::init(true));
 
-    // Create a parser object and initialize it with the lexer.
-    Parser Parser(Lex);
+// Split large inputs at statement boundaries and parse the pieces in parallel.
+static llvm::cl::opt<unsigned>
+    ParseJobs("parse-jobs",
+              llvm::cl::desc("Number of threads for lexing and parsing large inputs (0: one per hardware thread, default: 1)"),
+              llvm::cl::init(1));
 
-    // Parse the input expression and generate an abstract syntax tree (AST).
-    Program *Tree = Parser.parse();
+// Skip lexing and parsing for sources whose AST was cached before.
+static llvm::cl::opt<std::string>
+    ASTCache("ast-cache",
+             llvm::cl::desc("Cache parsed ASTs in <dir> and reuse them for unchanged sources"),
+             llvm::cl::value_desc("dir"),
+             llvm::cl::init(""));
+
+// Recompile only what changed since the last compile of the same file.
+static llvm::cl::opt<bool>
+    Incremental("incremental",
+                llvm::cl::desc("With -ast-cache, reparse only the top-level statements that changed since the "
+                               "last compile of the same -input-name"),
+                llvm::cl::init(false));
+
+// Keep the compiler warm in a daemon, and talk to it from thin clients.
+static llvm::cl::opt<std::string>
+    Serve("serve",
+          llvm::cl::desc("Serve compile requests on a Unix domain socket"),
+          llvm::cl::value_desc("socket"));
+
+static llvm::cl::opt<unsigned>
+    ServeJobs("serve-jobs",
+              llvm::cl::desc("Number of --serve threads (default: one per hardware thread)"),
+              llvm::cl::init(0));
 
-    // Check if parsing was successful or if there were any syntax errors.
-    if (!Tree || Parser.hasError())
+static llvm::cl::opt<std::string>
+    Connect("connect",
+            llvm::cl::desc("Send the input to the compile server on this socket"),
+            llvm::cl::value_desc("socket"));
+
+static llvm::cl::opt<unsigned>
+    BatchJobs("batch-jobs",
+              llvm::cl::desc("Number of --batch worker threads (default: one per hardware thread)"),
+              llvm::cl::init(0));
+
+// The stream --interp and --tiered write results to, where the runtime of a
+// compiled program would: binary results may go to a file or a descriptor
+// other than standard output, which is then opened into File. Returns
+// nullptr if the file cannot be opened.
+static llvm::raw_ostream *openResults(std::unique_ptr<llvm::raw_fd_ostream> &File)
+{
+    if (Results == ResultFormat::Text)
+        return &llvm::outs();
+    if (const char *Path = std::getenv("COMPILER_RESULTS"); Path && *Path)
     {
-        llvm::errs() << "Syntax errors occurred\n";
-        return 1;
+        std::error_code EC;
+        File = std::make_unique<llvm::raw_fd_ostream>(Path, EC, llvm::sys::fs::OF_None);
+        if (EC)
+        {
+            llvm::errs() << "Error: cannot open " << Path << ": " << EC.message() << "\n";
+            return nullptr;
+        }
+        return File.get();
     }
+    const char *FD = std::getenv("COMPILER_RESULTS_FD");
+    if (!FD || std::atoi(FD) == 1)
+        return &llvm::outs();
+    File = std::make_unique<llvm::raw_fd_ostream>(std::atoi(FD), /*shouldClose=*/false);
+    return File.get();
+}
 
-    // Perform semantic analysis on the AST.
-    Sema Semantic;
-    if (Semantic.semantic(Tree))
+// The main function of the program.
+static int compile()
+{
+    FrontendOptions FrontendOpts;
+    FrontendOpts.PreLex = PreLex;
+    FrontendOpts.ParseJobs = ParseJobs;
+    FrontendOpts.ASTCacheDir = ASTCache;
+    FrontendOpts.Incremental = Incremental;
+
+    CompileOptions CompileOpts;
+    CompileOpts.OptLevel = OptLevel;
+    CompileOpts.LinkRuntime = LinkRuntime;
+    CompileOpts.DebugInfo = DebugInfo;
+    CompileOpts.ChunkSize = ChunkSize;
+    CompileOpts.GlobalsThreshold = GlobalsThreshold;
+    CompileOpts.Results = Results;
+
+    if (!Serve.empty())
+        return runServer(Serve, ServeJobs);
+
+    if (!Connect.empty())
     {
-        llvm::errs() << "Semantic errors occurred\n";
+        // These flags act on the client's side of a compile, which the
+        // server cannot see. (The & of a cl::list is its vector of values.)
+        llvm::cl::Option *LocalOnly[] = {&Tiered,      &TierThreshold,         &TierJobs,   &JITPerf,
+                                         &JITGDB,      std::addressof(Batch),  &ProfileGenerate,
+                                         &ProfileUse,  &ASTCache,              &Incremental};
+        for (llvm::cl::Option *O : LocalOnly)
+            if (O->getNumOccurrences())
+            {
+                llvm::errs() << "Error: --connect cannot forward -" << O->ArgStr << " to the server.\n";
+                return 1;
+            }
+        RequestOptions RequestOpts;
+        RequestOpts.Compile = CompileOpts;
+        RequestOpts.Frontend.PreLex = PreLex;
+        RequestOpts.Frontend.ParseJobs = ParseJobs;
+        RequestOpts.ExecProfile = ExecProfile || ExecProfileCycles;
+        RequestOpts.ExecCycles = ExecProfileCycles;
+        RequestOpts.InputName = InputName;
+        RequestKind Kind = Interp                 ? RequestKind::Run
+                           : Emit == EmitIR       ? RequestKind::IR
+                           : Emit == EmitObject   ? RequestKind::Object
+                                                  : RequestKind::Bitcode;
+        std::error_code EC;
+        llvm::ToolOutputFile Out(OutputFilename, EC, llvm::sys::fs::OF_None);
+        if (EC)
+        {
+            llvm::errs() << "Error: cannot open " << OutputFilename << ": " << EC.message() << "\n";
+            return 1;
+        }
+        int Status = runClient(Connect, Kind, RequestOpts, Input, Out.os());
+        Out.keep();
+        return Status;
+    }
+
+    // Compile a whole set of files instead of the input expression.
+    if (!Batch.empty())
+    {
+        llvm::InitializeNativeTarget();
+        llvm::InitializeNativeTargetAsmPrinter();
+        BatchOptions Opts;
+        Opts.OutDir = BatchOutDir;
+        Opts.SourceExt = BatchExt;
+        Opts.Jobs = BatchJobs;
+        Opts.Compile.OptLevel = OptLevel;
+        Opts.Compile.LinkRuntime = LinkRuntime;
+        Opts.Compile.DebugInfo = DebugInfo;
+        Opts.Compile.ChunkSize = ChunkSize;
+        Opts.Compile.GlobalsThreshold = GlobalsThreshold;
+        Opts.Compile.Results = Results;
+        Opts.Frontend = FrontendOpts;
+        if (ProfileGenerate.getNumOccurrences() || !ProfileUse.empty())
+        {
+            llvm::errs() << "Error: --batch cannot take -fprofile-generate or -fprofile-use, "
+                            "since a profile file belongs to a single program.\n";
+            return 1;
+        }
+        Opts.Profile.ExecProfile = ExecProfile || ExecProfileCycles;
+        Opts.Profile.ExecCycles = ExecProfileCycles;
+        return runBatch(Batch, Opts);
+    }
+
+    // Parse the input expression and check its semantics.
+    ASTContext Ctx;
+    SourceManager SM(Input, InputName);
+    Program *Tree = parseAndCheck(SM, Ctx, llvm::errs(), FrontendOpts);
+    if (!Tree)
         return 1;
+
+    // Execute the program directly, without building an LLVM module.
+    std::unique_ptr<llvm::raw_fd_ostream> ResultsFile;
+    if (Interp && !Tiered)
+    {
+        ByteCode BC;
+        if (!ByteCodeGen().compile(Tree, BC))
+            return 3;
+        llvm::raw_ostream *OS = openResults(ResultsFile);
+        if (!OS)
+            return 1;
+        VM Interpreter;
+        Interpreter.setResultFormat(Results);
+        return Interpreter.run(BC, *OS);
+    }
+
+    // Interpret first and move hot loops to native code.
+    if (Tiered)
+    {
+        ByteCode BC;
+        if (!ByteCodeGen().compile(Tree, BC, /*CountLoops=*/true))
+            return 3;
+
+        llvm::InitializeNativeTarget();
+        llvm::InitializeNativeTargetAsmPrinter();
+        TierOptions TierOpts;
+        TierOpts.Sources = &SM;
+        TierOpts.PerfEvents = JITPerf;
+        TierOpts.GDBEvents = JITGDB;
+        TierOpts.Results = Results;
+        TierOpts.Jobs = TierJobs;
+        llvm::raw_ostream *OS = openResults(ResultsFile);
+        if (!OS)
+            return 1;
+        auto JIT = TieredJIT::create(BC, *OS, TierOpts);
+        VM Interpreter(JIT ? JIT->get() : nullptr, TierThreshold);
+        if (!JIT)
+            llvm::errs() << "Error: " << llvm::toString(JIT.takeError()) << "\n";
+        Interpreter.setResultFormat(Results);
+        return Interpreter.run(BC, *OS);
     }
 
+    ProfileOptions Profile;
+    ProfileData Counts;
+    if (ProfileGenerate.getNumOccurrences())
+        Profile.GeneratePath = ProfileGenerate.empty() ? std::string("compiler.profile") : ProfileGenerate.getValue();
+    if (!ProfileUse.empty())
+    {
+        if (!readProfile(ProfileUse, Counts, llvm::errs()))
+            return 1;
+        Profile.Use = &Counts;
+    }
+    Profile.ExecProfile = ExecProfile || ExecProfileCycles;
+    Profile.ExecCycles = ExecProfileCycles;
+
     // Generate code for the AST using a code generator.
-    CodeGen CodeGenerator;
-    CodeGenerator.compile(Tree);
+    llvm::LLVMContext LLVMCtx;
+    CodeGen Gen(llvm::errs(), Profile);
+    if (DebugInfo)
+        Gen.setDebugInfo(SM);
+    Gen.setChunkSize(ChunkSize);
+    Gen.setGlobalsThreshold(GlobalsThreshold);
+    Gen.setResultFormat(Results);
+    std::unique_ptr<llvm::Module> M = Gen.compile(Tree, LLVMCtx);
+    if (!M)
+        return 3;
+
+    // Optimize for the host; only object files cannot do without its target.
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+    std::unique_ptr<llvm::TargetMachine> TM =
+        createHostTargetMachine(Emit == EmitObject ? llvm::errs() : llvm::nulls());
+    if (!TM && Emit == EmitObject)
+        return 1;
+    if (!finishModule(*M, TM.get(), CompileOpts, llvm::errs()))
+        return 1;
+
+    // Write the module through a buffered file stream.
+    std::error_code EC;
+    llvm::ToolOutputFile Out(OutputFilename, EC, Emit == EmitIR ? llvm::sys::fs::OF_Text : llvm::sys::fs::OF_None);
+    if (EC)
+    {
+        llvm::errs() << "Error: cannot open " << OutputFilename << ": " << EC.message() << "\n";
+        return 1;
+    }
+
+    if (Emit == EmitIR)
+    {
+        M->print(Out.os(), nullptr);
+    }
+    else if (Emit == EmitBitcode)
+    {
+        if (OutputFilename == "-" && llvm::CheckBitcodeOutputToConsole(Out.os()))
+            return 1;
+        llvm::WriteBitcodeToFile(*M, Out.os());
+    }
+    else
+    {
+        // Object writers may need to seek, which a pipe cannot do.
+        std::unique_ptr<llvm::buffer_ostream> BOS;
+        llvm::raw_pwrite_stream *OS = &Out.os();
+        if (!Out.os().supportsSeeking())
+        {
+            BOS = std::make_unique<llvm::buffer_ostream>(Out.os());
+            OS = BOS.get();
+        }
+        if (!emitObjectFile(*M, *TM, *OS))
+        {
+            llvm::errs() << "Error: the target cannot emit object files\n";
+            return 1;
+        }
+    }
+    Out.keep();
 
     // The program executed successfully.
     return 0;
 }
+
+int main(int argc, const char **argv)
+{
+    // Initialize the LLVM framework.
+    llvm::InitLLVM X(argc, argv);
+
+    // Parse command-line options.
+    llvm::cl::ParseCommandLineOptions(argc, argv, "Simple Compiler\n");
+
+    return compile();
+}
@@ -0,0 +1,100 @@
+#include "Driver.h"
+#include "CodeGen.h"
+#include "ASTCache.h"
+#include "Incremental.h"
+#include "ParallelParse.h"
+#include "Runtime.h"
+#include "Sema.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/Support/Host.h"
+
+using namespace llvm;
+
+Program *parseAndCheck(const SourceManager &SM, ASTContext &Ctx, raw_ostream &Diag, const FrontendOptions &Opts)
+{
+  bool SyntaxErrors = false;
+  Program *Tree = nullptr;
+  std::unique_ptr<IncrementalIndex> Index;
+  if (!Opts.ASTCacheDir.empty() && Opts.Incremental)
+  {
+    Index = std::make_unique<IncrementalIndex>(Opts.ASTCacheDir, SM);
+    Tree = Index->parse(Ctx, Opts.PreLex);
+  }
+  else if (!Opts.ASTCacheDir.empty())
+    Tree = loadCachedAST(Opts.ASTCacheDir, SM.getBuffer(), Ctx);
+  if (!Tree)
+  {
+    if (Opts.ParseJobs == 1)
+      Tree = parseRange(SM, 0, SM.getBuffer().size(), Ctx, Diag, Opts.PreLex, SyntaxErrors);
+    else
+      Tree = parseInParallel(SM, Ctx, Diag, Opts.ParseJobs, Opts.PreLex, SyntaxErrors);
+    // Only trees without syntax errors are cached; Sema runs on every load.
+    if (!SyntaxErrors && !Opts.ASTCacheDir.empty() && !Index)
+      storeCachedAST(Opts.ASTCacheDir, SM.getBuffer(), Tree);
+  }
+
+  // Perform semantic analysis on the AST. The parser drops the statements it
+  // could not parse, so this also runs after syntax errors and reports the
+  // semantic errors in the rest of the program. The value ranges are not
+  // checked then: a declaration that lost its initializer looks zero.
+  Sema Semantic;
+  bool SemaErrors = Semantic.semantic(Tree, Diag, &SM, Index ? Index->checked(Tree) : None, !SyntaxErrors);
+  if (Index && !SyntaxErrors)
+    Index->store(Tree, !SemaErrors);
+
+  if (SyntaxErrors)
+  {
+    Diag << "Syntax errors occurred\n";
+    return nullptr;
+  }
+  if (SemaErrors)
+  {
+    Diag << "Semantic errors occurred\n";
+    return nullptr;
+  }
+  return Tree;
+}
+
+std::unique_ptr<TargetMachine> createHostTargetMachine(raw_ostream &Diag)
+{
+  std::string Triple = sys::getDefaultTargetTriple();
+  std::string Error;
+  const Target *T = TargetRegistry::lookupTarget(Triple, Error);
+  if (!T)
+  {
+    Diag << "Error: " << Error << "\n";
+    return nullptr;
+  }
+  // Position independent, since the runtime is linked as a PIE by default.
+  return std::unique_ptr<TargetMachine>(T->createTargetMachine(
+      Triple, sys::getHostCPUName(), "", TargetOptions(), Reloc::PIC_));
+}
+
+bool finishModule(Module &M, TargetMachine *TM, const CompileOptions &Opts, raw_ostream &Diag)
+{
+  if (TM)
+  {
+    M.setTargetTriple(TM->getTargetTriple().str());
+    M.setDataLayout(TM->createDataLayout());
+  }
+  if (Opts.LinkRuntime && !linkRuntime(M))
+  {
+    Diag << "Error: cannot link the runtime\n";
+    return false;
+  }
+  CodeGen(Diag).optimize(M, Opts.OptLevel, TM);
+  return true;
+}
+
+bool emitObjectFile(Module &M, TargetMachine &TM, raw_pwrite_stream &OS)
+{
+  M.setTargetTriple(TM.getTargetTriple().str());
+  M.setDataLayout(TM.createDataLayout());
+
+  legacy::PassManager PM;
+  if (TM.addPassesToEmitFile(PM, OS, nullptr, CGFT_ObjectFile))
+    return false;
+  PM.run(M);
+  return true;
+}
@@ -0,0 +1,50 @@
+#ifndef DRIVER_H
+#define DRIVER_H
+
+#include "AST.h"
+#include "CodeGen.h"
+#include "SourceManager.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+#include <memory>
+#include <string>
+
+// How the front end reads the source.
+struct FrontendOptions
+{
+  bool PreLex = true;     // lex into a TokenBuffer before parsing
+  unsigned ParseJobs = 1; // threads for lexing and parsing, 0: one per hardware thread
+  std::string ASTCacheDir; // reuse ASTs of sources parsed before, if not empty
+  bool Incremental = false; // with ASTCacheDir, only parse the statements changed since the last compile
+};
+
+// Run the front end (lexer, parser and semantic analysis) over the buffer of
+// SM, which must be null terminated. The AST is allocated in Ctx. Errors are
+// reported to Diag, and nullptr is returned if there were any.
+Program *parseAndCheck(const SourceManager &SM, ASTContext &Ctx, llvm::raw_ostream &Diag,
+                       const FrontendOptions &Opts = FrontendOptions());
+
+// Create a target machine for the host. The native target has to be
+// initialized. Returns nullptr and reports to Diag on failure.
+std::unique_ptr<llvm::TargetMachine> createHostTargetMachine(llvm::raw_ostream &Diag);
+
+// How a generated module is finished before it is written out.
+struct CompileOptions
+{
+  unsigned OptLevel = 2;  // -O level of the LLVM pipeline
+  bool LinkRuntime = true; // link the IR runtime so it can be inlined
+  bool DebugInfo = false;  // emit debug info for the source file
+  unsigned ChunkSize = CodeGen::DefaultChunkSize; // AST nodes per function main is split into, 0: never split
+  unsigned GlobalsThreshold = CodeGen::DefaultGlobalsThreshold; // variables above which they are globals, 0: never
+  ResultFormat Results = ResultFormat::Text; // how the program writes its results
+};
+
+// Target M at TM (if any), link the runtime into it and optimize it as Opts
+// asks. Returns false and reports to Diag on failure.
+bool finishModule(llvm::Module &M, llvm::TargetMachine *TM, const CompileOptions &Opts, llvm::raw_ostream &Diag);
+
+// Emit M as an object file for TM. Returns false on failure.
+bool emitObjectFile(llvm::Module &M, llvm::TargetMachine &TM, llvm::raw_pwrite_stream &OS);
+
+#endif
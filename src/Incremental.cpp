@@ -0,0 +1,239 @@
+#include "Incremental.h"
+#include "ASTCache.h"
+#include "ParallelParse.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/EndianStream.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/FileUtilities.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/xxhash.h"
+
+using namespace llvm;
+
+namespace
+{
+  const uint32_t Magic = 0x434e4953; // "SINC"
+  const uint32_t Version = 3;
+  const unsigned HeaderWords = 4;
+  const unsigned EntryHeaderWords = 4;
+
+  bool isLetter(char C) { return (C >= 'a' && C <= 'z') || (C >= 'A' && C <= 'Z'); }
+  bool isWhitespace(char C) { return C == ' ' || C == '\t' || C == '\f' || C == '\v' || C == '\r' || C == '\n'; }
+}
+
+// Blocks only hold assignments and never nest, so words and semicolons are
+// enough: a ';' outside a block ends a statement, and so does an 'end' that
+// is not followed by elif or else. int, if, loopc, parloopc and read always
+// start one, even if the statement before is missing its end.
+void splitStatements(StringRef Buffer, std::vector<StringRef> &Stmts)
+{
+  const size_t Size = Buffer.size();
+  const size_t None = StringRef::npos;
+  size_t Start = None;
+  bool InBlock = false;
+
+  auto wordAt = [&](size_t At) {
+    size_t WordEnd = At;
+    while (WordEnd < Size && isLetter(Buffer[WordEnd]))
+      ++WordEnd;
+    return Buffer.slice(At, WordEnd);
+  };
+  auto finish = [&](size_t End) {
+    if (Start != None && Start < End)
+      Stmts.push_back(Buffer.slice(Start, End));
+    Start = None;
+  };
+
+  size_t Pos = 0;
+  while (Pos < Size)
+  {
+    char C = Buffer[Pos];
+    if (isWhitespace(C))
+    {
+      ++Pos;
+      continue;
+    }
+    if (!isLetter(C))
+    {
+      if (Start == None)
+        Start = Pos;
+      ++Pos;
+      if (C == ';' && !InBlock)
+        finish(Pos);
+      continue;
+    }
+
+    StringRef Word = wordAt(Pos);
+    if (Word == "int" || Word == "if" || Word == "loopc" || Word == "parloopc" || Word == "read")
+    {
+      finish(Pos);
+      InBlock = false;
+    }
+    if (Start == None)
+      Start = Pos;
+    Pos += Word.size();
+
+    if (Word == "begin")
+      InBlock = true;
+    else if (Word == "end")
+    {
+      InBlock = false;
+      size_t Next = Pos;
+      while (Next < Size && isWhitespace(Buffer[Next]))
+        ++Next;
+      StringRef NextWord = wordAt(Next);
+      if (NextWord != "elif" && NextWord != "else")
+        finish(Pos);
+    }
+  }
+  finish(Size);
+}
+
+IncrementalIndex::IncrementalIndex(StringRef Dir, const SourceManager &SM) : SM(SM)
+{
+  SmallString<128> IndexPath(Dir);
+  sys::path::append(IndexPath, utohexstr(xxHash64(SM.getName())) + ".inc");
+  Path = std::string(IndexPath.str());
+
+  splitStatements(SM.getBuffer(), Texts);
+  for (StringRef Text : Texts)
+    Hashes.push_back(xxHash64(Text));
+  Reused.resize(Texts.size());
+  load();
+}
+
+void IncrementalIndex::load()
+{
+  auto Buffer = MemoryBuffer::getFile(Path, /*IsText=*/false, /*RequiresNullTerminator=*/false);
+  if (!Buffer)
+    return;
+  Old = std::move(*Buffer);
+  StringRef Data = Old->getBuffer();
+  uint64_t NumWords = Data.size() / 4;
+  auto Word = [&Data](uint64_t I) { return support::endian::read32le(Data.data() + 4 * I); };
+  if (Data.size() % 4 || NumWords < HeaderWords || Word(0) != Magic || Word(1) != Version)
+    return;
+
+  uint64_t NumStmts = Word(3);
+  uint64_t Pos = HeaderWords;
+  for (uint64_t I = 0; I < NumStmts; ++I)
+  {
+    if (Pos + EntryHeaderWords > NumWords || Pos + EntryHeaderWords + Word(Pos + 3) > NumWords)
+    {
+      OldStmts.clear();
+      return;
+    }
+    uint64_t Hash = Word(Pos) | uint64_t(Word(Pos + 1)) << 32;
+    Entry E = {Word(Pos + 2), Data.substr(4 * (Pos + EntryHeaderWords), 4 * Word(Pos + 3))};
+    // The two largest keys are reserved by DenseMap; such a statement is
+    // just parsed again.
+    if (Hash < DenseMapInfo<uint64_t>::getTombstoneKey())
+      OldStmts.try_emplace(Hash, E);
+    Pos += EntryHeaderWords + Word(Pos + 3);
+  }
+  OldChecked = Word(2) != 0;
+}
+
+Program *IncrementalIndex::parse(ASTContext &Ctx, bool PreLex)
+{
+  StringRef Buffer = SM.getBuffer();
+  size_t N = Texts.size();
+  Scopes.assign(N, CheckedStmt());
+  Checked.assign(N, nullptr);
+
+  // Decode the statements whose text is in the index.
+  std::vector<AST *> Found(N);
+  for (size_t I = 0; I < N; ++I)
+  {
+    auto It = OldStmts.find(Hashes[I]);
+    if (It == OldStmts.end() || It->second.Size != Texts[I].size())
+      continue;
+    Found[I] = readBinaryStmt(It->second.Data, Texts[I], SM.getLocation(Texts[I].begin()), Ctx, Scopes[I]);
+    if (!Found[I])
+      continue;
+    Reused[I] = It->second.Data;
+    if (OldChecked)
+      Checked[I] = &Scopes[I];
+  }
+
+  // Parse each run of the others in one piece.
+  SmallVector<AST *> Stmts;
+  for (size_t I = 0; I < N;)
+  {
+    if (Found[I])
+    {
+      Stmts.push_back(Found[I++]);
+      continue;
+    }
+    size_t RunEnd = I + 1;
+    while (RunEnd < N && !Found[RunEnd])
+      ++RunEnd;
+
+    bool HasError;
+    Program *Part = parseRange(SM, Texts[I].begin() - Buffer.begin(), Texts[RunEnd - 1].end() - Buffer.begin(),
+                               Ctx, nulls(), PreLex, HasError);
+    if (HasError || size_t(Part->end() - Part->begin()) != RunEnd - I)
+      return nullptr;
+    Stmts.append(Part->begin(), Part->end());
+    I = RunEnd;
+  }
+
+  Tree = Ctx.create<Program>(Stmts);
+  return Tree;
+}
+
+ArrayRef<const CheckedStmt *> IncrementalIndex::checked(Program *Tree) const
+{
+  if (Tree != this->Tree)
+    return None;
+  return Checked;
+}
+
+void IncrementalIndex::store(Program *Tree, bool Passed)
+{
+  size_t N = Texts.size();
+  if (size_t(Tree->end() - Tree->begin()) != N)
+    return;
+
+  SmallString<0> Data;
+  raw_svector_ostream OS(Data);
+  support::endian::Writer Out(OS, support::little);
+  auto Put = [&Out](uint32_t V) { Out.write<uint32_t>(V); };
+  Put(Magic);
+  Put(Version);
+  Put(Passed);
+  Put(N);
+
+  SmallString<0> Fresh;
+  for (size_t I = 0; I < N; ++I)
+  {
+    // Statement I has to start in text I, or the split went wrong.
+    AST *Stmt = Tree->begin()[I];
+    SourceLocation TextLoc = SM.getLocation(Texts[I].begin());
+    SourceLocation Loc = Stmt->getLoc();
+    if (!Loc.isValid() || Loc.getOffset() < TextLoc.getOffset() ||
+        Loc.getOffset() >= TextLoc.getOffset() + Texts[I].size())
+      return;
+
+    // Statements from the old index are copied as they are.
+    StringRef Entry = Reused[I];
+    if (Entry.empty())
+    {
+      Fresh.clear();
+      raw_svector_ostream EntryOS(Fresh);
+      if (!writeBinaryStmt(Stmt, Texts[I], TextLoc, EntryOS))
+        return;
+      Entry = Fresh;
+    }
+    Put(uint32_t(Hashes[I]));
+    Put(uint32_t(Hashes[I] >> 32));
+    Put(Texts[I].size());
+    Put(Entry.size() / 4);
+    OS << Entry;
+  }
+
+  if (sys::fs::create_directories(sys::path::parent_path(Path)))
+    return;
+  consumeError(writeFileAtomically(Path + ".tmp%%%%%%", Path, Data));
+}
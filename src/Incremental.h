@@ -0,0 +1,70 @@
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+
+#include "AST.h"
+#include "Sema.h"
+#include "SourceManager.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+// Split Buffer into the texts of its top-level statements, without the
+// whitespace between them.
+void splitStatements(llvm::StringRef Buffer, std::vector<llvm::StringRef> &Stmts);
+
+// IncrementalIndex recompiles a source statement by statement. The index of
+// the last compile of a source with the same name, kept in the cache
+// directory, fingerprints each top-level statement by the hash of its text
+// and stores it in the binary AST format. Statements whose text is found in
+// the index are decoded instead of parsed, wherever they moved to, and Sema
+// only looks up their names; the text in between is parsed as usual.
+//
+// The index file holds a header (magic "SINC", version, whether the program
+// passed Sema, number of statements) and per statement the hash (low, high)
+// and size of its text, the number of words of its entry and the entry.
+class IncrementalIndex
+{
+  struct Entry
+  {
+    uint32_t Size;      // of the text
+    llvm::StringRef Data; // the statement, see writeBinaryStmt
+  };
+
+  const SourceManager &SM;
+  std::string Path;
+  std::unique_ptr<llvm::MemoryBuffer> Old; // the index of the last compile
+  llvm::DenseMap<uint64_t, Entry> OldStmts;
+  bool OldChecked = false;
+
+  std::vector<llvm::StringRef> Texts;  // of the statements of the source
+  std::vector<uint64_t> Hashes;        // of the texts
+  std::vector<llvm::StringRef> Reused; // their entries in Old, empty if parsed
+  std::vector<CheckedStmt> Scopes;
+  std::vector<const CheckedStmt *> Checked;
+  Program *Tree = nullptr;             // the program parse() built
+
+  void load();
+
+public:
+  IncrementalIndex(llvm::StringRef Dir, const SourceManager &SM);
+
+  // Build the program from the index and the changed statements. Returns
+  // nullptr if the changed text does not parse on its own, so that the whole
+  // source has to be parsed and its errors reported.
+  Program *parse(ASTContext &Ctx, bool PreLex);
+
+  // The statements of Tree that Sema can check by their names, if Tree came
+  // from parse().
+  llvm::ArrayRef<const CheckedStmt *> checked(Program *Tree) const;
+
+  // Replace the index by the statements of Tree, parsed without errors from
+  // the buffer of SM. Passed tells whether Tree passed Sema. Failures are
+  // ignored, the index only saves time.
+  void store(Program *Tree, bool Passed);
+};
+
+#endif
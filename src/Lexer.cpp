@@ -29,14 +29,14 @@ namespace charinfo
 
 void Lexer::next(Token &token)
 {
-    while (*BufferPtr && charinfo::isWhitespace(*BufferPtr))
+    while (BufferPtr != BufferEnd && *BufferPtr && charinfo::isWhitespace(*BufferPtr))
     {
         ++BufferPtr;
     }
     // make sure we didn't reach the end of input
-    if (!*BufferPtr)
+    if (BufferPtr == BufferEnd || !*BufferPtr)
     {
-        token.Kind = Token::eoi;
+        formToken(token, BufferPtr, Token::eoi);
         return;
     }
     // collect characters and check for keywords or ident
@@ -61,6 +61,10 @@ void Lexer::next(Token &token)
             kind = Token::KW_end;
         else if (Name == "loopc")
             kind = Token::KW_loopc;
+        else if (Name == "parloopc")
+            kind = Token::KW_parloopc;
+        else if (Name == "read")
+            kind = Token::KW_read;
         else if (Name == "and")
             kind = Token::KW_and;
         else if (Name == "or")
@@ -142,6 +146,8 @@ void Lexer::next(Token &token)
         break
             CASE('(', Token::l_paren);
             CASE(')', Token::r_paren);
+            CASE('[', Token::l_square);
+            CASE(']', Token::r_square);
             CASE(';', Token::semicolon);
             CASE(':', Token::colon);
             CASE(',', Token::comma);
@@ -157,6 +163,28 @@ void Lexer::formToken(Token &Tok, const char *TokEnd,
                       Token::TokenKind Kind)
 {
     Tok.Kind = Kind;
+    Tok.Loc = SourceLocation::fromOffset(BufferPtr - BufferStart);
     Tok.Text = llvm::StringRef(BufferPtr, TokEnd - BufferPtr);
     BufferPtr = TokEnd;
 }
+
+TokenBuffer::TokenBuffer(llvm::StringRef Buffer, size_t Begin, size_t End) : Buffer(Buffer)
+{
+    static_assert(Token::KW_or <= UINT8_MAX, "token kinds are stored in a byte");
+
+    // Guess at one token per four characters to avoid most regrowth.
+    size_t Estimate = (End - Begin) / 4 + 1;
+    Kinds.reserve(Estimate);
+    Offsets.reserve(Estimate);
+    Lengths.reserve(Estimate);
+
+    Lexer Lex(Buffer, Begin, End);
+    Token Tok;
+    do
+    {
+        Lex.next(Tok);
+        Kinds.push_back(Tok.Kind);
+        Offsets.push_back(Tok.Loc.getOffset());
+        Lengths.push_back(Tok.Text.size());
+    } while (!Tok.is(Token::eoi));
+}
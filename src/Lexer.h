@@ -1,14 +1,20 @@
 #ifndef LEXER_H // conditional compilations(checks whether a macro is not defined)
 #define LEXER_H
 
+#include "llvm/ADT/ArrayRef.h"
 #include "llvm/ADT/StringRef.h"        // encapsulates a pointer to a C string and its length
 #include "llvm/Support/MemoryBuffer.h" // read-only access to a block of memory, filled with the content of a file
+#include "SourceManager.h"            // SourceLocation, a 32-bit offset into the source
+#include <cstdint>
+#include <vector>
 
 class Lexer;
+class TokenBuffer;
 
 class Token
 {
     friend class Lexer; // Lexer can access private and protected members of Token
+    friend class TokenBuffer;
 
 public:
     enum TokenKind : unsigned short
@@ -41,6 +47,8 @@ public:
         exp,            // ^
         l_paren,        // (
         r_paren,        // )
+        l_square,       // [
+        r_square,       // ]
         KW_int,         // int
         KW_if,          // if
         KW_elif,        // elif
@@ -48,17 +56,21 @@ public:
         KW_begin,       // begin
         KW_end,         // end
         KW_loopc,       // loopc
+        KW_parloopc,    // parloopc
+        KW_read,        // read
         KW_and,         // and
         KW_or           // or
     };
 
 private:
     TokenKind Kind;
+    SourceLocation Loc;   // offset of the token in the input
     llvm::StringRef Text; // points to the start of the text of the token
 
 public:
     TokenKind getKind() const { return Kind; }
     llvm::StringRef getText() const { return Text; }
+    SourceLocation getLocation() const { return Loc; }
 
     // to test if the token is of a certain kind
     bool is(TokenKind K) const { return Kind == K; }
@@ -75,12 +87,23 @@ class Lexer
 {
     const char *BufferStart; // pointer to the beginning of the input
     const char *BufferPtr;   // pointer to the next unprocessed character
+    const char *BufferEnd;   // pointer past the last character to lex
 
 public:
     Lexer(const llvm::StringRef &Buffer)
     {
         BufferStart = Buffer.begin();
         BufferPtr = BufferStart;
+        BufferEnd = Buffer.end();
+    }
+
+    // lexes the bytes [Begin, End) of Buffer; locations are still offsets
+    // into the whole Buffer
+    Lexer(const llvm::StringRef &Buffer, size_t Begin, size_t End)
+    {
+        BufferStart = Buffer.begin();
+        BufferPtr = BufferStart + Begin;
+        BufferEnd = BufferStart + End;
     }
 
     void next(Token &token); // return the next token
@@ -88,4 +111,41 @@ public:
 private:
     void formToken(Token &Result, const char *TokEnd, Token::TokenKind Kind);
 };
+
+// TokenBuffer lexes a whole buffer up front and keeps the tokens as parallel
+// arrays of kinds, offsets and lengths, 9 bytes per token instead of a Token
+// each. Tokens are addressed by index, so a parser can look ahead or go back
+// any distance, and several threads can read the same buffer. The last token
+// is always eoi.
+class TokenBuffer
+{
+    llvm::StringRef Buffer;
+    std::vector<uint8_t> Kinds;
+    std::vector<uint32_t> Offsets;
+    std::vector<uint32_t> Lengths;
+
+public:
+    explicit TokenBuffer(llvm::StringRef Buffer) : TokenBuffer(Buffer, 0, Buffer.size()) {}
+
+    // only the tokens in the bytes [Begin, End) of Buffer
+    TokenBuffer(llvm::StringRef Buffer, size_t Begin, size_t End);
+
+    size_t size() const { return Kinds.size(); }
+    llvm::StringRef getBuffer() const { return Buffer; }
+
+    Token::TokenKind getKind(size_t I) const { return static_cast<Token::TokenKind>(Kinds[I]); }
+    SourceLocation getLocation(size_t I) const { return SourceLocation::fromOffset(Offsets[I]); }
+    llvm::StringRef getText(size_t I) const { return Buffer.substr(Offsets[I], Lengths[I]); }
+
+    // All kinds at once, e.g. to scan for statement boundaries.
+    llvm::ArrayRef<uint8_t> kinds() const { return Kinds; }
+
+    // Fill Tok with token I.
+    void getToken(size_t I, Token &Tok) const
+    {
+        Tok.Kind = getKind(I);
+        Tok.Loc = getLocation(I);
+        Tok.Text = getText(I);
+    }
+};
 #endif
\ No newline at end of file
@@ -0,0 +1,222 @@
+#include "ParallelLoop.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSet.h"
+
+using namespace llvm;
+
+namespace
+{
+  // Finds out what kind of node a Logic or Expr is, since the AST has no
+  // RTTI, and collects the variables an expression reads.
+  class NodeMatcher : public ASTVisitor
+  {
+  public:
+    Final *AsFinal = nullptr;
+    Comparison *AsComparison = nullptr;
+    SmallVector<StringRef, 8> Reads;
+    // The arrays read, with the index of each element read, or nullptr
+    // where all of them are.
+    SmallVector<std::pair<StringRef, Expr *>, 4> ArrayReads;
+
+    virtual void visit(ArrayElement &Node) override
+    {
+      ArrayReads.push_back({Node.getArray(), Node.getIndex()});
+      Node.getIndex()->accept(*this);
+      AsFinal = nullptr;
+    }
+
+    virtual void visit(ArrayReduce &Node) override
+    {
+      ArrayReads.push_back({Node.getArray(), nullptr});
+      AsFinal = nullptr;
+    }
+
+    virtual void visit(Final &Node) override
+    {
+      AsFinal = &Node;
+      if (Node.getKind() == Final::Ident)
+        Reads.push_back(Node.getVal());
+    }
+
+    virtual void visit(BinaryOp &Node) override
+    {
+      SmallVector<BinaryOp *, 16> Spine = leftSpine(Node);
+      Spine.front()->getLeft()->accept(*this);
+      for (BinaryOp *Op : Spine)
+        Op->getRight()->accept(*this);
+      AsFinal = nullptr;
+    }
+
+    virtual void visit(Comparison &Node) override { AsComparison = &Node; }
+    virtual void visit(Assignment &) override {}
+    virtual void visit(Declaration &) override {}
+    virtual void visit(LogicalExpr &) override {}
+    virtual void visit(IfStmt &) override {}
+    virtual void visit(IterStmt &) override {}
+    virtual void visit(elifStmt &) override {}
+    virtual void visit(ReadStmt &) override {}
+  };
+
+  NodeMatcher match(AST *Node)
+  {
+    NodeMatcher M;
+    Node->accept(M);
+    return M;
+  }
+
+  // Whether Stmt reads Var: in its right-hand side or index, or as the
+  // destination of a compound assignment.
+  bool readsVar(Assignment *Stmt, StringRef Var)
+  {
+    if (Stmt->getAssignKind() != Assignment::Assign && Stmt->getLeft()->getVal() == Var)
+      return true;
+    if (Stmt->getIndex() && is_contained(match(Stmt->getIndex()).Reads, Var))
+      return true;
+    return is_contained(match(Stmt->getRight()).Reads, Var);
+  }
+
+  // Whether E is the variable Var.
+  bool isVar(Expr *E, StringRef Var)
+  {
+    Final *F = E ? match(E).AsFinal : nullptr;
+    return F && F->getKind() == Final::Ident && F->getVal() == Var;
+  }
+}
+
+bool matchParallelLoop(IterStmt *Loop, ParallelLoop &Shape, function_ref<bool(StringRef)> IsArray,
+                       std::string &Error, SourceLocation &Loc)
+{
+  auto fail = [&](const AST &Node, const Twine &Message) {
+    Error = Message.str();
+    Loc = Node.getLoc();
+    return false;
+  };
+
+  Comparison *Cond = match(Loop->getCond()).AsComparison;
+  Final *IndVar = Cond ? match(Cond->getLeft()).AsFinal : nullptr;
+  if (!IndVar || IndVar->getKind() != Final::Ident || Cond->getOperator() == Comparison::Equal ||
+      Cond->getOperator() == Comparison::Not_equal)
+    return fail(*Loop, "parloopc needs a condition of the form i < n, i <= n, i > n or i >= n.");
+  Shape.IndVar = IndVar->getVal();
+  Shape.Bound = Cond->getRight();
+  Shape.Op = Cond->getOperator();
+  Shape.Step = 0;
+  Shape.Vars.clear();
+  Shape.Inputs.clear();
+
+  ArrayRef<Assignment *> Body(Loop->begin(), Loop->end());
+  StringMap<unsigned> Index; // of the variables in Shape.Vars
+  Assignment::AssignKind StepKind = Shape.countsUp() ? Assignment::Plus_assign : Assignment::Minus_assign;
+  StringSet<> Stored; // arrays
+  for (Assignment *Stmt : Body)
+  {
+    StringRef Var = Stmt->getLeft()->getVal();
+    if (IsArray(Var))
+    {
+      if (!Stmt->getIndex())
+        return fail(*Stmt, "parloopc cannot assign whole arrays.");
+      Stored.insert(Var);
+      continue;
+    }
+    if (Index.try_emplace(Var, Shape.Vars.size()).second)
+      Shape.Vars.push_back({Var, ParallelLoop::Private});
+    if (Var != Shape.IndVar)
+      continue;
+
+    Final *Step = match(Stmt->getRight()).AsFinal;
+    int32_t Value;
+    if (Shape.Step || Stmt->getAssignKind() != StepKind || !Step || Step->getKind() != Final::Number ||
+        Step->getVal().getAsInteger(10, Value) || Value <= 0)
+      return fail(*Stmt, "parloopc has to step " + Shape.IndVar + " once, by " + Shape.IndVar +
+                             (Shape.countsUp() ? " +=" : " -=") + " a positive constant.");
+    Shape.Step = Shape.countsUp() ? Value : -Value;
+  }
+  if (!Shape.Step)
+    return fail(*Loop, "parloopc has to step " + Shape.IndVar + " once, by " + Shape.IndVar +
+                           (Shape.countsUp() ? " +=" : " -=") + " a positive constant.");
+  Shape.Vars[Index.lookup(Shape.IndVar)].Kind = ParallelLoop::Induction;
+
+  // Each iteration may only touch its own element of the arrays it stores
+  // to, the one at the induction variable before it is stepped.
+  bool Stepped = false;
+  for (Assignment *Stmt : Body)
+  {
+    NodeMatcher Reads = match(Stmt->getRight());
+    if (Stmt->getIndex())
+    {
+      Stmt->getIndex()->accept(Reads);
+      if (!isVar(Stmt->getIndex(), Shape.IndVar) || Stepped)
+        return fail(*Stmt, "parloopc can only store to element " + Shape.IndVar + " of " +
+                               Stmt->getLeft()->getVal() + ", before stepping " + Shape.IndVar + ".");
+    }
+    for (auto &Read : Reads.ArrayReads)
+      if (Stored.count(Read.first) && (Stepped || !isVar(Read.second, Shape.IndVar)))
+        return fail(*Stmt, "parloopc stores to " + Read.first + ", so it can only read element " + Shape.IndVar +
+                               " of it, before stepping " + Shape.IndVar + ".");
+    Stepped |= Stmt->getLeft()->getVal() == Shape.IndVar;
+  }
+
+  NodeMatcher BoundReads = match(Shape.Bound);
+  for (StringRef Var : BoundReads.Reads)
+    if (Index.count(Var))
+      return fail(*Shape.Bound, "The bound of parloopc must not change in the loop, but " + Var + " does.");
+  for (auto &Read : BoundReads.ArrayReads)
+    if (Stored.count(Read.first))
+      return fail(*Shape.Bound, "The bound of parloopc must not change in the loop, but " + Read.first + " does.");
+
+  for (ParallelLoop::Var &V : Shape.Vars)
+  {
+    if (V.Kind == ParallelLoop::Induction)
+      continue;
+
+    // Private if the first statement that reads or writes it assigns it
+    // from other values.
+    for (Assignment *Stmt : Body)
+    {
+      bool Reads = readsVar(Stmt, V.Name);
+      if (!Reads && Stmt->getLeft()->getVal() != V.Name)
+        continue;
+      V.Kind = Reads ? ParallelLoop::Sum : ParallelLoop::Private;
+      break;
+    }
+    if (V.Kind == ParallelLoop::Private)
+      continue;
+
+    // Otherwise a reduction: only ever added to or multiplied, and never
+    // read otherwise.
+    bool Sum = false, Product = false;
+    for (Assignment *Stmt : Body)
+    {
+      bool Reads = is_contained(match(Stmt->getRight()).Reads, V.Name);
+      if (Stmt->getIndex())
+        Reads |= is_contained(match(Stmt->getIndex()).Reads, V.Name);
+      if (Stmt->getLeft()->getVal() == V.Name)
+      {
+        Assignment::AssignKind Kind = Stmt->getAssignKind();
+        bool Adds = Kind == Assignment::Plus_assign || Kind == Assignment::Minus_assign;
+        bool Multiplies = Kind == Assignment::Star_assign;
+        Sum |= Adds;
+        Product |= Multiplies;
+        Reads |= !(Adds || Multiplies) || (Sum && Product);
+      }
+      if (Reads)
+        return fail(*Stmt, "Variable " + V.Name +
+                               " carries a value from one iteration of parloopc to the next; only += and *= "
+                               "reductions can.");
+    }
+    V.Kind = Product ? ParallelLoop::Product : ParallelLoop::Sum;
+  }
+
+  for (Assignment *Stmt : Body)
+  {
+    NodeMatcher Reads = match(Stmt->getRight());
+    if (Stmt->getIndex())
+      Stmt->getIndex()->accept(Reads);
+    for (StringRef Var : Reads.Reads)
+      if (Var != Shape.IndVar && !Index.count(Var) && !is_contained(Shape.Inputs, Var))
+        Shape.Inputs.push_back(Var);
+  }
+  return true;
+}
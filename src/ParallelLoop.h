@@ -0,0 +1,51 @@
+#ifndef PARALLELLOOP_H
+#define PARALLELLOOP_H
+
+#include "AST.h"
+#include "SourceManager.h"
+#include "llvm/ADT/STLFunctionalExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include <cstdint>
+#include <string>
+
+// The shape of a parloopc, whose iterations can run in any order. The
+// condition compares an induction variable with a bound the body does not
+// change, and the body steps the induction variable once by a constant, so
+// the number of iterations is known when the loop starts. Every other
+// variable the body assigns is either private to an iteration (assigned
+// before it is read) or a reduction that the body only adds to or only
+// multiplies, and never reads. Arrays the body stores to are only accessed
+// at the element the induction variable selects, before it is stepped.
+struct ParallelLoop
+{
+  enum VarKind
+  {
+    Induction,
+    Private,
+    Sum,     // changed by += and -= only
+    Product  // changed by *= only
+  };
+
+  struct Var
+  {
+    llvm::StringRef Name;
+    VarKind Kind;
+  };
+
+  llvm::StringRef IndVar;
+  Expr *Bound = nullptr;
+  Comparison::Operator Op = Comparison::Less; // IndVar Op Bound: <, <=, > or >=
+  int32_t Step = 0;                          // added to IndVar by each iteration
+  llvm::SmallVector<Var, 8> Vars;            // assigned by the body, in the order of their first assignment
+  llvm::SmallVector<llvm::StringRef, 8> Inputs; // only read by the body, besides IndVar
+
+  bool countsUp() const { return Op == Comparison::Less || Op == Comparison::Less_equal; }
+};
+
+// Match Loop against the shape of a parloopc, where IsArray tells the arrays
+// from the ints. On failure, Error says what is wrong and Loc where.
+bool matchParallelLoop(IterStmt *Loop, ParallelLoop &Shape, llvm::function_ref<bool(llvm::StringRef)> IsArray,
+                       std::string &Error, SourceLocation &Loc);
+
+#endif
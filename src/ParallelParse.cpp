@@ -0,0 +1,149 @@
+#include "ParallelParse.h"
+#include "Driver.h"
+#include "Lexer.h"
+#include "Parser.h"
+#include "WorkStealingPool.h"
+#include "llvm/ADT/STLExtras.h"
+#include <string>
+#include <vector>
+
+using namespace llvm;
+
+namespace
+{
+  // Chunks smaller than this are not worth a thread.
+  const size_t MinChunkSize = 1 << 20;
+
+  // Chunks per thread, so that a slow chunk does not hold up the others.
+  const unsigned ChunksPerJob = 4;
+
+  bool isLetter(char C) { return (C >= 'a' && C <= 'z') || (C >= 'A' && C <= 'Z'); }
+  bool isWhitespace(char C) { return C == ' ' || C == '\t' || C == '\f' || C == '\v' || C == '\r' || C == '\n'; }
+}
+
+Program *parseRange(const SourceManager &SM, size_t Begin, size_t End, ASTContext &Ctx,
+                    raw_ostream &Diag, bool PreLex, bool &HasError)
+{
+  Program *Tree;
+  if (PreLex)
+  {
+    TokenBuffer Toks(SM.getBuffer(), Begin, End);
+    Parser Parser(Toks, Ctx, Diag, &SM);
+    Tree = Parser.parse();
+    HasError = Parser.hasError();
+  }
+  else
+  {
+    Lexer Lex(SM.getBuffer(), Begin, End);
+    Parser Parser(Lex, Ctx, Diag, &SM);
+    Tree = Parser.parse();
+    HasError = Parser.hasError();
+  }
+  return Tree;
+}
+
+// Blocks only hold assignments and never nest, so the begin/end depth at any
+// point can be told from the next few words, without scanning from the start:
+// - int, if, loopc, parloopc and read only start top-level statements;
+// - an 'end' closes a block, so the statement is over after it unless an
+//   elif or else follows;
+// - a ';' is top level unless an 'end' comes before the next 'begin' or
+//   statement keyword.
+size_t findStatementBoundary(StringRef Buffer, size_t Pos)
+{
+  const size_t Size = Buffer.size();
+  const size_t None = StringRef::npos;
+  size_t PendingSemi = None;
+
+  // Do not start in the middle of a word.
+  while (Pos > 0 && Pos < Size && isLetter(Buffer[Pos - 1]) && isLetter(Buffer[Pos]))
+    ++Pos;
+
+  auto wordAt = [&](size_t At) {
+    size_t WordEnd = At;
+    while (WordEnd < Size && isLetter(Buffer[WordEnd]))
+      ++WordEnd;
+    return Buffer.slice(At, WordEnd);
+  };
+
+  while (Pos < Size)
+  {
+    char C = Buffer[Pos];
+    if (C == ';')
+    {
+      if (PendingSemi == None)
+        PendingSemi = Pos + 1;
+      ++Pos;
+      continue;
+    }
+    if (!isLetter(C))
+    {
+      ++Pos;
+      continue;
+    }
+
+    StringRef Word = wordAt(Pos);
+    size_t WordEnd = Pos + Word.size();
+    if (Word == "int" || Word == "if" || Word == "loopc" || Word == "parloopc" || Word == "read")
+      return PendingSemi != None ? PendingSemi : Pos;
+    if (Word == "begin" && PendingSemi != None)
+      return PendingSemi;
+    if (Word == "end")
+    {
+      // Any ';' seen so far was inside this block.
+      PendingSemi = None;
+      size_t Next = WordEnd;
+      while (Next < Size && isWhitespace(Buffer[Next]))
+        ++Next;
+      StringRef NextWord = wordAt(Next);
+      if (NextWord != "elif" && NextWord != "else")
+        return WordEnd;
+    }
+    Pos = WordEnd;
+  }
+  return Size;
+}
+
+Program *parseInParallel(const SourceManager &SM, ASTContext &Ctx, raw_ostream &Diag,
+                         unsigned Jobs, bool PreLex, bool &HasError)
+{
+  StringRef Buffer = SM.getBuffer();
+  WorkStealingPool Pool(Jobs);
+  size_t NumChunks = std::min<size_t>(Pool.size() * ChunksPerJob, Buffer.size() / MinChunkSize);
+  if (Pool.size() == 1 || NumChunks < 2)
+    return parseRange(SM, 0, Buffer.size(), Ctx, Diag, PreLex, HasError);
+
+  // Cut at the first boundary after each evenly spaced target.
+  std::vector<size_t> Cuts = {0};
+  for (size_t I = 1; I < NumChunks; ++I)
+  {
+    size_t Cut = findStatementBoundary(Buffer, Buffer.size() * I / NumChunks);
+    if (Cut > Cuts.back() && Cut < Buffer.size())
+      Cuts.push_back(Cut);
+  }
+  Cuts.push_back(Buffer.size());
+
+  size_t N = Cuts.size() - 1;
+  std::vector<ASTContext *> Arenas;
+  for (size_t I = 0; I < N; ++I)
+    Arenas.push_back(&Ctx.createChild());
+  std::vector<Program *> Parts(N);
+  std::vector<std::string> Diags(N);
+  std::vector<char> Failed(N);
+
+  Pool.run(N, [&](unsigned, size_t I) {
+    raw_string_ostream ChunkDiag(Diags[I]);
+    bool ChunkError;
+    Parts[I] = parseRange(SM, Cuts[I], Cuts[I + 1], *Arenas[I], ChunkDiag, PreLex, ChunkError);
+    Failed[I] = ChunkError;
+  });
+
+  if (is_contained(Failed, 1))
+    return parseRange(SM, 0, Buffer.size(), Ctx, Diag, PreLex, HasError);
+
+  SmallVector<AST *> Stmts;
+  for (Program *Part : Parts)
+    Stmts.append(Part->begin(), Part->end());
+  HasError = false;
+  return Ctx.create<Program>(Stmts);
+}
@@ -0,0 +1,28 @@
+#ifndef PARALLELPARSE_H
+#define PARALLELPARSE_H
+
+#include "AST.h"
+#include "SourceManager.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstddef>
+
+// Lex and parse the bytes [Begin, End) of the buffer of SM into Ctx. The
+// range has to start and end between top-level statements. Syntax errors are
+// reported to Diag and set HasError; the statements that parsed are returned
+// either way.
+Program *parseRange(const SourceManager &SM, size_t Begin, size_t End, ASTContext &Ctx,
+                    llvm::raw_ostream &Diag, bool PreLex, bool &HasError);
+
+// Offset of the first top-level statement boundary at or after Pos, or the
+// size of Buffer if there is none.
+size_t findStatementBoundary(llvm::StringRef Buffer, size_t Pos);
+
+// Parse the buffer of SM in chunks on up to Jobs threads (0: one per
+// hardware thread), each chunk into its own child arena of Ctx, and splice
+// the statements into one Program. Small inputs are parsed on the calling
+// thread. If any chunk has a syntax error the input is parsed again in one
+// piece, so the diagnostics are the same as without chunking.
+Program *parseInParallel(const SourceManager &SM, ASTContext &Ctx, llvm::raw_ostream &Diag,
+                         unsigned Jobs, bool PreLex, bool &HasError);
+
+#endif
@@ -1,7 +1,5 @@
 #include "Parser.h"
 
-bool haveElse;
-
 // main point is that the whole input has been consumed
 Program *Parser::parse()
 {
@@ -9,71 +7,93 @@ Program *Parser::parse()
     return Res;
 }
 
+// After a syntax error, skips to where the next statement can start: past
+// the ';' that ends the broken statement, or up to a keyword that begins a
+// new one. A skipped begin ... end block is skipped as a whole, together with
+// the elif and else arms that follow it.
+void Parser::skipStatement()
+{
+    unsigned Depth = 0;
+    while (!Tok.is(Token::eoi))
+    {
+        if (Tok.isOneOf(Token::KW_int, Token::KW_if, Token::KW_loopc, Token::KW_parloopc, Token::KW_read))
+            return;
+        if (Tok.is(Token::semicolon) && Depth == 0)
+        {
+            advance();
+            return;
+        }
+        if (Tok.is(Token::KW_begin))
+            ++Depth;
+        else if (Tok.is(Token::KW_end) && Depth > 0 && --Depth == 0)
+        {
+            advance();
+            if (!Tok.isOneOf(Token::KW_elif, Token::KW_else))
+                return;
+            continue;
+        }
+        advance();
+    }
+}
+
+// Same for a broken assignment inside a block: skips past its ';', or up to
+// the 'end' of the block or a keyword that cannot appear in one.
+void Parser::skipAssignment()
+{
+    while (!Tok.isOneOf(Token::eoi, Token::KW_end, Token::KW_int, Token::KW_if, Token::KW_loopc,
+                        Token::KW_parloopc, Token::KW_read, Token::KW_elif, Token::KW_else))
+    {
+        if (Tok.is(Token::semicolon))
+        {
+            advance();
+            return;
+        }
+        advance();
+    }
+}
+
 Program *Parser::parseProgram()
 {
     llvm::SmallVector<AST *> data;
-    
+
+    // A statement that cannot be parsed is reported and dropped, and parsing
+    // goes on with the next one, so that one run reports every error.
     while (!Tok.is(Token::eoi))
     {
-        haveElse = true;
+        AST *Stmt = nullptr;
         switch (Tok.getKind())
         {
         case Token::KW_int:
-            Declaration *d;
-            d = parseDec();
-            if (d)
-                data.push_back(d);
-            else {
-                goto _error;
-            }
+            Stmt = parseDec();
             break;
         case Token::ident:
             Assignment *a;
             a = parseAssign();
-            if (!Tok.is(Token::semicolon))
-            {
-                error();
-                goto _error;
-            }
-
-            if (a)
-                data.push_back(a);
-            else {
-                goto _error;
-            }
+            if (a && !consume(Token::semicolon))
+                Stmt = a;
+            else
+                skipStatement();
             break;
         case Token::KW_if:
-            IfStmt *i;
-            i = parseIf();
-            if (i)
-                data.push_back(i);
-            else {
-                goto _error;
-            }
+            Stmt = parseIf();
             break;
         case Token::KW_loopc:
-            IterStmt *l;
-            l = parseIter();
-            if (l)
-                data.push_back(l);
-            else {
-                goto _error;
-            }
+        case Token::KW_parloopc:
+            Stmt = parseIter();
+            break;
+        case Token::KW_read:
+            Stmt = parseRead();
             break;
         default:
             error();
-            goto _error;
-            break;
-        }
-        if(haveElse){
             advance();
+            skipStatement();
+            break;
         }
+        if (Stmt)
+            data.push_back(Stmt);
     }
-    return new Program(data);
-_error:
-    while (Tok.getKind() != Token::eoi)
-        advance();
-    return nullptr;
+    return Ctx.create<Program>(data);
 }
 
 Declaration *Parser::parseDec()
@@ -81,7 +101,30 @@ Declaration *Parser::parseDec()
     Expr *E;
     llvm::SmallVector<llvm::StringRef, 8> Vars;
     llvm::SmallVector<Expr *, 8> Values;
+    llvm::SmallVector<unsigned, 8> Sizes;
     int count = 1;
+    SourceLocation Loc = Tok.getLocation();
+
+    // A name, and for an array its number of elements in brackets.
+    auto parseVar = [&]() {
+        if (expect(Token::ident))
+            return false;
+        Vars.push_back(Tok.getText());
+        Sizes.push_back(0);
+        advance();
+        if (!Tok.is(Token::l_square))
+            return true;
+        advance();
+        if (expect(Token::number))
+            return false;
+        if (Tok.getText().getAsInteger(10, Sizes.back()) || Sizes.back() == 0)
+        {
+            error();
+            return false;
+        }
+        advance();
+        return !consume(Token::r_square);
+    };
     
     if (expect(Token::KW_int)){
         goto _error;
@@ -89,24 +132,19 @@ Declaration *Parser::parseDec()
 
     advance();
     
-    if (expect(Token::ident)){
+    if (!parseVar()){
         goto _error;
     }
 
-    Vars.push_back(Tok.getText());
-    advance();
-
     
     while (Tok.is(Token::comma))
     {
         advance();
-        if (expect(Token::ident)){
+        if (!parseVar()){
             goto _error;
         }
             
-        Vars.push_back(Tok.getText());
         count++;
-        advance();
     }
 
     if (Tok.is(Token::assign))
@@ -140,29 +178,74 @@ Declaration *Parser::parseDec()
         }
     }
 
-    if (expect(Token::semicolon)){
+    if (consume(Token::semicolon)){
         goto _error;
     }
 
 
-    return new Declaration(Vars, Values);
-_error: 
-    while (Tok.getKind() != Token::eoi)
+    return Ctx.createAt<Declaration>(Loc, Vars, Values, Sizes);
+_error:
+    skipStatement();
+    // Keep the names read so far, so that their uses are not reported as
+    // undeclared too.
+    if (Vars.empty())
+        return nullptr;
+    Sizes.resize(Vars.size());
+    return Ctx.createAt<Declaration>(Loc, Vars, llvm::SmallVector<Expr *, 8>(), Sizes);
+}
+
+// read x, a; reads a value into each variable and array named.
+ReadStmt *Parser::parseRead()
+{
+    llvm::SmallVector<Final *, 8> Vars;
+    SourceLocation Loc = Tok.getLocation();
+    advance();
+    do
+    {
+        if (!Vars.empty())
+            advance();
+        if (expect(Token::ident))
+        {
+            skipStatement();
+            return nullptr;
+        }
+        Vars.push_back(Ctx.createAt<Final>(Tok.getLocation(), Final::Ident, Tok.getText()));
         advance();
-    return nullptr;
+    } while (Tok.is(Token::comma));
+
+    if (consume(Token::semicolon))
+    {
+        skipStatement();
+        return nullptr;
+    }
+    return Ctx.createAt<ReadStmt>(Loc, Vars);
 }
 
 Assignment *Parser::parseAssign()
 {
     Expr *E;
     Final *F;
+    Expr *Index = nullptr;
     Assignment::AssignKind AK;
+    SourceLocation Loc = Tok.getLocation();
 
-    F = (Final *)(parseFinal());
-    if (F == nullptr)
+    // Sema rejects a number here with a better message than the parser can.
+    if (!Tok.isOneOf(Token::ident, Token::number))
     {
+        error();
         goto _error;
     }
+    F = Ctx.createAt<Final>(Loc, Tok.is(Token::number) ? Final::Number : Final::Ident, Tok.getText());
+    advance();
+
+    // An element of an array.
+    if (Tok.is(Token::l_square))
+    {
+        advance();
+        Index = parseExpr();
+        if (!Index || consume(Token::r_square))
+            goto _error;
+    }
 
     if (Tok.is(Token::assign))
     {
@@ -200,239 +283,326 @@ Assignment *Parser::parseAssign()
     advance();
     E = parseExpr();
     if(E){
-        return new Assignment(F, E, AK);
+        return Ctx.createAt<Assignment>(Loc, F, E, AK, Index);
     }
     else{
         goto _error;
     }
 
 _error:
-    while (Tok.getKind() != Token::eoi)
-        advance();
     return nullptr;
 }
 
-Expr *Parser::parseExpr()
+namespace
 {
-    Expr *Left = parseTerm();
-    if (Left == nullptr)
+    // A binary operator waiting on the operator stack of parseExpr or
+    // parseLogic for its right operand. Prec 0 marks an open parenthesis.
+    template <typename OpKind> struct PendingOp
     {
-        goto _error;
-    }
-    
-    while (Tok.isOneOf(Token::plus, Token::minus))
+        OpKind Op;
+        unsigned Prec;
+        SourceLocation Loc;
+    };
+
+    struct BinaryOpInfo
     {
         BinaryOp::Operator Op;
-        if (Tok.is(Token::plus))
-            Op = BinaryOp::Plus;
-        else if (Tok.is(Token::minus))
-            Op = BinaryOp::Minus;
-        else {
-            error();
-            goto _error;
-        }
-        advance();
-        Expr *Right = parseTerm();
-        if (Right == nullptr)
+        unsigned Prec; // 0 if the token is not a binary operator
+        bool RightAssoc;
+    };
+
+    // How each token binds as an arithmetic operator.
+    BinaryOpInfo getBinaryOpInfo(Token::TokenKind Kind)
+    {
+        switch (Kind)
         {
-            goto _error;
+        case Token::plus:
+            return {BinaryOp::Plus, 1, false};
+        case Token::minus:
+            return {BinaryOp::Minus, 1, false};
+        case Token::star:
+            return {BinaryOp::Mul, 2, false};
+        case Token::slash:
+            return {BinaryOp::Div, 2, false};
+        case Token::mod:
+            return {BinaryOp::Mod, 2, false};
+        case Token::exp:
+            return {BinaryOp::Exp, 3, true};
+        default:
+            return {BinaryOp::Plus, 0, false};
         }
-        Left = new BinaryOp(Op, Left, Right);
     }
-    return Left;
-
-_error:
-    while (Tok.getKind() != Token::eoi)
-        advance();
-    return nullptr;
 }
 
-Expr *Parser::parseTerm()
+// Arithmetic expressions are parsed by operator precedence with explicit
+// operand and operator stacks instead of one recursive function per level,
+// so neither long nor deeply nested expressions can overflow the call stack.
+// The later passes only recurse into right operands, so expressions are
+// nested at most MaxExprDepth deep that way, however long they are.
+Expr *Parser::parseExpr()
 {
-    Expr *Left = parseFactor();
-    if (Left == nullptr)
-    {
-        goto _error;
-    }
-    while (Tok.isOneOf(Token::star, Token::mod, Token::slash))
+    llvm::SmallVector<Expr *, 16> Operands;
+    llvm::SmallVector<unsigned, 16> Depths; // of each operand
+    llvm::SmallVector<PendingOp<BinaryOp::Operator>, 16> Ops;
+    unsigned OpenParens = 0;
+
+    // Combine the operator on top of the stack with its two operands.
+    // Returns false if the result is nested too deep.
+    auto Reduce = [&]() {
+        PendingOp<BinaryOp::Operator> Top = Ops.pop_back_val();
+        Expr *Right = Operands.pop_back_val();
+        Operands.back() = Ctx.createAt<BinaryOp>(Top.Loc, Top.Op, Operands.back(), Right);
+        unsigned RightDepth = Depths.pop_back_val();
+        Depths.back() = std::max(Depths.back(), RightDepth + 1);
+        if (Depths.back() <= MaxExprDepth)
+            return true;
+        depthError(Top.Loc);
+        return false;
+    };
+
+    while (true)
     {
-        BinaryOp::Operator Op;
-        if (Tok.is(Token::star))
-            Op = BinaryOp::Mul;
-        else if (Tok.is(Token::slash))
-            Op = BinaryOp::Div;
-        else if (Tok.is(Token::mod))
-            Op = BinaryOp::Mod;
-        else {
-            error();
-            goto _error;
+        // An operand, after any number of open parentheses.
+        while (Tok.is(Token::l_paren))
+        {
+            Ops.push_back({BinaryOp::Plus, 0, Tok.getLocation()});
+            ++OpenParens;
+            advance();
         }
-        advance();
-        Expr *Right = parseFactor();
-        if (Right == nullptr)
+        Expr *Operand = parseFinal();
+        if (Operand == nullptr)
+            return nullptr;
+        Operands.push_back(Operand);
+        Depths.push_back(Depth);
+
+        // Close parentheses until an operator, or the end of the expression.
+        while (OpenParens > 0 && Tok.is(Token::r_paren))
         {
-            goto _error;
+            while (Ops.back().Prec != 0)
+                if (!Reduce())
+                    return nullptr;
+            Ops.pop_back();
+            --OpenParens;
+            advance();
         }
-        Left = new BinaryOp(Op, Left, Right);
-    }
-    return Left;
 
-_error:
-    while (Tok.getKind() != Token::eoi)
+        BinaryOpInfo Info = getBinaryOpInfo(Tok.getKind());
+        if (Info.Prec == 0)
+            break;
+        while (!Ops.empty() && (Ops.back().Prec > Info.Prec || (Ops.back().Prec == Info.Prec && !Info.RightAssoc)))
+            if (!Reduce())
+                return nullptr;
+        Ops.push_back({Info.Op, Info.Prec, Tok.getLocation()});
         advance();
-    return nullptr;
-}
-
-Expr *Parser::parseFactor()
-{
-    Expr *Left = parseFinal();
-    if (Left == nullptr)
-    {
-        goto _error;
     }
-    while (Tok.is(Token::exp))
+
+    if (OpenParens > 0)
     {
-        BinaryOp::Operator Op;
-        if (Tok.is(Token::exp))
-            Op = BinaryOp::Exp;
-        else {
-            error();
-            goto _error;
-        }
-        advance();
-        Expr *Right = parseFactor();
-        if (Right == nullptr)
-        {
-            goto _error;
-        }
-        Left = new BinaryOp(Op, Left, Right);
+        error();
+        return nullptr;
     }
-    return Left;
-
-_error:
-    while (Tok.getKind() != Token::eoi)
-        advance();
-    return nullptr;
+    while (!Ops.empty())
+        if (!Reduce())
+            return nullptr;
+    Depth = Depths.back();
+    return Operands.back();
 }
 
 Expr *Parser::parseFinal()
 {
     Expr *Res = nullptr;
+    Depth = 1;
     switch (Tok.getKind())
     {
     case Token::number:
-        Res = new Final(Final::Number, Tok.getText());
+        Res = Ctx.createAt<Final>(Tok.getLocation(), Final::Number, Tok.getText());
         advance();
         break;
     case Token::ident:
-        Res = new Final(Final::Ident, Tok.getText());
-        advance();
-        break;
-    case Token::l_paren:
+    {
+        SourceLocation Loc = Tok.getLocation();
+        llvm::StringRef Name = Tok.getText();
         advance();
-        Res = parseExpr();
-        if(Res == nullptr){
-            goto _error;
+        if (Tok.is(Token::l_square))
+        {
+            // a[i]. The parser itself recurses into the index, so a check of
+            // the depth after the index would come too late.
+            if (IndexNesting == MaxExprDepth)
+            {
+                depthError(Tok.getLocation());
+                return nullptr;
+            }
+            advance();
+            ++IndexNesting;
+            Expr *Index = parseExpr();
+            --IndexNesting;
+            if (!Index || consume(Token::r_square))
+                return nullptr;
+            if (++Depth > MaxExprDepth)
+            {
+                depthError(Loc);
+                return nullptr;
+            }
+            Res = Ctx.createAt<ArrayElement>(Loc, Name, Index);
         }
-        if (!consume(Token::r_paren))
-            break;
+        else if (Tok.is(Token::l_paren))
+        {
+            // sum(a), min(a) or max(a)
+            ArrayReduce::Operator Op;
+            if (Name == "sum")
+                Op = ArrayReduce::Sum;
+            else if (Name == "min")
+                Op = ArrayReduce::Min;
+            else if (Name == "max")
+                Op = ArrayReduce::Max;
+            else
+            {
+                error();
+                return nullptr;
+            }
+            advance();
+            if (expect(Token::ident))
+                return nullptr;
+            llvm::StringRef Array = Tok.getText();
+            advance();
+            if (consume(Token::r_paren))
+                return nullptr;
+            Res = Ctx.createAt<ArrayReduce>(Loc, Op, Array);
+        }
+        else
+            Res = Ctx.createAt<Final>(Loc, Final::Ident, Name);
+        break;
+    }
     default:
         error();
-        goto _error;
+        break;
     }
     return Res;
-
-_error:
-    while (Tok.getKind() != Token::eoi)
-        advance();
-    return nullptr;
 }
 
-Logic *Parser::parseComparison()
+// Conditions are comparisons joined by and/or, which bind equally and group
+// to the left; parentheses group conditions. Like parseExpr, this keeps its
+// own stacks. The passes recurse into both sides of a condition, so the
+// comparisons joined in one are bounded by MaxExprDepth.
+Logic *Parser::parseLogic()
 {
-    Logic *Res = nullptr;
-    if (Tok.is(Token::l_paren)) {
-        advance();
-        Res = parseLogic();
-        if (Res == nullptr)
+    llvm::SmallVector<Logic *, 8> Operands;
+    llvm::SmallVector<unsigned, 8> Depths; // of each operand
+    llvm::SmallVector<PendingOp<LogicalExpr::Operator>, 8> Ops;
+    unsigned OpenParens = 0;
+
+    auto Reduce = [&]() {
+        PendingOp<LogicalExpr::Operator> Top = Ops.pop_back_val();
+        Logic *Right = Operands.pop_back_val();
+        Operands.back() = Ctx.createAt<LogicalExpr>(Top.Loc, Operands.back(), Right, Top.Op);
+        unsigned RightDepth = Depths.pop_back_val();
+        Depths.back() = std::max(Depths.back(), RightDepth) + 1;
+        if (Depths.back() <= MaxExprDepth)
+            return true;
+        depthError(Top.Loc);
+        return false;
+    };
+
+    while (true)
+    {
+        while (Tok.is(Token::l_paren))
         {
-            goto _error;
+            Ops.push_back({LogicalExpr::And, 0, Tok.getLocation()});
+            ++OpenParens;
+            advance();
         }
-        if (consume(Token::r_paren))
-            goto _error;
-    }
-    else {
+
         Expr *Left = parseExpr();
-        if(Left == nullptr){
-            goto _error;
-        }
+        if (Left == nullptr)
+            return nullptr;
+        unsigned LeftDepth = Depth;
         Comparison::Operator Op;
-            if (Tok.is(Token::eq))
-                Op = Comparison::Equal;
-            else if (Tok.is(Token::neq))
-                Op = Comparison::Not_equal;
-            else if (Tok.is(Token::gt))
-                Op = Comparison::Greater;
-            else if (Tok.is(Token::lt))
-                Op = Comparison::Less;
-            else if (Tok.is(Token::gte))
-                Op = Comparison::Greater_equal;
-            else if (Tok.is(Token::lte))
-                Op = Comparison::Less_equal;    
-            else {
-                    error();
-                    goto _error;
-                }
+        SourceLocation OpLoc = Tok.getLocation();
+        switch (Tok.getKind())
+        {
+        case Token::eq:
+            Op = Comparison::Equal;
+            break;
+        case Token::neq:
+            Op = Comparison::Not_equal;
+            break;
+        case Token::gt:
+            Op = Comparison::Greater;
+            break;
+        case Token::lt:
+            Op = Comparison::Less;
+            break;
+        case Token::gte:
+            Op = Comparison::Greater_equal;
+            break;
+        case Token::lte:
+            Op = Comparison::Less_equal;
+            break;
+        default:
+            error();
+            return nullptr;
+        }
+        advance();
+        Expr *Right = parseExpr();
+        if (Right == nullptr)
+            return nullptr;
+        Operands.push_back(Ctx.createAt<Comparison>(OpLoc, Left, Right, Op));
+        Depths.push_back(std::max(LeftDepth, Depth) + 1);
+        if (Depths.back() > MaxExprDepth)
+        {
+            depthError(OpLoc);
+            return nullptr;
+        }
+
+        while (OpenParens > 0 && Tok.is(Token::r_paren))
+        {
+            while (Ops.back().Prec != 0)
+                if (!Reduce())
+                    return nullptr;
+            Ops.pop_back();
+            --OpenParens;
             advance();
-            Expr *Right = parseExpr();
-            if (Right == nullptr)
-            {
-                goto _error;
-            }
-            
-            Res = new Comparison(Left, Right, Op);
-    }
-    
-    return Res;
+        }
 
-_error:
-    while (Tok.getKind() != Token::eoi)
+        if (!Tok.isOneOf(Token::KW_and, Token::KW_or))
+            break;
+        while (!Ops.empty() && Ops.back().Prec != 0)
+            if (!Reduce())
+                return nullptr;
+        Ops.push_back({Tok.is(Token::KW_and) ? LogicalExpr::And : LogicalExpr::Or, 1, Tok.getLocation()});
         advance();
-    return nullptr;
-}
+    }
 
-Logic *Parser::parseLogic()
-{
-    Logic *Left = parseComparison();
-    if (Left == nullptr)
+    if (OpenParens > 0)
     {
-        goto _error;
+        error();
+        return nullptr;
     }
-    while (Tok.isOneOf(Token::KW_and, Token::KW_or))
+    while (!Ops.empty())
+        if (!Reduce())
+            return nullptr;
+    return Operands.back();
+}
+
+// Parses "begin assignment; ... end" into Body. A broken assignment is
+// reported and skipped, and the rest of the block is still parsed. Returns
+// false if the block itself is malformed.
+bool Parser::parseBlock(llvm::SmallVector<Assignment *, 8> &Body)
+{
+    if (consume(Token::KW_begin))
+        return false;
+
+    while (!Tok.isOneOf(Token::eoi, Token::KW_end, Token::KW_int, Token::KW_if, Token::KW_loopc,
+                        Token::KW_parloopc, Token::KW_read, Token::KW_elif, Token::KW_else))
     {
-        LogicalExpr::Operator Op;
-        if (Tok.is(Token::KW_and))
-            Op = LogicalExpr::And;
-        else if (Tok.is(Token::KW_or))
-            Op = LogicalExpr::Or;
-        else {
-            error();
-            goto _error;
-        }
-        advance();
-        Logic *Right = parseComparison();
-        if (Right == nullptr)
-        {
-            goto _error;
-        }
-        Left = new LogicalExpr(Left, Right, Op);
+        Assignment *asgnmnt = parseAssign();
+        if (asgnmnt && !consume(Token::semicolon))
+            Body.push_back(asgnmnt);
+        else
+            skipAssignment();
     }
-    return Left;
 
-_error:
-    while (Tok.getKind() != Token::eoi)
-        advance();
-    return nullptr;
+    return !consume(Token::KW_end);
 }
 
 IfStmt *Parser::parseIf()
@@ -440,11 +610,8 @@ IfStmt *Parser::parseIf()
     llvm::SmallVector<Assignment *, 8> ifAssignments;
     llvm::SmallVector<Assignment *, 8> elseAssignments;
     llvm::SmallVector<elifStmt *, 8> elifStmts;
-    Logic *Cond;
-    Assignment *ifAsgnmnt;
-    Assignment *elseAssignment;
-
-    haveElse = false;
+    Logic *Cond = nullptr;
+    SourceLocation Loc = Tok.getLocation();
 
     if (expect(Token::KW_if)){
         goto _error;
@@ -458,182 +625,131 @@ IfStmt *Parser::parseIf()
         goto _error;
     }
 
-    if (expect(Token::colon)){
+    if (consume(Token::colon)){
         goto _error;
     }
-        
-    advance();
 
-    if (expect(Token::KW_begin)){
+    if (!parseBlock(ifAssignments)){
         goto _error;
     }
 
-    advance();
-    
-    while (!Tok.is(Token::KW_end))
-    {
-        ifAsgnmnt = parseAssign();
-        if(ifAsgnmnt)
-           ifAssignments.push_back(ifAsgnmnt);
-        else
-            goto _error;
-        
-        if (expect(Token::semicolon))
-        {
-            goto _error;
-        }
-
-        advance();
-    }
-
-    advance();
-
     while (Tok.is(Token::KW_elif)) {
+        SourceLocation ElifLoc = Tok.getLocation();
 
         advance();
         
-        elifStmt *elif;
         llvm::SmallVector<Assignment *, 8> elifAssignments;
-        Logic *Cond;
-        Assignment *elifAssignment;
+        Logic *ElifCond;
 
-        Cond = parseLogic();
-        if (Cond == nullptr)
+        ElifCond = parseLogic();
+        if (ElifCond == nullptr)
         {
             goto _error;
         }
 
-        if (expect(Token::colon)){
+        if (consume(Token::colon)){
             goto _error;
         }
 
-        advance();
-
-        if (expect(Token::KW_begin)){
+        if (!parseBlock(elifAssignments)){
             goto _error;
         }
 
-        advance();
-
-        while (!Tok.is(Token::KW_end))
-        {
-            elifAssignment = parseAssign();
-
-            if (elifAssignment)
-            {
-                elifAssignments.push_back(elifAssignment);                
-            }
-            else
-                goto _error;
-            
-            if (expect(Token::semicolon))
-            {
-                goto _error;
-            }
-
-            advance();
-        }
-
-        elif = new elifStmt(Cond, elifAssignments);
-        elifStmts.push_back(elif);
-        advance();
+        elifStmts.push_back(Ctx.createAt<elifStmt>(ElifLoc, ElifCond, elifAssignments));
     }
 
     if (Tok.is(Token::KW_else))
     {
-        haveElse = true;
-
         advance();
 
-        if (expect(Token::colon)){
+        if (consume(Token::colon)){
             goto _error;
         }
 
-        advance();
-
-        if (expect(Token::KW_begin)){
+        if (!parseBlock(elseAssignments)){
             goto _error;
         }
-        
-        advance();
-
-        while (!Tok.is(Token::KW_end))
-        {
-            elseAssignment = parseAssign();
-            if(elseAssignment)
-                elseAssignments.push_back(elseAssignment);
-            else
-                goto _error;
-
-            if (expect(Token::semicolon))
-            {
-                goto _error;
-            }
-
-            advance();
-        }
-
     }
 
-
-    return new IfStmt(Cond, ifAssignments, elseAssignments, elifStmts);
+    return Ctx.createAt<IfStmt>(Loc, Cond, ifAssignments, elseAssignments, elifStmts);
 
 _error:
-    while (Tok.getKind() != Token::eoi)
-        advance();
-    return nullptr;
+    skipStatement();
+    // Keep the arms parsed so far, so that Sema still checks them.
+    if (Cond == nullptr)
+        return nullptr;
+    return Ctx.createAt<IfStmt>(Loc, Cond, ifAssignments, elseAssignments, elifStmts);
 }
 
 IterStmt *Parser::parseIter()
 {
     llvm::SmallVector<Assignment *, 8> assignments;
     Logic *Cond;
+    LoopHints Hints;
+    SourceLocation Loc = Tok.getLocation();
+    bool Parallel = Tok.is(Token::KW_parloopc);
 
-    if (expect(Token::KW_loopc)){
+    if (!Tok.isOneOf(Token::KW_loopc, Token::KW_parloopc)){
+        error();
         goto _error;
     }
         
     advance();
 
-    Cond = parseLogic();
-    if (Cond == nullptr)
+    // optional tuning annotations, e.g. loopc unroll(8) vectorize(4) i < n: ...
+    // The hint names are not keywords: they are hints only here, before a
+    // '(', where no variable can stand, and variables elsewhere.
+    while (Tok.is(Token::ident) && peek().is(Token::l_paren) &&
+           (Tok.getText() == "unroll" || Tok.getText() == "vectorize" || Tok.getText() == "interleave"))
     {
-        goto _error;
-    }
-    if(expect(Token::colon)){
-        goto _error;
-    }
-
-    advance();
-
-    if (expect(Token::KW_begin)){
-        goto _error;
-    }
+        llvm::StringRef HintName = Tok.getText();
+        unsigned Count;
 
-    advance();
+        advance();
 
-    while (!Tok.is(Token::KW_end))
-    {
-        Assignment *asgnmnt = parseAssign();
-        if(asgnmnt){
-            assignments.push_back(asgnmnt);
+        if (consume(Token::l_paren)){
+            goto _error;
         }
-        else{
+
+        if (expect(Token::number)){
             goto _error;
         }
-        
-        if (expect(Token::semicolon))
-        {
+
+        if (Tok.getText().getAsInteger(10, Count) || Count == 0){
+            error();
             goto _error;
         }
 
         advance();
+
+        if (consume(Token::r_paren)){
+            goto _error;
+        }
+
+        if (HintName == "unroll")
+            Hints.Unroll = Count;
+        else if (HintName == "vectorize")
+            Hints.VectorizeWidth = Count;
+        else
+            Hints.Interleave = Count;
+    }
+
+    Cond = parseLogic();
+    if (Cond == nullptr)
+    {
+        goto _error;
+    }
+    if (consume(Token::colon)){
+        goto _error;
     }
 
-    return new IterStmt(Cond, assignments);
+    if (!parseBlock(assignments)){
+        goto _error;
+    }
+
+    return Ctx.createAt<IterStmt>(Loc, Cond, assignments, Hints, Parallel);
 
 _error:
-    while (Tok.getKind() != Token::eoi)
-        advance();
+    skipStatement();
     return nullptr;
 }
@@ -7,19 +7,61 @@
 
 class Parser
 {
-    Lexer &Lex;    // retrieve the next token from the input
-    Token Tok;     // stores the next token
-    bool HasError; // indicates if an error was detected
+    Lexer *Lex;               // retrieve the next token from the input, or
+    const TokenBuffer *Toks;  // take it from the tokens lexed up front
+    size_t NextTok;           // index in Toks of the token after Tok
+    ASTContext &Ctx;          // allocates the AST nodes
+    Token Tok;                // stores the next token
+    bool HasError;            // indicates if an error was detected
+    llvm::raw_ostream &Diag;  // where syntax errors are reported
+    const SourceManager *SM;  // locates errors in the input, if given
+    unsigned Depth;           // of the expression or condition parsed last, see MaxExprDepth
+    unsigned IndexNesting;    // array indexes being parsed, one inside the other
 
     void error()
     {
-        llvm::errs() << "Unexpected: " << Tok.getText() << "\n";
+        std::string Message = Tok.is(Token::eoi) ? "Unexpected end of input" : ("Unexpected: " + Tok.getText()).str();
+        if (SM)
+            SM->report(Diag, Tok.getLocation(), Message);
+        else
+            Diag << Message << "\n";
+        HasError = true;
+    }
+
+    // reports an expression nested deeper than MaxExprDepth at Loc
+    void depthError(SourceLocation Loc)
+    {
+        std::string Message = "Expression is nested more than " + std::to_string(MaxExprDepth) + " levels deep";
+        if (SM)
+            SM->report(Diag, Loc, Message);
+        else
+            Diag << Message << "\n";
         HasError = true;
     }
 
     // retrieves the next token from the lexer.expect()
     // tests whether the look-ahead is of the expected kind
-    void advance() { Lex.next(Tok); }
+    void advance()
+    {
+        if (!Toks)
+            Lex->next(Tok);
+        else if (NextTok < Toks->size())
+            Toks->getToken(NextTok++, Tok);
+    }
+
+    // the token after the look-ahead, without consuming either
+    Token peek() const
+    {
+        Token Next = Tok;
+        if (!Toks)
+        {
+            Lexer Ahead = *Lex;
+            Ahead.next(Next);
+        }
+        else if (NextTok < Toks->size())
+            Toks->getToken(NextTok, Next);
+        return Next;
+    }
 
     bool expect(Token::TokenKind Kind)
     {
@@ -44,17 +86,30 @@ class Parser
     Declaration *parseDec();
     Assignment *parseAssign();
     Expr *parseExpr();
-    Expr *parseTerm();
     Expr *parseFinal();
-    Expr *parseFactor();
     Logic *parseLogic();
-    Logic *parseComparison();
     IfStmt *parseIf();
     IterStmt *parseIter();
+    ReadStmt *parseRead();
+    bool parseBlock(llvm::SmallVector<Assignment *, 8> &Body);
+
+    // error recovery, see Parser.cpp
+    void skipStatement();
+    void skipAssignment();
 
 public:
     // initializes all members and retrieves the first token
-    Parser(Lexer &Lex) : Lex(Lex), HasError(false)
+    Parser(Lexer &Lex, ASTContext &Ctx, llvm::raw_ostream &Diag = llvm::errs(), const SourceManager *SM = nullptr)
+        : Lex(&Lex), Toks(nullptr), NextTok(0), Ctx(Ctx), HasError(false), Diag(Diag), SM(SM), Depth(0),
+          IndexNesting(0)
+    {
+        advance();
+    }
+
+    // parses tokens lexed up front
+    Parser(const TokenBuffer &Toks, ASTContext &Ctx, llvm::raw_ostream &Diag = llvm::errs(), const SourceManager *SM = nullptr)
+        : Lex(nullptr), Toks(&Toks), NextTok(0), Ctx(Ctx), HasError(false), Diag(Diag), SM(SM), Depth(0),
+          IndexNesting(0)
     {
         advance();
     }
@@ -0,0 +1,195 @@
+#include "Profile.h"
+#include "ASTPrinter.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+using namespace llvm;
+
+namespace
+prof{
+  // Assigns counters to the control flow statements in program order and
+  // hashes their shape (FNV-1a, so the value is stable between runs).
+  class CounterNumbering : public ASTVisitor
+  {
+    DenseMap<const AST *, unsigned> &First;
+    unsigned &NumCounters;
+    uint64_t &Hash;
+
+    void mix(uint64_t Val)
+    {
+      for (unsigned I = 0; I < 8; ++I, Val >>= 8)
+      {
+        Hash ^= Val & 0xff;
+        Hash *= 0x100000001b3ULL;
+      }
+    }
+
+  public:
+    CounterNumbering(DenseMap<const AST *, unsigned> &First, unsigned &NumCounters, uint64_t &Hash)
+        : First(First), NumCounters(NumCounters), Hash(Hash)
+    {
+      Hash = 0xcbf29ce484222325ULL;
+    }
+
+    virtual void visit(Program &Node) override
+    {
+      for (AST *Stmt : Node)
+        Stmt->accept(*this);
+    }
+
+    virtual void visit(IfStmt &Node) override
+    {
+      unsigned Arms = 1 + (Node.endElif() - Node.beginElif()) + (Node.beginElse() != Node.endElse());
+      First[&Node] = NumCounters;
+      NumCounters += 1 + Arms;
+
+      mix('I');
+      mix(Arms);
+      mix(Node.end() - Node.begin());
+      for (auto I = Node.beginElif(), E = Node.endElif(); I != E; ++I)
+        mix((*I)->end() - (*I)->begin());
+      mix(Node.endElse() - Node.beginElse());
+    }
+
+    virtual void visit(IterStmt &Node) override
+    {
+      First[&Node] = NumCounters;
+      NumCounters += ProfileLayout::NumLoopCounters;
+
+      mix(Node.isParallel() ? 'P' : 'L');
+      mix(Node.end() - Node.begin());
+    }
+
+    virtual void visit(Final &) override {}
+    virtual void visit(BinaryOp &) override {}
+    virtual void visit(Assignment &) override {}
+    virtual void visit(Declaration &) override {}
+    virtual void visit(Comparison &) override {}
+    virtual void visit(LogicalExpr &) override {}
+    virtual void visit(elifStmt &) override {}
+    virtual void visit(ArrayElement &) override {}
+    virtual void visit(ArrayReduce &) override {}
+    virtual void visit(ReadStmt &) override {}
+  };
+
+  // Fills a StmtTable by walking the statements in source order.
+  class StmtCollector : public ASTVisitor
+  {
+    std::vector<StmtTable::Entry> &Entries;
+    DenseMap<const AST *, unsigned> &Index;
+    unsigned Depth = 0;
+
+    void add(AST *Stmt, StringRef Text, StmtTable::EntryKind Kind)
+    {
+      if (Stmt)
+        Index[Stmt] = Entries.size();
+      Entries.push_back({std::string(2 * Depth, ' ') + Text.str(), Kind});
+    }
+
+    template <typename It> void body(It Begin, It End)
+    {
+      ++Depth;
+      for (; Begin != End; ++Begin)
+        (*Begin)->accept(*this);
+      --Depth;
+    }
+
+  public:
+    StmtCollector(std::vector<StmtTable::Entry> &Entries, DenseMap<const AST *, unsigned> &Index)
+        : Entries(Entries), Index(Index) {}
+
+    virtual void visit(Program &Node) override
+    {
+      for (AST *Stmt : Node)
+        Stmt->accept(*this);
+    }
+
+    virtual void visit(Assignment &Node) override { add(&Node, printStmtHeader(&Node), StmtTable::Stmt); }
+    virtual void visit(Declaration &Node) override { add(&Node, printStmtHeader(&Node), StmtTable::Stmt); }
+    virtual void visit(ReadStmt &Node) override { add(&Node, printStmtHeader(&Node), StmtTable::Stmt); }
+
+    virtual void visit(IfStmt &Node) override
+    {
+      add(&Node, printStmtHeader(&Node), StmtTable::Stmt);
+      body(Node.begin(), Node.end());
+      for (auto I = Node.beginElif(), E = Node.endElif(); I != E; ++I)
+      {
+        add(nullptr, printStmtHeader(*I), StmtTable::Label);
+        body((*I)->begin(), (*I)->end());
+      }
+      if (Node.beginElse() != Node.endElse())
+      {
+        add(nullptr, "else:", StmtTable::Label);
+        body(Node.beginElse(), Node.endElse());
+      }
+    }
+
+    virtual void visit(IterStmt &Node) override
+    {
+      add(&Node, printStmtHeader(&Node), StmtTable::Loop);
+      body(Node.begin(), Node.end());
+    }
+
+    virtual void visit(Final &) override {}
+    virtual void visit(BinaryOp &) override {}
+    virtual void visit(Comparison &) override {}
+    virtual void visit(LogicalExpr &) override {}
+    virtual void visit(elifStmt &) override {}
+    virtual void visit(ArrayElement &) override {}
+    virtual void visit(ArrayReduce &) override {}
+  };
+}; // namespace
+
+ProfileLayout::ProfileLayout(Program *Tree)
+{
+  prof::CounterNumbering Numbering(First, NumCounters, Hash);
+  Tree->accept(Numbering);
+}
+
+StmtTable::StmtTable(Program *Tree)
+{
+  prof::StmtCollector Collector(Entries, Index);
+  Tree->accept(Collector);
+}
+
+bool readProfile(StringRef Path, ProfileData &Data, raw_ostream &Diag)
+{
+  auto Buffer = MemoryBuffer::getFile(Path);
+  if (!Buffer)
+  {
+    Diag << "Error: cannot read profile " << Path << ": " << Buffer.getError().message() << "\n";
+    return false;
+  }
+
+  // A header line "<hash> <count>" followed by one count per line; lines
+  // starting with '#' are comments.
+  SmallVector<StringRef, 64> Lines;
+  (*Buffer)->getBuffer().split(Lines, '\n', -1, false);
+  bool HaveHeader = false;
+  unsigned Expected = 0;
+  Data.Counts.clear();
+  for (StringRef Line : Lines)
+  {
+    Line = Line.trim();
+    if (Line.empty() || Line.startswith("#"))
+      continue;
+    if (!HaveHeader)
+    {
+      std::pair<StringRef, StringRef> Fields = Line.split(' ');
+      if (Fields.first.getAsInteger(16, Data.Hash) || Fields.second.trim().getAsInteger(10, Expected))
+        break;
+      HaveHeader = true;
+      continue;
+    }
+    uint64_t Count;
+    if (Line.getAsInteger(10, Count))
+      break;
+    Data.Counts.push_back(Count);
+  }
+
+  if (!HaveHeader || Data.Counts.size() != Expected)
+  {
+    Diag << "Error: malformed profile " << Path << "\n";
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,80 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "AST.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// ProfileLayout numbers the execution counters of a program. An if statement
+// gets one counter for reaching it and one per arm (if, each elif, else). A
+// loop gets the counters listed in LoopCounter. The hash identifies the
+// control flow structure, so a profile is never applied to another program.
+class ProfileLayout
+{
+  llvm::DenseMap<const AST *, unsigned> First;
+  unsigned NumCounters = 0;
+  uint64_t Hash = 0;
+
+public:
+  enum LoopCounter
+  {
+    LoopEntered,  // the guard let execution into the body
+    LoopSkipped,  // the guard skipped the loop
+    LoopBackEdge, // the latch went around again
+    NumLoopCounters
+  };
+
+  explicit ProfileLayout(Program *Tree);
+
+  // Index of the first counter of an if statement or loop.
+  unsigned counterFor(const AST *Stmt) const { return First.lookup(Stmt); }
+  unsigned size() const { return NumCounters; }
+  uint64_t hash() const { return Hash; }
+};
+
+// StmtTable lists the lines of the -fexec-profile report in source order:
+// every statement, indented by its nesting, and the elif and else lines of
+// if statements.
+class StmtTable
+{
+public:
+  enum EntryKind : uint8_t
+  {
+    Stmt,  // counted each time it runs
+    Loop,  // counted when reached; its cycles can be measured too
+    Label  // an elif or else line, which has no counter of its own
+  };
+
+  struct Entry
+  {
+    std::string Text;
+    EntryKind Kind;
+  };
+
+  explicit StmtTable(Program *Tree);
+
+  unsigned indexOf(const AST *Stmt) const { return Index.lookup(Stmt); }
+  llvm::ArrayRef<Entry> entries() const { return Entries; }
+
+private:
+  std::vector<Entry> Entries;
+  llvm::DenseMap<const AST *, unsigned> Index;
+};
+
+// Counts of a program run, as written by compiler_profile_dump.
+struct ProfileData
+{
+  uint64_t Hash = 0;
+  std::vector<uint64_t> Counts;
+};
+
+// Read a profile written by an instrumented program. Returns false and
+// reports to Diag if the file cannot be read or parsed.
+bool readProfile(llvm::StringRef Path, ProfileData &Data, llvm::raw_ostream &Diag);
+
+#endif
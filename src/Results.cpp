@@ -0,0 +1,38 @@
+#include "Results.h"
+#include "rtCompiler.h"
+#include "llvm/Support/EndianStream.h"
+
+using namespace llvm;
+
+void writeResultsHeader(raw_ostream &OS, ArrayRef<StringRef> Names)
+{
+  support::endian::Writer Out(OS, support::little);
+  Out.write<uint32_t>(ResultsMagic);
+  Out.write<uint32_t>(ResultsVersion);
+  Out.write<uint32_t>(Names.size());
+  for (StringRef Name : Names)
+  {
+    Out.write<uint32_t>(Name.size());
+    OS << Name;
+    OS.write_zeros(-Name.size() & 3);
+  }
+}
+
+void writeResult(raw_ostream &OS, ResultFormat F, uint32_t Var, int32_t V)
+{
+  support::endian::Writer Out(OS, support::little);
+  switch (F)
+  {
+  case ResultFormat::Text:
+    OS << COMPILER_RESULT_PREFIX << V << "\n";
+    break;
+  case ResultFormat::Raw:
+    Out.write<int32_t>(V);
+    break;
+  case ResultFormat::Records:
+    Out.write<uint32_t>(8);
+    Out.write<uint32_t>(Var);
+    Out.write<int32_t>(V);
+    break;
+  }
+}
@@ -0,0 +1,36 @@
+#ifndef RESULTS_H
+#define RESULTS_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstdint>
+
+// How a program writes its results: a value per assignment outside of
+// parloopc bodies, and the final values of the variables a parloopc assigns.
+//
+// Raw is the values alone, as little-endian int32s. Records starts with a
+// header: magic "SRES", version, number of variables, then each variable
+// name as its length and its bytes, padded with zeros to a multiple of 4.
+// Every value follows as a record: the length of the rest of the record (8),
+// the ID of the variable, its index in the header, and the value. All words
+// are little-endian 32-bit, so the stream can be mapped and walked in place.
+// A variable's ID is its position among the declared ints and arrays, in
+// declaration order.
+enum class ResultFormat
+{
+  Text,   // "The result is: V" lines
+  Raw,    // int32 values
+  Records // a header, then tagged values
+};
+
+const uint32_t ResultsMagic = 0x53455253; // "SRES"
+const uint32_t ResultsVersion = 1;
+
+// Write the header of a Records stream for the variables Names.
+void writeResultsHeader(llvm::raw_ostream &OS, llvm::ArrayRef<llvm::StringRef> Names);
+
+// Write the value V of the variable with the ID Var in format F.
+void writeResult(llvm::raw_ostream &OS, ResultFormat F, uint32_t Var, int32_t V);
+
+#endif
@@ -0,0 +1,176 @@
+#include "Runtime.h"
+#include "rtCompiler.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/Transforms/IPO/Internalize.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+
+using namespace llvm;
+
+namespace rt
+{
+  // Builds the functions of the runtime module one by one.
+  class RuntimeBuilder
+  {
+    Module *M;
+    IRBuilder<> Builder;
+    Type *VoidTy;
+    Type *Int8Ty;
+    Type *Int32Ty;
+    Type *SizeTy;
+    Type *Int8PtrTy;
+
+    // The buffer protocol of rtCompiler.h.
+    static const unsigned BufferSize = COMPILER_OUTPUT_BUFFER;
+    static const unsigned MaxLine = COMPILER_MAX_LINE;
+
+    GlobalVariable *Buffer;    // formatted output not yet written
+    GlobalVariable *Pos;       // number of bytes used in Buffer
+    GlobalVariable *Prefix;    // COMPILER_RESULT_PREFIX
+    Function *FlushFn;
+
+    Value *bufferAt(Value *Offset)
+    {
+      return Builder.CreateInBoundsGEP(Buffer->getValueType(), Buffer, {Builder.getInt32(0), Offset});
+    }
+
+  public:
+    RuntimeBuilder(Module *M) : M(M), Builder(M->getContext())
+    {
+      VoidTy = Builder.getVoidTy();
+      Int8Ty = Builder.getInt8Ty();
+      Int32Ty = Builder.getInt32Ty();
+      SizeTy = M->getDataLayout().getIntPtrType(M->getContext());
+      Int8PtrTy = Builder.getInt8PtrTy();
+
+      ArrayType *BufferTy = ArrayType::get(Int8Ty, BufferSize);
+      Buffer = new GlobalVariable(*M, BufferTy, false, GlobalValue::InternalLinkage,
+                                  ConstantAggregateZero::get(BufferTy), "compiler.outbuf");
+      Pos = new GlobalVariable(*M, Int32Ty, false, GlobalValue::InternalLinkage,
+                               Builder.getInt32(0), "compiler.outpos");
+      Constant *PrefixStr = ConstantDataArray::getString(M->getContext(), COMPILER_RESULT_PREFIX, false);
+      Prefix = new GlobalVariable(*M, PrefixStr->getType(), true, GlobalValue::PrivateLinkage,
+                                  PrefixStr, "compiler.prefix");
+      Prefix->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+    }
+
+    // void compiler_flush(): write the buffer to stdout and empty it.
+    void buildFlush()
+    {
+      FunctionType *WriteTy = FunctionType::get(SizeTy, {Int32Ty, Int8PtrTy, SizeTy}, false);
+      FunctionCallee WriteFn = M->getOrInsertFunction("write", WriteTy);
+
+      FlushFn = Function::Create(FunctionType::get(VoidTy, false), GlobalValue::ExternalLinkage, "compiler_flush", M);
+      FlushFn->addFnAttr(Attribute::NoInline);
+      FlushFn->addFnAttr(Attribute::Cold);
+
+      BasicBlock *Entry = BasicBlock::Create(M->getContext(), "entry", FlushFn);
+      BasicBlock *Loop = BasicBlock::Create(M->getContext(), "loop", FlushFn);
+      BasicBlock *Body = BasicBlock::Create(M->getContext(), "body", FlushFn);
+      BasicBlock *Exit = BasicBlock::Create(M->getContext(), "exit", FlushFn);
+
+      Builder.SetInsertPoint(Entry);
+      Value *Size = Builder.CreateZExt(Builder.CreateLoad(Int32Ty, Pos), SizeTy);
+      Builder.CreateBr(Loop);
+
+      // write(2) may write less than asked for; retry until done or failed.
+      Builder.SetInsertPoint(Loop);
+      PHINode *Done = Builder.CreatePHI(SizeTy, 2);
+      Done->addIncoming(ConstantInt::get(SizeTy, 0), Entry);
+      Builder.CreateCondBr(Builder.CreateICmpULT(Done, Size), Body, Exit);
+
+      Builder.SetInsertPoint(Body);
+      Value *Written = Builder.CreateCall(WriteFn, {Builder.getInt32(1), bufferAt(Done), Builder.CreateSub(Size, Done)});
+      Done->addIncoming(Builder.CreateAdd(Done, Written), Body);
+      Builder.CreateCondBr(Builder.CreateICmpSGT(Written, ConstantInt::get(SizeTy, 0)), Loop, Exit);
+
+      Builder.SetInsertPoint(Exit);
+      Builder.CreateStore(Builder.getInt32(0), Pos);
+      Builder.CreateRetVoid();
+
+      // Flush whatever is left when the program exits.
+      appendToGlobalDtors(*M, FlushFn, 65535);
+    }
+
+    // void compiler_write(i32 V): append "The result is: V\n" to the buffer.
+    void buildWrite()
+    {
+      Function *WriteFn = Function::Create(FunctionType::get(VoidTy, {Int32Ty}, false), GlobalValue::ExternalLinkage, "compiler_write", M);
+      WriteFn->addFnAttr(Attribute::InlineHint);
+      WriteFn->addFnAttr(Attribute::NoUnwind);
+
+      BasicBlock *Entry = BasicBlock::Create(M->getContext(), "entry", WriteFn);
+      BasicBlock *Flush = BasicBlock::Create(M->getContext(), "flush", WriteFn);
+      BasicBlock *Format = BasicBlock::Create(M->getContext(), "format", WriteFn);
+      BasicBlock *Digits = BasicBlock::Create(M->getContext(), "digits", WriteFn);
+      BasicBlock *Done = BasicBlock::Create(M->getContext(), "done", WriteFn);
+
+      Builder.SetInsertPoint(Entry);
+      Value *V = WriteFn->getArg(0);
+      ArrayType *TmpTy = ArrayType::get(Int8Ty, 10);
+      AllocaInst *Tmp = Builder.CreateAlloca(TmpTy);
+      Value *Full = Builder.CreateICmpUGT(Builder.CreateLoad(Int32Ty, Pos), Builder.getInt32(BufferSize - MaxLine));
+      Builder.CreateCondBr(Full, Flush, Format);
+
+      Builder.SetInsertPoint(Flush);
+      Builder.CreateCall(FlushFn);
+      Builder.CreateBr(Format);
+
+      // Copy the prefix and a '-' that is kept only for negative values.
+      Builder.SetInsertPoint(Format);
+      Value *Start = Builder.CreateLoad(Int32Ty, Pos);
+      uint64_t PrefixLen = Prefix->getValueType()->getArrayNumElements();
+      Builder.CreateMemCpy(bufferAt(Start), MaybeAlign(1), Prefix, MaybeAlign(1), PrefixLen);
+      Value *SignPos = Builder.CreateAdd(Start, Builder.getInt32(PrefixLen));
+      Builder.CreateStore(Builder.getInt8('-'), bufferAt(SignPos));
+      Value *IsNeg = Builder.CreateICmpSLT(V, Builder.getInt32(0));
+      Value *Abs = Builder.CreateSelect(IsNeg, Builder.CreateSub(Builder.getInt32(0), V), V);
+      Value *DigitPos = Builder.CreateAdd(SignPos, Builder.CreateZExt(IsNeg, Int32Ty));
+      Builder.CreateBr(Digits);
+
+      // Produce the digits backwards into Tmp.
+      Builder.SetInsertPoint(Digits);
+      PHINode *I = Builder.CreatePHI(Int32Ty, 2);
+      PHINode *U = Builder.CreatePHI(Int32Ty, 2);
+      I->addIncoming(Builder.getInt32(10), Format);
+      U->addIncoming(Abs, Format);
+      Value *Q = Builder.CreateUDiv(U, Builder.getInt32(10));
+      Value *Digit = Builder.CreateSub(U, Builder.CreateMul(Q, Builder.getInt32(10)));
+      Value *Next = Builder.CreateSub(I, Builder.getInt32(1));
+      Value *Slot = Builder.CreateInBoundsGEP(TmpTy, Tmp, {Builder.getInt32(0), Next});
+      Builder.CreateStore(Builder.CreateAdd(Builder.CreateTrunc(Digit, Int8Ty), Builder.getInt8('0')), Slot);
+      I->addIncoming(Next, Digits);
+      U->addIncoming(Q, Digits);
+      Builder.CreateCondBr(Builder.CreateICmpNE(Q, Builder.getInt32(0)), Digits, Done);
+
+      Builder.SetInsertPoint(Done);
+      Value *Len = Builder.CreateSub(Builder.getInt32(10), Next);
+      Builder.CreateMemCpy(bufferAt(DigitPos), MaybeAlign(1), Slot, MaybeAlign(1), Builder.CreateZExt(Len, SizeTy));
+      Value *NewlinePos = Builder.CreateAdd(DigitPos, Len);
+      Builder.CreateStore(Builder.getInt8('\n'), bufferAt(NewlinePos));
+      Builder.CreateStore(Builder.CreateAdd(NewlinePos, Builder.getInt32(1)), Pos);
+      Builder.CreateRetVoid();
+    }
+  };
+} // namespace rt
+
+std::unique_ptr<Module> buildRuntimeModule(const Module &Program)
+{
+  auto M = std::make_unique<Module>("compiler-runtime", Program.getContext());
+  M->setTargetTriple(Program.getTargetTriple());
+  M->setDataLayout(Program.getDataLayout());
+  rt::RuntimeBuilder RB(M.get());
+  RB.buildFlush();
+  RB.buildWrite();
+  return M;
+}
+
+bool linkRuntime(Module &M)
+{
+  if (Linker::linkModules(M, buildRuntimeModule(M)))
+    return false;
+  // compiler_flush stays visible, so that the input functions of
+  // rtCompiler.c write out the results before they prompt or fail.
+  internalizeModule(M, [](const GlobalValue &GV) { return GV.getName() == "main" || GV.getName() == "compiler_flush"; });
+  return true;
+}
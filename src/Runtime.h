@@ -0,0 +1,19 @@
+#ifndef RUNTIME_H
+#define RUNTIME_H
+
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include <memory>
+
+// Build the runtime of the generated code as an IR module, so it can be
+// linked into programs and inlined. It provides the same compiler_write as
+// rtCompiler.c, formatting into the buffer described in rtCompiler.h, which
+// is flushed with write(2) when full and at exit. The module is laid out for the target of Program.
+std::unique_ptr<llvm::Module> buildRuntimeModule(const llvm::Module &Program);
+
+// Link the runtime into M and internalize everything except main and
+// compiler_flush, so the optimizer sees every function body. Returns false
+// on failure.
+bool linkRuntime(llvm::Module &M);
+
+#endif
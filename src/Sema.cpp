@@ -1,28 +1,123 @@
 #include "Sema.h"
-#include "llvm/ADT/StringSet.h"
+#include "ParallelLoop.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/MathExtras.h"
 #include "llvm/Support/raw_ostream.h"
-
+#include <algorithm>
+#include <cstdint>
+#include <vector>
 
 namespace nms{
+// Finds out whether an expression is a Final, since the AST has no RTTI.
+class FinalMatcher : public ASTVisitor {
+public:
+  Final *Match = nullptr;
+
+  virtual void visit(Final &Node) override { Match = &Node; }
+  virtual void visit(BinaryOp &) override {}
+  virtual void visit(Assignment &) override {}
+  virtual void visit(Declaration &) override {}
+  virtual void visit(Comparison &) override {}
+  virtual void visit(LogicalExpr &) override {}
+  virtual void visit(IfStmt &) override {}
+  virtual void visit(IterStmt &) override {}
+  virtual void visit(elifStmt &) override {}
+  virtual void visit(ArrayElement &) override {}
+  virtual void visit(ArrayReduce &) override {}
+  virtual void visit(ReadStmt &) override {}
+};
+
+// Returns E as a Final, or nullptr if it is another kind of expression.
+static Final *asFinal(Expr *E) {
+  FinalMatcher M;
+  if (E)
+    E->accept(M);
+  return M.Match;
+}
+
 class InputCheck : public ASTVisitor {
-  llvm::StringSet<> Scope; // StringSet to store declared variables
+  llvm::StringMap<unsigned> Scope; // declared variables, with their numbers of elements (0 for an int)
+  unsigned ElementwiseSize = 0; // of the destination of the whole-array assignment being checked
+  llvm::StringRef ElementwiseDest;
   bool HasError; // Flag to indicate if an error occurred
+  llvm::raw_ostream &Diag; // Stream the errors are reported to
+  const SourceManager *SM; // Locates the errors in the source, if given
+
+  static const unsigned MaxArraySize = 1 << 24; // elements, so that the bytes of an array fit in an int
 
   enum ErrorType { Twice, Not }; // Enum to represent error types: Twice - variable declared twice, Not - variable not declared
 
-  void error(ErrorType ET, llvm::StringRef V) {
+  // Report Message at Loc and set the error flag.
+  void report(SourceLocation Loc, const llvm::Twine &Message) {
+    if (SM)
+      SM->report(Diag, Loc, Message);
+    else
+      Diag << Message << "\n";
+    HasError = true;
+  }
+
+  void error(ErrorType ET, llvm::StringRef V, SourceLocation Loc) {
     // Function to report errors
-    llvm::errs() << "Variable " << V << " is "
-                 << (ET == Twice ? "already" : "not")
-                 << " declared\n";
-    HasError = true; // Set error flag to true
+    report(Loc, "Variable " + V + " is " + (ET == Twice ? "already" : "not") + " declared");
+  }
+
+  // Look up a variable, reporting it if it is not declared, or if it is an
+  // int where an array is needed. Returns its number of elements, 0 for an
+  // int.
+  unsigned lookup(llvm::StringRef V, SourceLocation Loc, bool NeedsArray) {
+    auto It = Scope.find(V);
+    if (It == Scope.end()) {
+      error(Not, V, Loc);
+      return 0;
+    }
+    if (NeedsArray && !It->second)
+      report(Loc, "Variable " + V + " is not an array.");
+    return It->second;
+  }
+
+  // Check the index of an element, in which arrays need indexes of their own.
+  void checkIndex(Expr *Index) {
+    unsigned WasSize = ElementwiseSize;
+    ElementwiseSize = 0;
+    Index->accept(*this);
+    ElementwiseSize = WasSize;
   }
 
 public:
-  InputCheck() : HasError(false) {} // Constructor
+  InputCheck(llvm::raw_ostream &Diag, const SourceManager *SM) : HasError(false), Diag(Diag), SM(SM) {} // Constructor
 
   bool hasError() { return HasError; } // Function to check if an error occurred
 
+  // Check a statement that passed before by its names alone. Returns false,
+  // without changing the scope, if it has to be checked in full to report
+  // what is wrong.
+  bool checkNames(const CheckedStmt &Stmt) {
+    if (Stmt.IndexesArrays)
+      return false;
+    for (llvm::StringRef Var : Stmt.Decls)
+      if (Scope.count(Var))
+        return false;
+    // Arrays are only allowed in some places, which their names do not tell.
+    for (llvm::StringRef Var : Stmt.Uses) {
+      auto It = Scope.find(Var);
+      auto Decl = llvm::find(Stmt.Decls, Var);
+      if (It != Scope.end() ? It->second != 0
+                            : Decl == Stmt.Decls.end() || Stmt.DeclSizes[Decl - Stmt.Decls.begin()] != 0)
+        return false;
+    }
+    for (size_t I = 0, E = Stmt.Decls.size(); I != E; ++I)
+      Scope.try_emplace(Stmt.Decls[I], Stmt.DeclSizes[I]);
+    return true;
+  }
+
+  void checkProgram(Program &Node, llvm::ArrayRef<const CheckedStmt *> Checked) {
+    for (size_t I = 0, E = Node.end() - Node.begin(); I != E; ++I)
+      if (!Checked[I] || !checkNames(*Checked[I]))
+        Node.begin()[I]->accept(*this);
+  }
+
   // Visit function for Program nodes
   virtual void visit(Program &Node) override { 
 
@@ -39,44 +134,68 @@ public:
   // Visit function for Final nodes
   virtual void visit(Final &Node) override {
     if (Node.getKind() == Final::Ident) {
-      // Check if identifier is in the scope
-      if (Scope.find(Node.getVal()) == Scope.end())
-        error(Not, Node.getVal());
+      // Check if identifier is in the scope. An array without an index
+      // stands for its elements in a whole-array assignment.
+      unsigned Size = lookup(Node.getVal(), Node.getLoc(), false);
+      if (Size && !ElementwiseSize)
+        report(Node.getLoc(), "Array " + Node.getVal() + " needs an index here.");
+      else if (Size && Size != ElementwiseSize)
+        report(Node.getLoc(), "Array " + Node.getVal() + " has " + llvm::Twine(Size) + " elements, but " +
+                                  ElementwiseDest + " has " + llvm::Twine(ElementwiseSize) + ".");
+    } else {
+      // Every backend takes numbers as 32-bit ints.
+      int32_t Val;
+      if (Node.getVal().getAsInteger(10, Val))
+        report(Node.getLoc(), "The number " + Node.getVal() + " does not fit in an int.");
     }
   };
 
-  // Visit function for BinaryOp nodes
+  virtual void visit(ArrayElement &Node) override {
+    lookup(Node.getArray(), Node.getLoc(), true);
+    checkIndex(Node.getIndex());
+  }
+
+  virtual void visit(ArrayReduce &Node) override {
+    lookup(Node.getArray(), Node.getLoc(), true);
+  }
+
+  // Visit function for BinaryOp nodes, which checks the operations down the
+  // left spine in a loop, innermost first
   virtual void visit(BinaryOp &Node) override {
-    Expr* right = Node.getRight();
-    if (Node.getLeft())
-      Node.getLeft()->accept(*this);
+    llvm::SmallVector<BinaryOp *, 16> Spine = leftSpine(Node);
+    if (Spine.front()->getLeft())
+      Spine.front()->getLeft()->accept(*this);
     else
       HasError = true;
+    for (BinaryOp *Op : Spine)
+      checkOperation(*Op);
+  }
 
+  // Check the right-hand side of Node and the operation itself
+  void checkOperation(BinaryOp &Node) {
+    Expr* right = Node.getRight();
     if (right)
       right->accept(*this);
     else
       HasError = true;
 
     if (Node.getOperator() == BinaryOp::Operator::Div || Node.getOperator() == BinaryOp::Operator::Mod ) {
-      Final* f = (Final*)right;
+      Final* f = asFinal(right);
 
-      if (f->getKind() == Final::ValueKind::Number) {
+      if (f && f->getKind() == Final::ValueKind::Number) {
         llvm::StringRef intval = f->getVal();
 
         if (intval == "0") {
-          llvm::errs() << "Division by zero is not allowed." << "\n";
-          HasError = true;
+          report(Node.getLoc(), "Division by zero is not allowed.");
         }
       }
     }
 
     if (Node.getOperator() == BinaryOp::Operator::Exp ) {
-      Final* f = (Final*)right;
+      Final* f = asFinal(right);
 
-      if (f->getKind() == Final::ValueKind::Ident) {
-        llvm::errs() << "The exponent only allowed to be a constant.\n";
-        HasError = true;
+      if (f && f->getKind() == Final::ValueKind::Ident) {
+        report(Node.getLoc(), "The exponent only allowed to be a constant.");
       }
     }
   };
@@ -84,32 +203,41 @@ public:
   // Visit function for Assignment nodes
   virtual void visit(Assignment &Node) override {
     Final *dest = Node.getLeft();
-
-    dest->accept(*this);
+    unsigned Size = 0;
 
     if (dest->getKind() == Final::Number) {
-        llvm::errs() << "Assignment destination must be an identifier.";
-        HasError = true;
+        report(dest->getLoc(), "Assignment destination must be an identifier.");
+    }
+    else {
+      Size = lookup(dest->getVal(), dest->getLoc(), Node.getIndex() != nullptr);
+      if (Node.getIndex())
+        checkIndex(Node.getIndex());
     }
 
+    // Without an index, an array is assigned element by element.
     Expr *Right = Node.getRight();
-    if (Right)
+    if (Right) {
+      if (!Node.getIndex()) {
+        ElementwiseSize = Size;
+        ElementwiseDest = dest->getVal();
+      }
       Right->accept(*this);
+      ElementwiseSize = 0;
+    }
     else{
       HasError=true;
     }
 
     if (Node.getAssignKind() == Assignment::AssignKind::Slash_assign || Node.getAssignKind() == Assignment::AssignKind::Mod_assign) {
 
-      Final* f = (Final*)(Right);
+      Final* f = asFinal(Right);
       if (f)
       {
         if (f->getKind() == Final::ValueKind::Number) {
         llvm::StringRef intval = f->getVal();
 
         if (intval == "0") {
-          llvm::errs() << "Division by zero is not allowed." << "\n";
-          HasError = true;
+          report(Node.getLoc(), "Division by zero is not allowed.");
         }
         }
       }
@@ -118,16 +246,27 @@ public:
   };
 
   virtual void visit(Declaration &Node) override {
+    size_t N = 0;
     for (llvm::SmallVector<llvm::StringRef, 8>::const_iterator I = Node.varBegin(), E = Node.varEnd(); I != E;
-         ++I) {
-      if (!Scope.insert(*I).second)
-        error(Twice, *I); // If the insertion fails (element already exists in Scope), report a "Twice" error
+         ++I, ++N) {
+      SourceLocation Loc = SM ? SM->getLocation(I->data()) : SourceLocation();
+      if (!Scope.try_emplace(*I, Node.getSize(N)).second)
+        error(Twice, *I, Loc); // If the insertion fails (element already exists in Scope), report a "Twice" error
+      else if (Node.getSize(N) > MaxArraySize)
+        report(Loc, "Array " + *I + " is too large; it can have at most " + llvm::Twine(MaxArraySize) +
+                        " elements.");
     }
     for (llvm::SmallVector<Expr *, 8>::const_iterator I = Node.valBegin(), E = Node.valEnd(); I != E; ++I){
       (*I)->accept(*this); // If the Declaration node has an expression, recursively visit the expression node
     }
   };
 
+  // An array is read whole, one value per element.
+  virtual void visit(ReadStmt &Node) override {
+    for (Final *Var : llvm::make_range(Node.varBegin(), Node.varEnd()))
+      lookup(Var->getVal(), Var->getLoc(), false);
+  }
+
   virtual void visit(Comparison &Node) override {
     if(Node.getLeft()){
       Node.getLeft()->accept(*this);
@@ -174,19 +313,546 @@ public:
     Logic* l = Node.getCond();
     (*l).accept(*this);
 
+    // the vectorizer only handles power-of-two widths
+    unsigned Width = Node.getHints().VectorizeWidth;
+    if (Width && !llvm::isPowerOf2_32(Width)) {
+      report(Node.getLoc(), "Vectorize width must be a power of two.");
+    }
+
+    // the iterations of a parloopc have to be independent
+    if (Node.isParallel()) {
+      ParallelLoop Shape;
+      std::string Error;
+      SourceLocation Loc;
+      auto IsArray = [this](llvm::StringRef V) { return Scope.lookup(V) != 0; };
+      if (!matchParallelLoop(&Node, Shape, IsArray, Error, Loc))
+        report(Loc, Error);
+    }
+
     for (llvm::SmallVector<Assignment *, 8>::const_iterator I = Node.begin(), E = Node.end(); I != E; ++I) {
       (*I)->accept(*this);
     }
   };
 
 };
+
+// An interval of values for RangeCheck. The bounds have 64 bits, so the
+// exact result of an operation on two ints always fits in them.
+struct Interval {
+  int64_t Lo, Hi;
+
+  static Interval full() { return {INT32_MIN, INT32_MAX}; }
+  static Interval empty() { return {1, 0}; }
+  static Interval of(int64_t V) { return {V, V}; }
+
+  bool isEmpty() const { return Lo > Hi; }
+  bool isConstant() const { return Lo == Hi; }
+  bool operator==(const Interval &O) const { return Lo == O.Lo && Hi == O.Hi; }
+  bool contains(const Interval &O) const { return O.isEmpty() || (Lo <= O.Lo && O.Hi <= Hi); }
+
+  Interval meet(const Interval &O) const { return {std::max(Lo, O.Lo), std::min(Hi, O.Hi)}; }
+  Interval join(const Interval &O) const {
+    if (isEmpty())
+      return O;
+    if (O.isEmpty())
+      return *this;
+    return {std::min(Lo, O.Lo), std::max(Hi, O.Hi)};
+  }
+};
+
+// The ranges of all variables at a point of the program. An unreachable
+// state is the bottom of the lattice.
+struct RangeState {
+  bool Reachable = true;
+  std::vector<Interval> Vars; // by slot, see RangeCheck::Slots
+
+  static RangeState unreachable() {
+    RangeState S;
+    S.Reachable = false;
+    return S;
+  }
+
+  void join(const RangeState &O) {
+    if (!O.Reachable)
+      return;
+    if (!Reachable) {
+      *this = O;
+      return;
+    }
+    for (size_t I = 0, E = Vars.size(); I != E; ++I)
+      Vars[I] = Vars[I].join(O.Vars[I]);
+  }
+
+  // Join O, moving every bound that grew to the end of the int range, so
+  // that loops reach their fixed point in a few rounds.
+  void widen(const RangeState &O) {
+    if (!O.Reachable)
+      return;
+    if (!Reachable) {
+      *this = O;
+      return;
+    }
+    for (size_t I = 0, E = Vars.size(); I != E; ++I) {
+      if (O.Vars[I].Lo < Vars[I].Lo)
+        Vars[I].Lo = INT32_MIN;
+      if (O.Vars[I].Hi > Vars[I].Hi)
+        Vars[I].Hi = INT32_MAX;
+    }
+  }
+
+  bool contains(const RangeState &O) const {
+    if (!O.Reachable)
+      return true;
+    if (!Reachable)
+      return false;
+    for (size_t I = 0, E = Vars.size(); I != E; ++I)
+      if (!Vars[I].contains(O.Vars[I]))
+        return false;
+    return true;
+  }
+};
+
+// RangeCheck runs an interval analysis over a program that passed
+// InputCheck. It follows the values of the variables through the branches
+// of if statements and to the fixed point of loops, narrowed by the
+// conditions. Operations that always divide by zero or always overflow are
+// errors. Every expression gets the range of values it takes, for CodeGen.
+//
+// Overflow is undefined, as in the nsw arithmetic of CodeGen, so the range
+// of a result that may overflow is the part of it that fits in an int.
+class RangeCheck : public ASTVisitor {
+  llvm::raw_ostream &Diag;
+  const SourceManager *SM;
+  bool HasError = false;
+  llvm::SmallPtrSet<const AST *, 4> Reported; // loop conditions are evaluated twice
+
+  llvm::StringMap<unsigned> Slots; // of the variables in RangeState::Vars
+  llvm::StringMap<unsigned> Arrays; // numbers of elements; their values are not followed
+  RangeState Cur;
+  Interval Val = Interval::empty(); // of the expression just visited
+
+  // Ranges are recorded and errors reported in the states the program can
+  // be in, not in the rounds towards the fixed point of a loop.
+  bool Recording = true;
+  // Conditions narrow Cur to the states where they are Truth, rather than
+  // being evaluated.
+  bool Refining = false;
+  bool Truth = true;
+
+  void report(const AST &Node, const llvm::Twine &Message) {
+    if (!Recording || !Reported.insert(&Node).second)
+      return;
+    if (SM)
+      SM->report(Diag, Node.getLoc(), Message);
+    else
+      Diag << Message << "\n";
+    HasError = true;
+  }
+
+  void record(Expr &Node, Interval I) {
+    if (!Recording || I.isEmpty())
+      return;
+    ValueRange R = Node.getRange();
+    if (R.isKnown())
+      I = I.join({R.Lo, R.Hi});
+    Node.setRange({int32_t(I.Lo), int32_t(I.Hi)});
+  }
+
+  Interval eval(Expr *E) {
+    E->accept(*this);
+    return Val;
+  }
+
+  Interval *slotOf(Expr *E) {
+    Final *F = asFinal(E);
+    if (!F || F->getKind() != Final::Ident)
+      return nullptr;
+    auto It = Slots.find(F->getVal());
+    return It == Slots.end() ? nullptr : &Cur.Vars[It->second];
+  }
+
+  // The result of an operation whose exact value is in Exact.
+  Interval fit(const AST &Node, Interval Exact) {
+    if (Exact.Lo > INT32_MAX || Exact.Hi < INT32_MIN) {
+      report(Node, "Integer overflow: the result is always out of range.");
+      return Interval::full();
+    }
+    return Exact.meet(Interval::full());
+  }
+
+  static Interval mul(Interval A, Interval B) {
+    int64_t P[] = {A.Lo * B.Lo, A.Lo * B.Hi, A.Hi * B.Lo, A.Hi * B.Hi};
+    return {*std::min_element(P, P + 4), *std::max_element(P, P + 4)};
+  }
+
+  Interval apply(const AST &Node, BinaryOp::Operator Op, Interval A, Interval B) {
+    if (A.isEmpty() || B.isEmpty())
+      return Interval::empty();
+
+    // The divisor without zero, where division is undefined.
+    Interval Neg = B.meet({INT32_MIN, -1}), Pos = B.meet({1, INT32_MAX});
+    if ((Op == BinaryOp::Div || Op == BinaryOp::Mod) && Neg.isEmpty() && Pos.isEmpty()) {
+      report(Node, "Division by zero is not allowed.");
+      return Interval::full();
+    }
+
+    switch (Op) {
+    case BinaryOp::Plus:
+      return fit(Node, {A.Lo + B.Lo, A.Hi + B.Hi});
+    case BinaryOp::Minus:
+      return fit(Node, {A.Lo - B.Hi, A.Hi - B.Lo});
+    case BinaryOp::Mul:
+      return fit(Node, mul(A, B));
+    case BinaryOp::Div: {
+      // Truncating division is monotonic in each operand as long as the
+      // sign of the divisor does not change, so the corners bound it.
+      Interval R = Interval::empty();
+      for (Interval D : {Neg, Pos})
+        if (!D.isEmpty())
+          for (int64_t X : {A.Lo, A.Hi})
+            for (int64_t Y : {D.Lo, D.Hi})
+              R = R.join(Interval::of(X / Y));
+      return fit(Node, R);
+    }
+    case BinaryOp::Mod: {
+      if (A.isConstant() && B.isConstant())
+        return Interval::of(A.Lo % B.Lo);
+      // The remainder has the sign of the dividend and is smaller than the
+      // divisor.
+      int64_t Max = std::max(-B.Lo, B.Hi) - 1;
+      return {A.Lo >= 0 ? 0 : std::max(A.Lo, -Max), A.Hi <= 0 ? 0 : std::min(A.Hi, Max)};
+    }
+    case BinaryOp::Exp: {
+      if (!B.isConstant())
+        return Interval::full();
+      // CodeGen multiplies B times, and each product has to fit.
+      Interval R = Interval::of(1), Prev = R;
+      for (int64_t I = 0; I < B.Lo; ++I) {
+        if (I == 64) {
+          // Only bases in [-1, 1] get here, alternating in sign.
+          R = R.join(Prev);
+          break;
+        }
+        Interval Next = fit(Node, mul(R, A));
+        if (Next == R)
+          break;
+        Prev = R;
+        R = Next;
+      }
+      return R;
+    }
+    }
+    return Interval::full();
+  }
+
+  static BinaryOp::Operator operatorOf(Assignment::AssignKind Kind) {
+    switch (Kind) {
+    case Assignment::Minus_assign:
+      return BinaryOp::Minus;
+    case Assignment::Star_assign:
+      return BinaryOp::Mul;
+    case Assignment::Slash_assign:
+      return BinaryOp::Div;
+    case Assignment::Mod_assign:
+      return BinaryOp::Mod;
+    case Assignment::Exp_assign:
+      return BinaryOp::Exp;
+    default:
+      return BinaryOp::Plus;
+    }
+  }
+
+  // S narrowed to where Cond is Truth.
+  RangeState refine(Logic *Cond, bool Truth, RangeState S) {
+    std::swap(Cur, S);
+    bool WasRecording = Recording, WasRefining = Refining, WasTruth = this->Truth;
+    Recording = false;
+    Refining = true;
+    this->Truth = Truth;
+    Cond->accept(*this);
+    Recording = WasRecording;
+    Refining = WasRefining;
+    this->Truth = WasTruth;
+    std::swap(Cur, S);
+    return S;
+  }
+
+  // Narrow the variable E, if it is one, to I.
+  void narrow(Expr *E, Interval I) {
+    if (Interval *Var = slotOf(E)) {
+      *Var = Var->meet(I);
+      if (Var->isEmpty())
+        Cur = RangeState::unreachable();
+    }
+  }
+
+  // An element of Array at Index, which is in I, is accessed. Past the
+  // access the index is known to be in range, or the program has stopped.
+  void access(const AST &Node, llvm::StringRef Array, Expr *Index, Interval I) {
+    Interval InRange = {0, int64_t(Arrays.lookup(Array)) - 1};
+    if (!I.isEmpty() && I.meet(InRange).isEmpty())
+      report(Node, "Index out of range: the index is never within the " + llvm::Twine(InRange.Hi + 1) +
+                       " elements of " + Array + ".");
+    narrow(Index, InRange);
+  }
+
+  template <typename It> void run(It Begin, It End) {
+    for (; Begin != End; ++Begin)
+      (*Begin)->accept(*this);
+  }
+
+public:
+  RangeCheck(llvm::raw_ostream &Diag, const SourceManager *SM) : Diag(Diag), SM(SM) {}
+
+  bool hasError() { return HasError; }
+
+  virtual void visit(Program &Node) override { run(Node.begin(), Node.end()); }
+
+  virtual void visit(Final &Node) override {
+    if (!Cur.Reachable) {
+      Val = Interval::empty();
+      return;
+    }
+    Val = Interval::full();
+    if (Node.getKind() == Final::Ident) {
+      if (Interval *Var = slotOf(&Node))
+        Val = *Var;
+    } else {
+      int64_t V;
+      if (!Node.getVal().getAsInteger(10, V))
+        Val = Interval::of(V).meet(Interval::full());
+      if (Val.isEmpty())
+        Val = Interval::full();
+    }
+    record(Node, Val);
+  }
+
+  virtual void visit(BinaryOp &Node) override {
+    llvm::SmallVector<BinaryOp *, 16> Spine = leftSpine(Node);
+    Val = eval(Spine.front()->getLeft());
+    for (BinaryOp *Op : Spine) {
+      Interval L = Val;
+      Interval R = eval(Op->getRight());
+      Val = apply(*Op, Op->getOperator(), L, R);
+      record(*Op, Val);
+    }
+  }
+
+  virtual void visit(ArrayElement &Node) override {
+    Interval I = eval(Node.getIndex());
+    if (!Cur.Reachable) {
+      Val = Interval::empty();
+      return;
+    }
+    access(Node, Node.getArray(), Node.getIndex(), I);
+    Val = Interval::full();
+    record(Node, Val);
+  }
+
+  virtual void visit(ArrayReduce &Node) override {
+    Val = Cur.Reachable ? Interval::full() : Interval::empty();
+    record(Node, Val);
+  }
+
+  virtual void visit(Assignment &Node) override {
+    Interval R = eval(Node.getRight());
+
+    // The old value of an element is not known, and no variable changes.
+    llvm::StringRef Dest = Node.getLeft()->getVal();
+    if (Node.getIndex() || Arrays.count(Dest)) {
+      Interval I = Node.getIndex() ? eval(Node.getIndex()) : Interval::empty();
+      if (!Cur.Reachable)
+        return;
+      if (Node.getAssignKind() != Assignment::Assign)
+        apply(Node, operatorOf(Node.getAssignKind()), Interval::full(), R);
+      if (Node.getIndex())
+        access(Node, Dest, Node.getIndex(), I);
+      return;
+    }
+
+    Interval Old = eval(Node.getLeft());
+    if (!Cur.Reachable)
+      return;
+    Interval New = R;
+    if (Node.getAssignKind() != Assignment::Assign)
+      New = apply(Node, operatorOf(Node.getAssignKind()), Old, R);
+    if (Interval *Var = slotOf(Node.getLeft()))
+      *Var = New;
+  }
+
+  virtual void visit(Declaration &Node) override {
+    llvm::SmallVector<Interval, 8> Vals;
+    for (auto I = Node.valBegin(), E = Node.valEnd(); I != E; ++I)
+      Vals.push_back(eval(*I));
+    size_t N = 0;
+    for (auto I = Node.varBegin(), E = Node.varEnd(); I != E; ++I, ++N) {
+      if (Node.getSize(N)) {
+        Arrays[*I] = Node.getSize(N);
+        continue;
+      }
+      Interval Init = N < Vals.size() ? Vals[N] : Interval::of(0);
+      auto Inserted = Slots.try_emplace(*I, Cur.Vars.size());
+      if (Inserted.second)
+        Cur.Vars.push_back(Interval::full());
+      if (Cur.Reachable)
+        Cur.Vars[Inserted.first->second] = Init;
+    }
+  }
+
+  // Nothing is known about the values read.
+  virtual void visit(ReadStmt &Node) override {
+    if (!Cur.Reachable)
+      return;
+    for (Final *Var : llvm::make_range(Node.varBegin(), Node.varEnd()))
+      if (Interval *Slot = slotOf(Var))
+        *Slot = Interval::full();
+  }
+
+  virtual void visit(Comparison &Node) override {
+    Interval L = eval(Node.getLeft());
+    Interval R = eval(Node.getRight());
+    if (!Refining || !Cur.Reachable)
+      return;
+
+    Comparison::Operator Op = Node.getOperator();
+    if (!Truth) {
+      static const Comparison::Operator Negated[] = {Comparison::Not_equal, Comparison::Equal,
+                                                     Comparison::Less_equal, Comparison::Greater_equal,
+                                                     Comparison::Less, Comparison::Greater};
+      Op = Negated[Op];
+    }
+
+    Interval NewL = L, NewR = R;
+    switch (Op) {
+    case Comparison::Equal:
+      NewL = NewR = L.meet(R);
+      break;
+    case Comparison::Not_equal:
+      if (R.isConstant())
+        NewL = {L.Lo + (L.Lo == R.Lo), L.Hi - (L.Hi == R.Lo)};
+      if (L.isConstant())
+        NewR = {R.Lo + (R.Lo == L.Lo), R.Hi - (R.Hi == L.Lo)};
+      break;
+    case Comparison::Less:
+      NewL = L.meet({INT32_MIN, R.Hi - 1});
+      NewR = R.meet({L.Lo + 1, INT32_MAX});
+      break;
+    case Comparison::Less_equal:
+      NewL = L.meet({INT32_MIN, R.Hi});
+      NewR = R.meet({L.Lo, INT32_MAX});
+      break;
+    case Comparison::Greater:
+      NewL = L.meet({R.Lo + 1, INT32_MAX});
+      NewR = R.meet({INT32_MIN, L.Hi - 1});
+      break;
+    case Comparison::Greater_equal:
+      NewL = L.meet({R.Lo, INT32_MAX});
+      NewR = R.meet({INT32_MIN, L.Hi});
+      break;
+    }
+    if (NewL.isEmpty() || NewR.isEmpty()) {
+      Cur = RangeState::unreachable();
+      return;
+    }
+    narrow(Node.getLeft(), NewL);
+    narrow(Node.getRight(), NewR);
+  }
+
+  virtual void visit(LogicalExpr &Node) override {
+    // Both sides are evaluated, and they have to hold together for a true
+    // "and" and a false "or".
+    bool Both = (Node.getOperator() == LogicalExpr::And) == Truth;
+    if (!Refining || Both) {
+      Node.getLeft()->accept(*this);
+      Node.getRight()->accept(*this);
+      return;
+    }
+    RangeState Start = Cur;
+    Node.getLeft()->accept(*this);
+    RangeState Left = std::move(Cur);
+    Cur = std::move(Start);
+    Node.getRight()->accept(*this);
+    Cur.join(Left);
+  }
+
+  virtual void visit(IfStmt &Node) override {
+    RangeState Rest = Cur, Out = RangeState::unreachable();
+    auto arm = [&](Logic *Cond, auto Begin, auto End) {
+      Cur = Rest;
+      Cond->accept(*this);
+      Cur = refine(Cond, true, Rest);
+      run(Begin, End);
+      Out.join(Cur);
+      Rest = refine(Cond, false, Rest);
+    };
+    arm(Node.getCond(), Node.begin(), Node.end());
+    for (auto I = Node.beginElif(), E = Node.endElif(); I != E; ++I)
+      arm((*I)->getCond(), (*I)->begin(), (*I)->end());
+    Cur = Rest;
+    run(Node.beginElse(), Node.endElse());
+    Out.join(Cur);
+    Cur = std::move(Out);
+  }
+
+  virtual void visit(elifStmt &) override {}
+
+  // The guard is evaluated on entry and the latch after each round of the
+  // body, so the body runs in the join of the entry narrowed by the
+  // condition and of every round's result narrowed by it.
+  virtual void visit(IterStmt &Node) override {
+    Logic *Cond = Node.getCond();
+    RangeState Start = Cur;
+    Cond->accept(*this);
+    RangeState Entry = refine(Cond, true, Start);
+
+    bool WasRecording = Recording;
+    Recording = false;
+    RangeState Head = Entry;
+    auto round = [&]() {
+      Cur = Head;
+      run(Node.begin(), Node.end());
+      RangeState Next = refine(Cond, true, Cur);
+      Next.join(Entry);
+      return Next;
+    };
+    for (unsigned Round = 0;; ++Round) {
+      RangeState Next = round();
+      if (Head.contains(Next))
+        break;
+      if (Round < 3)
+        Head.join(Next);
+      else
+        Head.widen(Next);
+    }
+    // One more round takes back what widening gave away beyond the bounds
+    // of the condition.
+    Head = round();
+    Recording = WasRecording;
+
+    Cur = Head;
+    run(Node.begin(), Node.end());
+    Cond->accept(*this);
+    RangeState Exit = refine(Cond, false, Cur);
+    Exit.join(refine(Cond, false, Start));
+    Cur = std::move(Exit);
+  }
+};
 }
 
-bool Sema::semantic(Program *Tree) {
+bool Sema::semantic(Program *Tree, llvm::raw_ostream &Diag, const SourceManager *SM,
+                    llvm::ArrayRef<const CheckedStmt *> Checked, bool CheckRanges) {
   if (!Tree)
     return false; // If the input AST is not valid, return false indicating no errors
-  nms::InputCheck *Check = new nms::InputCheck();;// Create an instance of the InputCheck class for semantic analysis
-  Tree->accept(*Check); // Initiate the semantic analysis by traversing the AST using the accept function
-
-  return Check->hasError(); // Return the result of Check.hasError() indicating if any errors were detected during the analysis
+  nms::InputCheck Check(Diag, SM); // Create an instance of the InputCheck class for semantic analysis
+  if (!Checked.empty() && Checked.size() == size_t(Tree->end() - Tree->begin()))
+    Check.checkProgram(*Tree, Checked);
+  else
+    Tree->accept(Check); // Initiate the semantic analysis by traversing the AST using the accept function
+  if (Check.hasError() || !CheckRanges)
+    return Check.hasError();
+
+  // The ranges need the whole program, statements checked before included.
+  nms::RangeCheck Ranges(Diag, SM);
+  Tree->accept(Ranges);
+  return Ranges.hasError();
 }
@@ -3,10 +3,27 @@
 
 #include "AST.h"
 #include "Lexer.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/raw_ostream.h"
+
+// A top-level statement that passed its checks before, in an earlier compile
+// of the same text. Only its names depend on the rest of the program.
+struct CheckedStmt {
+  llvm::SmallVector<llvm::StringRef, 4> Decls; // the variables it declares
+  llvm::SmallVector<unsigned, 4> DeclSizes;    // their numbers of elements, 0 for an int
+  bool IndexesArrays = false;                  // whether it has elements or sums of arrays
+  llvm::SmallVector<llvm::StringRef, 4> Uses;  // the variables it reads or assigns
+};
 
 class Sema {
 public:
-  bool semantic(Program *Tree);
+  // Checked, if given, has an entry per statement of Tree. The statements
+  // with one are only checked against the scope, unless that fails. The
+  // value ranges are only checked if CheckRanges is set, since they are
+  // wrong for a tree the parser dropped statements from.
+  bool semantic(Program *Tree, llvm::raw_ostream &Diag = llvm::errs(), const SourceManager *SM = nullptr,
+                llvm::ArrayRef<const CheckedStmt *> Checked = llvm::None, bool CheckRanges = true);
 };
 
 #endif
\ No newline at end of file
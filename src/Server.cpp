@@ -0,0 +1,425 @@
+#include "Server.h"
+#include "ByteCode.h"
+#include "CodeGen.h"
+#include "Driver.h"
+#include "VM.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef LLVM_ON_UNIX
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+using namespace llvm;
+
+namespace
+{
+  const char Magic[4] = {'L', 'P', 'C', '2'};
+  const uint32_t MaxSourceSize = 1u << 30;
+  const uint32_t MaxOptionsSize = 1u << 12;
+  const unsigned OptionWords = 10;
+
+  struct Response
+  {
+    uint32_t Status = 0;
+    std::string Out;
+    std::string Err;
+  };
+
+  // Serialize the options of a request as described in Server.h.
+  std::string encodeOptions(const RequestOptions &Opts)
+  {
+    const uint32_t Words[OptionWords] = {
+        Opts.Compile.OptLevel,  Opts.Compile.LinkRuntime,      Opts.Compile.DebugInfo,
+        Opts.Compile.ChunkSize, Opts.Compile.GlobalsThreshold, (uint32_t)Opts.Compile.Results,
+        Opts.Frontend.PreLex,   Opts.Frontend.ParseJobs,       Opts.ExecProfile,
+        Opts.ExecCycles};
+    std::string Data((OptionWords + 1) * 4, '\0');
+    for (unsigned I = 0; I < OptionWords; ++I)
+      support::endian::write32le(&Data[I * 4], Words[I]);
+    support::endian::write32le(&Data[OptionWords * 4], Opts.InputName.size());
+    return Data + Opts.InputName;
+  }
+
+  // The inverse of encodeOptions. Returns false if Data is malformed.
+  bool decodeOptions(StringRef Data, RequestOptions &Opts)
+  {
+    if (Data.size() < (OptionWords + 1) * 4)
+      return false;
+    uint32_t Words[OptionWords + 1];
+    for (unsigned I = 0; I <= OptionWords; ++I)
+      Words[I] = support::endian::read32le(Data.data() + I * 4);
+    if (Words[0] > 3 || Words[5] > (uint32_t)ResultFormat::Records ||
+        Data.size() != (OptionWords + 1) * 4 + (size_t)Words[OptionWords])
+      return false;
+    Opts.Compile.OptLevel = Words[0];
+    Opts.Compile.LinkRuntime = Words[1];
+    Opts.Compile.DebugInfo = Words[2];
+    Opts.Compile.ChunkSize = Words[3];
+    Opts.Compile.GlobalsThreshold = Words[4];
+    Opts.Compile.Results = (ResultFormat)Words[5];
+    Opts.Frontend.PreLex = Words[6];
+    Opts.Frontend.ParseJobs = Words[7];
+    Opts.ExecProfile = Words[8];
+    Opts.ExecCycles = Words[9];
+    Opts.InputName = Data.drop_front((OptionWords + 1) * 4).str();
+    return true;
+  }
+
+  // CompileCache remembers the responses to recent requests, keyed by the
+  // request kind, its options and the source text, up to a total size in
+  // bytes.
+  class CompileCache
+  {
+    std::mutex Lock;
+    StringMap<Response> Entries;
+    std::deque<std::string> Order; // insertion order, oldest first
+    size_t Bytes = 0;
+    size_t MaxBytes;
+
+    static size_t sizeOf(StringRef Key, const Response &R) { return Key.size() + R.Out.size() + R.Err.size(); }
+
+  public:
+    CompileCache(size_t MaxBytes) : MaxBytes(MaxBytes) {}
+
+    bool lookup(StringRef Key, Response &R)
+    {
+      std::lock_guard<std::mutex> Guard(Lock);
+      auto It = Entries.find(Key);
+      if (It == Entries.end())
+        return false;
+      R = It->second;
+      return true;
+    }
+
+    void insert(StringRef Key, const Response &R)
+    {
+      size_t Size = sizeOf(Key, R);
+      if (Size > MaxBytes)
+        return;
+      std::lock_guard<std::mutex> Guard(Lock);
+      if (!Entries.try_emplace(Key, R).second)
+        return;
+      Order.push_back(Key.str());
+      Bytes += Size;
+      while (Bytes > MaxBytes)
+      {
+        auto Oldest = Entries.find(Order.front());
+        Bytes -= sizeOf(Oldest->first(), Oldest->second);
+        Entries.erase(Oldest);
+        Order.pop_front();
+      }
+    }
+  };
+
+  // Warm state of one server thread, reused for every request it handles.
+  struct ServerWorker
+  {
+    LLVMContext Ctx;
+    std::unique_ptr<TargetMachine> TM;
+    ASTContext AST;
+  };
+
+  void handleRequest(ServerWorker &W, RequestKind Kind, const RequestOptions &Opts, StringRef Source, Response &R)
+  {
+    raw_string_ostream Out(R.Out);
+    raw_string_ostream Err(R.Err);
+
+    W.AST.reset();
+    SourceManager SM(Source, Opts.InputName);
+    Program *Tree = parseAndCheck(SM, W.AST, Err, Opts.Frontend);
+    if (!Tree)
+    {
+      R.Status = 1;
+      return;
+    }
+
+    if (Kind == RequestKind::Run)
+    {
+      ByteCode BC;
+      if (!ByteCodeGen().compile(Tree, BC))
+        R.Status = 3;
+      else
+      {
+        VM Interpreter;
+        Interpreter.setResultFormat(Opts.Compile.Results);
+        R.Status = Interpreter.run(BC, Out, /*InputFD=*/-1); // the input of the server is not the client's
+      }
+      return;
+    }
+
+    Module M("simple-compiler", W.Ctx);
+    ProfileOptions Profile;
+    Profile.ExecProfile = Opts.ExecProfile;
+    Profile.ExecCycles = Opts.ExecCycles;
+    CodeGen Gen(Err, Profile);
+    if (Opts.Compile.DebugInfo)
+      Gen.setDebugInfo(SM);
+    Gen.setChunkSize(Opts.Compile.ChunkSize);
+    Gen.setGlobalsThreshold(Opts.Compile.GlobalsThreshold);
+    Gen.setResultFormat(Opts.Compile.Results);
+    if (!Gen.generate(Tree, &M) || !finishModule(M, W.TM.get(), Opts.Compile, Err))
+    {
+      R.Status = 3;
+      return;
+    }
+
+    if (Kind == RequestKind::IR)
+    {
+      M.print(Out, nullptr);
+      return;
+    }
+
+    if (Kind == RequestKind::Bitcode)
+    {
+      WriteBitcodeToFile(M, Out);
+      return;
+    }
+
+    SmallString<0> Obj;
+    raw_svector_ostream ObjOS(Obj);
+    if (!W.TM || !emitObjectFile(M, *W.TM, ObjOS))
+    {
+      Err << "Error: the target cannot emit object files\n";
+      R.Status = 1;
+      return;
+    }
+    Out << Obj;
+  }
+}
+
+#ifdef LLVM_ON_UNIX
+
+static bool readAll(int FD, void *Buf, size_t Size)
+{
+  char *P = static_cast<char *>(Buf);
+  while (Size)
+  {
+    ssize_t N = ::read(FD, P, Size);
+    if (N < 0 && errno == EINTR)
+      continue;
+    if (N <= 0)
+      return false;
+    P += N;
+    Size -= N;
+  }
+  return true;
+}
+
+static bool writeAll(int FD, const void *Buf, size_t Size)
+{
+  const char *P = static_cast<const char *>(Buf);
+  while (Size)
+  {
+    ssize_t N = ::write(FD, P, Size);
+    if (N < 0 && errno == EINTR)
+      continue;
+    if (N <= 0)
+      return false;
+    P += N;
+    Size -= N;
+  }
+  return true;
+}
+
+static bool readU32(int FD, uint32_t &Val)
+{
+  char Buf[4];
+  if (!readAll(FD, Buf, 4))
+    return false;
+  Val = support::endian::read32le(Buf);
+  return true;
+}
+
+static bool writeU32(int FD, uint32_t Val)
+{
+  char Buf[4];
+  support::endian::write32le(Buf, Val);
+  return writeAll(FD, Buf, 4);
+}
+
+static bool writeBlob(int FD, StringRef Data)
+{
+  return writeU32(FD, Data.size()) && writeAll(FD, Data.data(), Data.size());
+}
+
+static bool readBlob(int FD, std::string &Data)
+{
+  uint32_t Size;
+  if (!readU32(FD, Size))
+    return false;
+  Data.resize(Size);
+  return readAll(FD, &Data[0], Size);
+}
+
+static bool makeAddress(StringRef SocketPath, sockaddr_un &Addr)
+{
+  if (SocketPath.size() >= sizeof(Addr.sun_path))
+  {
+    errs() << "Error: socket path is too long: " << SocketPath << "\n";
+    return false;
+  }
+  memset(&Addr, 0, sizeof(Addr));
+  Addr.sun_family = AF_UNIX;
+  memcpy(Addr.sun_path, SocketPath.data(), SocketPath.size());
+  return true;
+}
+
+// Serve requests on one connection until the client closes it.
+static void serveConnection(ServerWorker &W, CompileCache &Cache, int Conn)
+{
+  for (;;)
+  {
+    char Header[4];
+    uint32_t Kind;
+    std::string Key;
+    if (!readAll(Conn, Header, 4) || memcmp(Header, Magic, 4) != 0 || !readU32(Conn, Kind) ||
+        Kind > (uint32_t)RequestKind::Bitcode)
+      return;
+
+    // The key is the kind, the encoded options and the null-terminated
+    // source text, which is what the lexer expects. The options encode
+    // their own length, so no two requests share a key.
+    uint32_t OptsSize, Size;
+    if (!readU32(Conn, OptsSize) || OptsSize > MaxOptionsSize)
+      return;
+    Key.resize(1 + OptsSize);
+    Key[0] = (char)Kind;
+    RequestOptions Opts;
+    if (!readAll(Conn, &Key[1], OptsSize) || !decodeOptions(StringRef(Key).drop_front(), Opts))
+      return;
+    if (!readU32(Conn, Size) || Size > MaxSourceSize)
+      return;
+    Key.resize(1 + OptsSize + Size + 1);
+    if (!readAll(Conn, &Key[1 + OptsSize], Size))
+      return;
+
+    Response R;
+    if (!Cache.lookup(Key, R))
+    {
+      handleRequest(W, (RequestKind)Kind, Opts, StringRef(Key).drop_front(1 + OptsSize), R);
+      Cache.insert(Key, R);
+    }
+
+    if (!writeU32(Conn, R.Status) || !writeBlob(Conn, R.Out) || !writeBlob(Conn, R.Err))
+      return;
+  }
+}
+
+int runServer(StringRef SocketPath, unsigned Jobs)
+{
+  sockaddr_un Addr;
+  if (!makeAddress(SocketPath, Addr))
+    return 1;
+
+  InitializeNativeTarget();
+  InitializeNativeTargetAsmPrinter();
+  // A client that goes away must not take the server down with it.
+  signal(SIGPIPE, SIG_IGN);
+
+  int Listen = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  ::unlink(Addr.sun_path);
+  if (Listen < 0 || ::bind(Listen, (sockaddr *)&Addr, sizeof(Addr)) < 0 || ::listen(Listen, 128) < 0)
+  {
+    errs() << "Error: cannot listen on " << SocketPath << ": " << strerror(errno) << "\n";
+    return 1;
+  }
+
+  if (Jobs == 0)
+    Jobs = std::max(1u, std::thread::hardware_concurrency());
+  CompileCache Cache(256u << 20);
+  std::unique_ptr<ServerWorker[]> Workers(new ServerWorker[Jobs]);
+
+  // Every thread accepts connections on the shared socket, so a slow
+  // request only holds up its own thread.
+  auto Serve = [&](unsigned I) {
+    ServerWorker &W = Workers[I];
+    W.TM = createHostTargetMachine(errs());
+    for (;;)
+    {
+      int Conn = ::accept(Listen, nullptr, nullptr);
+      if (Conn < 0)
+      {
+        if (errno == EINTR || errno == ECONNABORTED)
+          continue;
+        errs() << "Error: accept failed: " << strerror(errno) << "\n";
+        return;
+      }
+      serveConnection(W, Cache, Conn);
+      ::close(Conn);
+    }
+  };
+
+  std::vector<std::thread> Threads;
+  for (unsigned I = 1; I < Jobs; ++I)
+    Threads.emplace_back(Serve, I);
+  Serve(0);
+  for (std::thread &T : Threads)
+    T.join();
+  ::close(Listen);
+  return 1;
+}
+
+int runClient(StringRef SocketPath, RequestKind Kind, const RequestOptions &Opts, StringRef Source,
+              raw_ostream &OS)
+{
+  sockaddr_un Addr;
+  if (!makeAddress(SocketPath, Addr))
+    return 1;
+
+  int Conn = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (Conn < 0 || ::connect(Conn, (sockaddr *)&Addr, sizeof(Addr)) < 0)
+  {
+    errs() << "Error: cannot connect to " << SocketPath << ": " << strerror(errno) << "\n";
+    return 1;
+  }
+
+  Response R;
+  bool Ok = writeAll(Conn, Magic, 4) && writeU32(Conn, (uint32_t)Kind) &&
+            writeBlob(Conn, encodeOptions(Opts)) && writeBlob(Conn, Source) &&
+            readU32(Conn, R.Status) && readBlob(Conn, R.Out) && readBlob(Conn, R.Err);
+  ::close(Conn);
+  if (!Ok)
+  {
+    errs() << "Error: the connection to " << SocketPath << " was lost\n";
+    return 1;
+  }
+
+  OS << R.Out;
+  errs() << R.Err;
+  return R.Status;
+}
+
+#else
+
+int runServer(StringRef SocketPath, unsigned Jobs)
+{
+  errs() << "Error: the compile server needs Unix domain sockets\n";
+  return 1;
+}
+
+int runClient(StringRef SocketPath, RequestKind Kind, const RequestOptions &Opts, StringRef Source,
+              raw_ostream &OS)
+{
+  errs() << "Error: the compile server needs Unix domain sockets\n";
+  return 1;
+}
+
+#endif
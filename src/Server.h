@@ -0,0 +1,48 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "Driver.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstdint>
+#include <string>
+
+// What a compile request asks the server for.
+enum class RequestKind : uint32_t
+{
+  IR,           // textual LLVM IR
+  Object,       // a host object file
+  Run,          // the output of running the program in the bytecode VM
+  Bitcode       // LLVM bitcode
+};
+
+// The flags of the client that change a response, which the server compiles
+// with instead of its own. Flags with local effects, such as --tiered or the
+// PGO profile files, are not sent; the client refuses them.
+struct RequestOptions
+{
+  CompileOptions Compile;
+  FrontendOptions Frontend;      // PreLex and ParseJobs only
+  bool ExecProfile = false;      // see ProfileOptions
+  bool ExecCycles = false;
+  std::string InputName = "input.txt"; // the name of the source in diagnostics and debug info
+};
+
+// Wire format on the Unix domain socket; integers are little endian u32.
+//   request:  "LPC2" Kind OptionsLen Options SourceLen Source
+//   response: Status OutLen Out ErrLen Err
+// Options are the words OptLevel LinkRuntime DebugInfo ChunkSize
+// GlobalsThreshold ResultFormat PreLex ParseJobs ExecProfile ExecCycles,
+// then InputNameLen InputName. Status is the exit code the compiler would
+// have returned locally.
+
+// Listen on SocketPath and serve compile requests on Jobs threads until the
+// process is killed. Returns the process exit code.
+int runServer(llvm::StringRef SocketPath, unsigned Jobs);
+
+// Send one request to the server on SocketPath, write the response output to
+// OS and its diagnostics to stderr, and return the response status.
+int runClient(llvm::StringRef SocketPath, RequestKind Kind, const RequestOptions &Opts, llvm::StringRef Source,
+              llvm::raw_ostream &OS);
+
+#endif
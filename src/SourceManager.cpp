@@ -0,0 +1,66 @@
+#include "SourceManager.h"
+#include "llvm/Support/MathExtras.h"
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace llvm;
+
+void SourceManager::buildLineTable() const
+{
+  const char *Begin = Buffer.begin();
+  const char *End = Buffer.end();
+  const char *P = Begin;
+  LineStarts.push_back(0);
+
+#ifdef __SSE2__
+  // Compare 16 bytes at a time against '\n' and walk the bits of the matches.
+  const __m128i Newline = _mm_set1_epi8('\n');
+  for (; End - P >= 16; P += 16)
+  {
+    __m128i Chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(P));
+    unsigned Mask = _mm_movemask_epi8(_mm_cmpeq_epi8(Chunk, Newline));
+    for (; Mask; Mask &= Mask - 1)
+      LineStarts.push_back(P - Begin + countTrailingZeros(Mask) + 1);
+  }
+#endif
+
+  for (; P != End; ++P)
+    if (*P == '\n')
+      LineStarts.push_back(P - Begin + 1);
+}
+
+std::pair<unsigned, unsigned> SourceManager::getLineAndColumn(SourceLocation Loc) const
+{
+  std::call_once(LineTableBuilt, [this] { buildLineTable(); });
+  uint32_t Offset = Loc.getOffset();
+  unsigned Line = std::upper_bound(LineStarts.begin(), LineStarts.end(), Offset) - LineStarts.begin();
+  return {Line, Offset - LineStarts[Line - 1] + 1};
+}
+
+StringRef SourceManager::getLineText(SourceLocation Loc) const
+{
+  std::pair<unsigned, unsigned> LineCol = getLineAndColumn(Loc);
+  StringRef Rest = Buffer.drop_front(LineStarts[LineCol.first - 1]);
+  return Rest.take_until([](char C) { return C == '\n' || C == '\r' || C == '\0'; });
+}
+
+void SourceManager::report(raw_ostream &OS, SourceLocation Loc, const Twine &Message) const
+{
+  if (!Loc.isValid())
+  {
+    OS << Name << ": " << Message << "\n";
+    return;
+  }
+  std::pair<unsigned, unsigned> LineCol = getLineAndColumn(Loc);
+  OS << Name << ":" << LineCol.first << ":" << LineCol.second << ": " << Message << "\n";
+
+  // Echo the line with a caret; tabs are kept so the caret lines up.
+  StringRef Line = getLineText(Loc);
+  OS << Line << "\n";
+  for (unsigned I = 1; I < LineCol.second && I <= Line.size(); ++I)
+    OS << (Line[I - 1] == '\t' ? '\t' : ' ');
+  OS << "^\n";
+}
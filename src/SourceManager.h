@@ -0,0 +1,76 @@
+#ifndef SOURCEMANAGER_H
+#define SOURCEMANAGER_H
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// SourceLocation is a position in the source as a 32-bit byte offset. The
+// default value is "no location".
+class SourceLocation
+{
+  uint32_t ID = 0; // offset + 1, so that 0 means invalid
+
+public:
+  static SourceLocation fromOffset(uint32_t Offset)
+  {
+    SourceLocation L;
+    L.ID = Offset + 1;
+    return L;
+  }
+
+  bool isValid() const { return ID != 0; }
+  uint32_t getOffset() const { return ID - 1; }
+
+  // The 32 bits as they are, for writing locations to a file.
+  uint32_t getRawEncoding() const { return ID; }
+  static SourceLocation getFromRawEncoding(uint32_t Raw)
+  {
+    SourceLocation L;
+    L.ID = Raw;
+    return L;
+  }
+};
+
+// SourceManager owns the name of a source buffer and maps locations in it to
+// lines and columns. The table of line starts is only built the first time a
+// line is asked for, so lexing and parsing never count lines. Lookups may
+// come from several threads.
+class SourceManager
+{
+  llvm::StringRef Buffer;
+  std::string Name;
+  mutable std::once_flag LineTableBuilt;
+  mutable std::vector<uint32_t> LineStarts; // offsets of the first character of each line
+
+  void buildLineTable() const;
+
+public:
+  SourceManager(llvm::StringRef Buffer, llvm::StringRef Name) : Buffer(Buffer), Name(Name.str()) {}
+
+  llvm::StringRef getBuffer() const { return Buffer; }
+  llvm::StringRef getName() const { return Name; }
+
+  // Location of a character in the buffer, e.g. the start of a token.
+  SourceLocation getLocation(const char *Ptr) const
+  {
+    return SourceLocation::fromOffset(static_cast<uint32_t>(Ptr - Buffer.begin()));
+  }
+
+  // 1-based line and column of Loc.
+  std::pair<unsigned, unsigned> getLineAndColumn(SourceLocation Loc) const;
+
+  // Text of the line that contains Loc, without the line break.
+  llvm::StringRef getLineText(SourceLocation Loc) const;
+
+  // Print "name:line:col: Message", then the source line with a caret under
+  // Loc.
+  void report(llvm::raw_ostream &OS, SourceLocation Loc, const llvm::Twine &Message) const;
+};
+
+#endif
@@ -0,0 +1,220 @@
+#include "Tiered.h"
+#include "CodeGen.h"
+#include "rtCompiler.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/ExecutionEngine/JITEventListener.h"
+#include "llvm/ExecutionEngine/Orc/CompileUtils.h"
+#include "llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h"
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
+#include "llvm/ExecutionEngine/SectionMemoryManager.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/Support/Path.h"
+#include <algorithm>
+#include <cstdlib>
+
+using namespace llvm;
+
+// The runtime of native loops. Each takes the stream the VM of the JIT
+// writes results to; see createRuntime.
+static void hostWrite(raw_ostream *OS, int V)
+{
+  *OS << COMPILER_RESULT_PREFIX << V << "\n";
+}
+
+static void hostWriteRaw(raw_ostream *OS, int V)
+{
+  writeResult(*OS, ResultFormat::Raw, 0, V);
+}
+
+static void hostWriteRecord(raw_ostream *OS, int Var, int V)
+{
+  writeResult(*OS, ResultFormat::Records, Var, V);
+}
+
+// Native code cannot return to the VM to stop, so the process ends here, as
+// it does in the C runtime; loops may still be compiling on other threads.
+static void hostIndexError(raw_ostream *OS, int Index, int Size)
+{
+  OS->flush();
+  errs() << "Error: index " << Index << " is out of range for an array of " << Size << " elements.\n";
+  std::_Exit(1);
+}
+
+// The runtime functions the generated code calls, e.g. compiler_write(V),
+// each forwarding to its host function with the stream of one JIT. The JIT
+// defines compiler.tier.stream at the address of that stream.
+static orc::ThreadSafeModule createRuntime(const DataLayout &DL)
+{
+  auto Ctx = std::make_unique<LLVMContext>();
+  auto M = std::make_unique<Module>("loopc.tier.runtime", *Ctx);
+  M->setDataLayout(DL);
+  IRBuilder<> Builder(*Ctx);
+  auto *Stream = new GlobalVariable(*M, Builder.getInt8Ty(), false, GlobalValue::ExternalLinkage, nullptr,
+                                    "compiler.tier.stream");
+
+  auto forward = [&](StringRef Name, StringRef Host, unsigned NumArgs) {
+    SmallVector<Type *, 2> Params(NumArgs, Builder.getInt32Ty());
+    Function *Fn = Function::Create(FunctionType::get(Builder.getVoidTy(), Params, false),
+                                    GlobalValue::ExternalLinkage, Name, *M);
+    Params.insert(Params.begin(), Builder.getInt8PtrTy());
+    FunctionCallee HostFn = M->getOrInsertFunction(Host, FunctionType::get(Builder.getVoidTy(), Params, false));
+    Builder.SetInsertPoint(BasicBlock::Create(*Ctx, "entry", Fn));
+    SmallVector<Value *, 3> Args = {Stream};
+    for (Argument &Arg : Fn->args())
+      Args.push_back(&Arg);
+    Builder.CreateCall(HostFn, Args);
+    Builder.CreateRetVoid();
+  };
+  forward("compiler_write", "compiler.tier.write", 1);
+  forward("compiler_write_raw", "compiler.tier.write_raw", 1);
+  forward("compiler_write_record", "compiler.tier.write_record", 2);
+  forward("compiler_index_error", "compiler.tier.index_error", 2);
+  return orc::ThreadSafeModule(std::move(M), std::move(Ctx));
+}
+
+TieredJIT::TieredJIT(const ByteCode &BC, std::unique_ptr<orc::LLJIT> JIT, const TierOptions &Opts)
+    : BC(BC), JIT(std::move(JIT)), Compiled(new std::atomic<NativeLoopFn>[BC.Loops.size()]), Opts(Opts)
+{
+  for (size_t I = 0, E = BC.Loops.size(); I != E; ++I)
+    Compiled[I].store(nullptr, std::memory_order_relaxed);
+
+  // Name each loop after where it is in the source, e.g. loopc@input.txt:3:1,
+  // so profiles and backtraces of JIT-compiled code point at the script.
+  for (size_t I = 0, E = BC.Loops.size(); I != E; ++I)
+  {
+    SourceLocation Loc = BC.Loops[I]->getLoc();
+    if (!Opts.Sources || !Loc.isValid())
+    {
+      Names.push_back(("loopc." + Twine(I)).str());
+      continue;
+    }
+    std::pair<unsigned, unsigned> LineCol = Opts.Sources->getLineAndColumn(Loc);
+    Names.push_back(("loopc@" + sys::path::filename(Opts.Sources->getName()) + ":" + Twine(LineCol.first) + ":" +
+                     Twine(LineCol.second))
+                        .str());
+  }
+}
+
+Expected<std::unique_ptr<TieredJIT>> TieredJIT::create(const ByteCode &BC, raw_ostream &OS, const TierOptions &Opts)
+{
+  orc::LLJITBuilder Builder;
+  // Loops are compiled on several threads at once, so each compile needs a
+  // target machine of its own.
+  Builder.setCompileFunctionCreator([](orc::JITTargetMachineBuilder JTMB)
+                                        -> Expected<std::unique_ptr<orc::IRCompileLayer::IRCompiler>> {
+    return std::make_unique<orc::ConcurrentIRCompiler>(std::move(JTMB));
+  });
+  if (Opts.PerfEvents || Opts.GDBEvents)
+  {
+    // Event listeners need the RuntimeDyld based linking layer.
+    Builder.setObjectLinkingLayerCreator([&](orc::ExecutionSession &ES, const Triple &) {
+      auto Layer = std::make_unique<orc::RTDyldObjectLinkingLayer>(
+          ES, []() { return std::make_unique<SectionMemoryManager>(); });
+      if (Opts.GDBEvents)
+        Layer->registerJITEventListener(*JITEventListener::createGDBRegistrationListener());
+      if (Opts.PerfEvents)
+      {
+        if (JITEventListener *Perf = JITEventListener::createPerfJITEventListener())
+          Layer->registerJITEventListener(*Perf);
+        else
+          errs() << "Warning: this LLVM cannot write perf jitdump files\n";
+      }
+      return std::unique_ptr<orc::ObjectLayer>(std::move(Layer));
+    });
+  }
+
+  auto JIT = Builder.create();
+  if (!JIT)
+    return JIT.takeError();
+
+  // Resolve the runtime functions of the generated code to the host, with
+  // the results going to OS.
+  orc::SymbolMap Runtime;
+  Runtime[(*JIT)->mangleAndIntern("compiler.tier.stream")] = JITEvaluatedSymbol::fromPointer(&OS);
+  Runtime[(*JIT)->mangleAndIntern("compiler.tier.write")] = JITEvaluatedSymbol::fromPointer(&hostWrite);
+  Runtime[(*JIT)->mangleAndIntern("compiler.tier.write_raw")] = JITEvaluatedSymbol::fromPointer(&hostWriteRaw);
+  Runtime[(*JIT)->mangleAndIntern("compiler.tier.write_record")] = JITEvaluatedSymbol::fromPointer(&hostWriteRecord);
+  Runtime[(*JIT)->mangleAndIntern("compiler.tier.index_error")] = JITEvaluatedSymbol::fromPointer(&hostIndexError);
+  if (Error Err = (*JIT)->getMainJITDylib().define(orc::absoluteSymbols(std::move(Runtime))))
+    return Err;
+  if (Error Err = (*JIT)->addIRModule(createRuntime((*JIT)->getDataLayout())))
+    return Err;
+
+  return std::unique_ptr<TieredJIT>(new TieredJIT(BC, std::move(*JIT), Opts));
+}
+
+TieredJIT::~TieredJIT()
+{
+  {
+    std::lock_guard<std::mutex> Guard(QueueLock);
+    Stopping = true;
+    Queue.clear();
+  }
+  QueueReady.notify_all();
+  for (std::thread &T : Workers)
+    T.join();
+}
+
+void TieredJIT::compile(unsigned LoopId)
+{
+  std::lock_guard<std::mutex> Guard(QueueLock);
+  Queue.push_back(LoopId);
+  unsigned Jobs = Opts.Jobs ? Opts.Jobs : std::max(1u, std::thread::hardware_concurrency());
+  if (Idle < Queue.size() && Workers.size() < Jobs)
+    Workers.emplace_back(&TieredJIT::work, this);
+  QueueReady.notify_one();
+}
+
+void TieredJIT::work()
+{
+  std::unique_lock<std::mutex> Guard(QueueLock);
+  for (;;)
+  {
+    ++Idle;
+    QueueReady.wait(Guard, [this] { return Stopping || !Queue.empty(); });
+    --Idle;
+    if (Stopping)
+      return;
+    unsigned LoopId = Queue.front();
+    Queue.pop_front();
+    Guard.unlock();
+    compileInBackground(LoopId);
+    Guard.lock();
+  }
+}
+
+NativeLoopFn TieredJIT::lookup(unsigned LoopId)
+{
+  return Compiled[LoopId].load(std::memory_order_acquire);
+}
+
+void TieredJIT::compileInBackground(unsigned LoopId)
+{
+  auto Ctx = std::make_unique<LLVMContext>();
+  auto M = std::make_unique<Module>("loopc.tier", *Ctx);
+  M->setDataLayout(JIT->getDataLayout());
+
+  const std::string &Name = Names[LoopId];
+  CodeGen Gen;
+  Gen.setResultFormat(Opts.Results);
+  // Line tables let perf and gdb attribute JIT-compiled code to the source.
+  if ((Opts.PerfEvents || Opts.GDBEvents) && Opts.Sources)
+    Gen.setDebugInfo(*Opts.Sources);
+  Gen.compileLoop(BC.Loops[LoopId], BC.Vars, BC.Sizes, M.get(), Name);
+  Gen.optimize(*M, Opts.OptLevel);
+
+  // On failure the loop simply stays in the interpreter.
+  if (Error Err = JIT->addIRModule(orc::ThreadSafeModule(std::move(M), std::move(Ctx))))
+  {
+    errs() << "Error: cannot JIT loop " << LoopId << ": " << toString(std::move(Err)) << "\n";
+    return;
+  }
+  auto Sym = JIT->lookup(Name);
+  if (!Sym)
+  {
+    errs() << "Error: cannot JIT loop " << LoopId << ": " << toString(Sym.takeError()) << "\n";
+    return;
+  }
+  Compiled[LoopId].store(jitTargetAddressToPointer<NativeLoopFn>(Sym->getAddress()), std::memory_order_release);
+}
@@ -0,0 +1,70 @@
+#ifndef TIERED_H
+#define TIERED_H
+
+#include "ByteCode.h"
+#include "SourceManager.h"
+#include "VM.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/Support/raw_ostream.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// How TieredJIT compiles loops, and how it shows them to profilers and
+// debuggers.
+struct TierOptions
+{
+  unsigned OptLevel = 2;  // -O level of JIT-compiled loops
+  unsigned Jobs = 0;      // threads compiling loops, 0: one per hardware thread
+  const SourceManager *Sources = nullptr; // the program, to name loops after their source
+  bool PerfEvents = false; // write perf jitdump files for `perf inject --jit`
+  bool GDBEvents = false;  // register JIT-compiled code with gdb
+  ResultFormat Results = ResultFormat::Text; // as the VM writes them
+};
+
+// TieredJIT compiles hot loops of an interpreted program with ORC. Hot loops
+// are queued for a fixed number of background threads, started as they are
+// needed, while the VM keeps interpreting; the VM switches to the native code
+// on the next iteration after it is ready. Loops still queued when the JIT is
+// destroyed are never compiled, so the program only waits for the compiles
+// already running.
+class TieredJIT : public LoopTier
+{
+  const ByteCode &BC;
+  std::unique_ptr<llvm::orc::LLJIT> JIT;
+  std::unique_ptr<std::atomic<NativeLoopFn>[]> Compiled;
+  TierOptions Opts;
+  std::vector<std::string> Names; // symbol name of each loop
+
+  std::vector<std::thread> Workers; // at most Opts.Jobs
+  std::mutex QueueLock;
+  std::condition_variable QueueReady;
+  std::deque<unsigned> Queue; // hot loops waiting for a worker
+  unsigned Idle = 0;          // workers waiting for a loop
+  bool Stopping = false;
+
+  TieredJIT(const ByteCode &BC, std::unique_ptr<llvm::orc::LLJIT> JIT, const TierOptions &Opts);
+
+  void work();
+  void compileInBackground(unsigned LoopId);
+
+public:
+  // Create the JIT. Results printed by native code go to OS, the stream the
+  // VM writes to, so the output order is preserved. OS has to outlive the
+  // JIT.
+  static llvm::Expected<std::unique_ptr<TieredJIT>> create(const ByteCode &BC, llvm::raw_ostream &OS,
+                                                           const TierOptions &Opts = TierOptions());
+
+  ~TieredJIT();
+
+  virtual void compile(unsigned LoopId) override;
+
+  virtual NativeLoopFn lookup(unsigned LoopId) override;
+};
+
+#endif
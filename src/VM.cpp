@@ -0,0 +1,360 @@
+#include "VM.h"
+#include "rtCompiler.h"
+#include "llvm/Support/Errno.h"
+#include "llvm/Support/Process.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <unistd.h>
+
+// Computed-goto dispatch is a GNU extension; fall back to a switch elsewhere.
+#if defined(__GNUC__) || defined(__clang__)
+#define VM_COMPUTED_GOTO 1
+#else
+#define VM_COMPUTED_GOTO 0
+#endif
+
+namespace
+{
+  // The input of read statements, as compiler_read in rtCompiler.c takes it:
+  // integers in decimal, with an optional sign, separated by whitespace, read
+  // in large blocks. Reads are prompted for when the input is a terminal, or
+  // as COMPILER_PROMPT says (0 for never).
+  class Input
+  {
+    int FD;
+    std::vector<char> Block;
+    const char *Pos = nullptr, *End = nullptr; // the part of Block not parsed yet
+
+    // Read the next block. Returns false at the end of the input.
+    bool fill()
+    {
+      if (FD < 0)
+        return false;
+      if (Block.empty())
+        Block.resize(1 << 16);
+      ssize_t N = llvm::sys::RetryAfterSignal(-1, ::read, FD, Block.data(), Block.size());
+      if (N <= 0)
+        return false;
+      Pos = Block.data();
+      End = Pos + N;
+      return true;
+    }
+
+    static bool isSpace(char C) { return C == ' ' || C == '\n' || C == '\t' || C == '\r' || C == '\f' || C == '\v'; }
+
+  public:
+    bool Prompt;
+
+    explicit Input(int FD) : FD(FD)
+    {
+      const char *Env = std::getenv("COMPILER_PROMPT");
+      Prompt = Env ? std::atoi(Env) != 0 : FD >= 0 && llvm::sys::Process::FileDescriptorIsDisplayed(FD);
+    }
+
+    // Parse the next integer into V. Returns 1, 0 at the end of the input,
+    // or -1 if the next word is not an int.
+    int next(int32_t &V)
+    {
+      char C;
+      do
+      {
+        if (Pos == End && !fill())
+          return 0;
+        C = *Pos++;
+      } while (isSpace(C));
+
+      bool Neg = C == '-';
+      if (C == '-' || C == '+')
+      {
+        if (Pos == End && !fill())
+          return -1;
+        C = *Pos++;
+      }
+      uint64_t X = 0;
+      for (;;)
+      {
+        if (C < '0' || C > '9')
+          return -1;
+        X = X * 10 + (C - '0');
+        if (X > uint64_t(INT32_MAX) + Neg)
+          return -1;
+        if (Pos == End && !fill())
+          break;
+        C = *Pos;
+        if (isSpace(C))
+          break;
+        ++Pos;
+      }
+      V = int32_t(Neg ? 0u - uint32_t(X) : uint32_t(X));
+      return 1;
+    }
+  };
+}
+
+int VM::run(const ByteCode &BC, llvm::raw_ostream &OS, int InputFD)
+{
+  // Dense frame: variables start at zero, constants are preloaded.
+  std::vector<int32_t> Frame(BC.NumRegs, 0);
+  std::copy(BC.Consts.begin(), BC.Consts.end(), Frame.begin() + BC.constBase());
+
+  if (Results == ResultFormat::Records)
+    writeResultsHeader(OS, BC.Vars);
+
+  int32_t *R = Frame.data();
+  std::vector<unsigned> Trips(BC.Loops.size(), 0);
+  const Instr *Code = BC.Code.data();
+  const Instr *IP = Code;
+  int32_t BadIndex = 0;
+  uint32_t BadSize = 0;
+  Input In(InputFD);
+  llvm::raw_ostream &PromptOS = Results == ResultFormat::Text ? OS : llvm::outs();
+  int BadRead = 0;        // what Input::next returned for the value it could not read
+  const Instr *ReadAt = nullptr;
+  uint32_t ReadElement = 0;
+
+  // Arithmetic wraps like the generated code does on the target.
+#define U(X) ((uint32_t)R[X])
+
+#if VM_COMPUTED_GOTO
+  static void *Labels[] = {
+      &&L_Move, &&L_Add, &&L_Sub, &&L_Mul, &&L_Div, &&L_Rem, &&L_Pow,
+      &&L_CmpEq, &&L_CmpNe, &&L_CmpLt, &&L_CmpGt, &&L_CmpLe, &&L_CmpGe,
+      &&L_And, &&L_Or, &&L_LoadElem, &&L_StoreElem, &&L_CheckIndex, &&L_Sum,
+      &&L_Min, &&L_Max, &&L_Jmp, &&L_JmpFalse, &&L_JmpTrue, &&L_Write,
+      &&L_Read, &&L_Loop, &&L_Halt};
+#define CASE(Name) L_##Name:
+#define NEXT() JUMP(IP + 1)
+#define DISPATCH() goto *Labels[(unsigned)IP->Op]
+#define JUMP(Target) \
+  IP = (Target);     \
+  DISPATCH()
+  DISPATCH();
+#else
+#define CASE(Name) case OpCode::Name:
+#define NEXT() JUMP(IP + 1)
+#define JUMP(Target) \
+  IP = (Target);     \
+  continue
+  for (;;)
+    switch (IP->Op)
+    {
+#endif
+
+  CASE(Move)
+  {
+    R[IP->A] = R[IP->B];
+    NEXT();
+  }
+  CASE(Add)
+  {
+    R[IP->A] = U(IP->B) + U(IP->C);
+    NEXT();
+  }
+  CASE(Sub)
+  {
+    R[IP->A] = U(IP->B) - U(IP->C);
+    NEXT();
+  }
+  CASE(Mul)
+  {
+    R[IP->A] = U(IP->B) * U(IP->C);
+    NEXT();
+  }
+  CASE(Div)
+  {
+    if (R[IP->C] == 0 || (R[IP->B] == INT32_MIN && R[IP->C] == -1))
+      goto div_error;
+    R[IP->A] = R[IP->B] / R[IP->C];
+    NEXT();
+  }
+  CASE(Rem)
+  {
+    if (R[IP->C] == 0 || (R[IP->B] == INT32_MIN && R[IP->C] == -1))
+      goto div_error;
+    R[IP->A] = R[IP->B] % R[IP->C];
+    NEXT();
+  }
+  CASE(Pow)
+  {
+    uint32_t Res = 1;
+    for (int32_t I = 0; I < (int32_t)IP->C; ++I)
+      Res *= U(IP->B);
+    R[IP->A] = Res;
+    NEXT();
+  }
+  CASE(CmpEq)
+  {
+    R[IP->A] = R[IP->B] == R[IP->C];
+    NEXT();
+  }
+  CASE(CmpNe)
+  {
+    R[IP->A] = R[IP->B] != R[IP->C];
+    NEXT();
+  }
+  CASE(CmpLt)
+  {
+    R[IP->A] = R[IP->B] < R[IP->C];
+    NEXT();
+  }
+  CASE(CmpGt)
+  {
+    R[IP->A] = R[IP->B] > R[IP->C];
+    NEXT();
+  }
+  CASE(CmpLe)
+  {
+    R[IP->A] = R[IP->B] <= R[IP->C];
+    NEXT();
+  }
+  CASE(CmpGe)
+  {
+    R[IP->A] = R[IP->B] >= R[IP->C];
+    NEXT();
+  }
+  CASE(And)
+  {
+    R[IP->A] = R[IP->B] & R[IP->C];
+    NEXT();
+  }
+  CASE(Or)
+  {
+    R[IP->A] = R[IP->B] | R[IP->C];
+    NEXT();
+  }
+  CASE(LoadElem)
+  {
+    R[IP->A] = R[IP->B + R[IP->C]];
+    NEXT();
+  }
+  CASE(StoreElem)
+  {
+    R[IP->A + R[IP->B]] = R[IP->C];
+    NEXT();
+  }
+  CASE(CheckIndex)
+  {
+    if (U(IP->A) >= IP->B)
+    {
+      BadIndex = R[IP->A];
+      BadSize = IP->B;
+      goto index_error;
+    }
+    NEXT();
+  }
+  CASE(Sum)
+  {
+    uint32_t Res = 0;
+    for (uint32_t I = 0; I < IP->C; ++I)
+      Res += U(IP->B + I);
+    R[IP->A] = Res;
+    NEXT();
+  }
+  CASE(Min)
+  {
+    R[IP->A] = *std::min_element(R + IP->B, R + IP->B + IP->C);
+    NEXT();
+  }
+  CASE(Max)
+  {
+    R[IP->A] = *std::max_element(R + IP->B, R + IP->B + IP->C);
+    NEXT();
+  }
+  CASE(Jmp)
+  {
+    JUMP(Code + IP->A);
+  }
+  CASE(JmpFalse)
+  {
+    JUMP(R[IP->A] ? IP + 1 : Code + IP->B);
+  }
+  CASE(JmpTrue)
+  {
+    JUMP(R[IP->A] ? Code + IP->B : IP + 1);
+  }
+  CASE(Write)
+  {
+    if (Results == ResultFormat::Text)
+      OS << COMPILER_RESULT_PREFIX << R[IP->A] << "\n";
+    else
+      writeResult(OS, Results, IP->B, R[IP->A]);
+    NEXT();
+  }
+  CASE(Read)
+  {
+    if (In.Prompt)
+    {
+      if (IP->B)
+        PromptOS << "Enter " << IP->B << " values for " << BC.Vars[IP->C] << ": ";
+      else
+        PromptOS << "Enter a value for " << BC.Vars[IP->C] << ": ";
+      PromptOS.flush();
+    }
+    for (uint32_t I = 0, E = std::max(IP->B, 1u); I != E; ++I)
+      if ((BadRead = In.next(R[IP->A + I])) != 1)
+      {
+        ReadAt = IP;
+        ReadElement = I;
+        goto input_error;
+      }
+    NEXT();
+  }
+  CASE(Loop)
+  {
+    // Count iterations; once the loop is hot and its native code is ready,
+    // run the rest of the loop natively on the same frame.
+    if (Tier)
+    {
+      unsigned &Trip = Trips[IP->A];
+      if (Trip < Threshold)
+      {
+        if (++Trip == Threshold)
+          Tier->compile(IP->A);
+      }
+      else if (NativeLoopFn Fn = Tier->lookup(IP->A))
+      {
+        Fn(R);
+        JUMP(Code + IP->B);
+      }
+    }
+    NEXT();
+  }
+  CASE(Halt)
+  {
+    OS.flush();
+    return 0;
+  }
+
+#if !VM_COMPUTED_GOTO
+    }
+#endif
+
+#undef CASE
+#undef NEXT
+#undef JUMP
+#undef DISPATCH
+#undef U
+
+div_error:
+  OS.flush();
+  llvm::errs() << "Error: Division by zero.\n";
+  return 1;
+
+index_error:
+  OS.flush();
+  llvm::errs() << "Error: index " << BadIndex << " is out of range for an array of " << BadSize << " elements.\n";
+  return 1;
+
+input_error:
+  OS.flush();
+  std::string Name = BC.Vars[ReadAt->C].str();
+  if (ReadAt->B)
+    Name += "[" + std::to_string(ReadElement) + "]";
+  if (BadRead == 0)
+    llvm::errs() << "Error: the input ended before a value for " << Name << ".\n";
+  else
+    llvm::errs() << "Error: the input for " << Name << " is not an integer.\n";
+  return 1;
+}
@@ -0,0 +1,44 @@
+#ifndef VM_H
+#define VM_H
+
+#include "ByteCode.h"
+#include "Results.h"
+#include "llvm/Support/raw_ostream.h"
+
+// Native code for a loop, entered at the top of its body with the frame of
+// the interpreter. It returns once the loop has exited.
+using NativeLoopFn = void (*)(int32_t *Frame);
+
+// LoopTier is the interface the VM uses to hand hot loops to a compiler.
+class LoopTier
+{
+public:
+  virtual ~LoopTier() {}
+
+  // Called once when loop LoopId crosses the iteration threshold.
+  virtual void compile(unsigned LoopId) = 0;
+
+  // Returns the native code for LoopId, or nullptr if it is not ready yet.
+  virtual NativeLoopFn lookup(unsigned LoopId) = 0;
+};
+
+class VM
+{
+  LoopTier *Tier;
+  unsigned Threshold;
+  ResultFormat Results = ResultFormat::Text;
+
+public:
+  VM(LoopTier *Tier = nullptr, unsigned Threshold = 0) : Tier(Tier), Threshold(Threshold) {}
+
+  // Write results in format F. Prompts for input then go to standard
+  // output rather than to the stream of results.
+  void setResultFormat(ResultFormat F) { Results = F; }
+
+  // Execute the program and write its results to OS. Read statements take
+  // their values from the file descriptor InputFD, or find the input empty
+  // if it is negative. Returns the process exit code.
+  int run(const ByteCode &BC, llvm::raw_ostream &OS, int InputFD = 0);
+};
+
+#endif
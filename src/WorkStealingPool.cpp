@@ -0,0 +1,62 @@
+#include "WorkStealingPool.h"
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+WorkStealingPool::WorkStealingPool(unsigned NumWorkers) : NumWorkers(NumWorkers)
+{
+  if (this->NumWorkers == 0)
+    this->NumWorkers = std::max(1u, std::thread::hardware_concurrency());
+  Queues.reset(new Queue[this->NumWorkers]);
+}
+
+bool WorkStealingPool::pop(unsigned Worker, size_t &Task)
+{
+  Queue &Q = Queues[Worker];
+  std::lock_guard<std::mutex> Guard(Q.Lock);
+  if (Q.Tasks.empty())
+    return false;
+  Task = Q.Tasks.front();
+  Q.Tasks.pop_front();
+  return true;
+}
+
+bool WorkStealingPool::steal(unsigned Thief, size_t &Task)
+{
+  for (unsigned I = 1; I < NumWorkers; ++I)
+  {
+    Queue &Victim = Queues[(Thief + I) % NumWorkers];
+    std::lock_guard<std::mutex> Guard(Victim.Lock);
+    if (Victim.Tasks.empty())
+      continue;
+    Task = Victim.Tasks.back();
+    Victim.Tasks.pop_back();
+    return true;
+  }
+  return false;
+}
+
+void WorkStealingPool::work(unsigned Worker, const TaskFn &Fn)
+{
+  // No task is added while the pool runs, so once neither the own deque nor
+  // any victim has work left, the worker is done.
+  size_t Task;
+  while (pop(Worker, Task) || steal(Worker, Task))
+    Fn(Worker, Task);
+}
+
+void WorkStealingPool::run(size_t NumTasks, const TaskFn &Fn)
+{
+  // Deal out contiguous ranges so neighbouring tasks stay on one worker.
+  for (unsigned W = 0; W < NumWorkers; ++W)
+    for (size_t T = NumTasks * W / NumWorkers, E = NumTasks * (W + 1) / NumWorkers; T < E; ++T)
+      Queues[W].Tasks.push_back(T);
+
+  // The calling thread acts as worker 0.
+  std::vector<std::thread> Threads;
+  for (unsigned W = 1; W < NumWorkers; ++W)
+    Threads.emplace_back(&WorkStealingPool::work, this, W, std::cref(Fn));
+  work(0, Fn);
+  for (std::thread &T : Threads)
+    T.join();
+}
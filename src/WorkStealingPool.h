@@ -0,0 +1,45 @@
+#ifndef WORKSTEALINGPOOL_H
+#define WORKSTEALINGPOOL_H
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+// WorkStealingPool runs a fixed set of tasks on a number of threads. The
+// tasks are dealt out to one deque per worker up front; a worker pops from
+// the front of its own deque and, once that runs dry, steals from the back
+// of the other workers' deques.
+class WorkStealingPool
+{
+public:
+  // Fn is called with the index of the worker running the task, so callers
+  // can keep per-worker state, and the index of the task.
+  using TaskFn = std::function<void(unsigned Worker, size_t Task)>;
+
+private:
+  struct Queue
+  {
+    std::mutex Lock;
+    std::deque<size_t> Tasks;
+  };
+
+  unsigned NumWorkers;
+  std::unique_ptr<Queue[]> Queues;
+
+  bool pop(unsigned Worker, size_t &Task);
+  bool steal(unsigned Thief, size_t &Task);
+  void work(unsigned Worker, const TaskFn &Fn);
+
+public:
+  // NumWorkers == 0 selects the number of hardware threads.
+  explicit WorkStealingPool(unsigned NumWorkers = 0);
+
+  unsigned size() const { return NumWorkers; }
+
+  // Run Fn for every task in [0, NumTasks) and wait until all are done.
+  void run(size_t NumTasks, const TaskFn &Fn);
+};
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef RTCOMPILER_H
+#define RTCOMPILER_H
+
+/* The text output of compiled programs, in C so that both of its
+   implementations share it: rtCompiler.c and the IR runtime that
+   src/Runtime.cpp links into programs. compiler_write(v) appends
+   COMPILER_RESULT_PREFIX, v and a newline to a buffer of
+   COMPILER_OUTPUT_BUFFER bytes, after writing the buffer out with
+   compiler_flush() if fewer than COMPILER_MAX_LINE bytes are left.
+   compiler_flush() is also called at exit, and by the runtime before it
+   prompts for input or stops the program. */
+
+#define COMPILER_OUTPUT_BUFFER (1 << 16)
+#define COMPILER_RESULT_PREFIX "The result is: "
+/* The longest line: the prefix, a sign, 10 digits and the newline. */
+#define COMPILER_MAX_LINE 32
+
+#endif